@@ -79,6 +79,7 @@ NGX_ERROR：表示错误。这时会调用ngx_http_terminate_request终止请求
 #include <ngx_queue.h>
 #include <ngx_array.h>
 #include <ngx_list.h>
+#include <ngx_btree.h>
 #include <ngx_hash.h>
 #include <ngx_file.h>
 #include <ngx_crc.h>
@@ -92,6 +93,8 @@ NGX_ERROR：表示错误。这时会调用ngx_http_terminate_request终止请求
 #include <ngx_rwlock.h>
 #include <ngx_shmtx.h>
 #include <ngx_slab.h>
+#include <ngx_shm_hash.h>
+#include <ngx_radix_shm.h>
 #include <ngx_inet.h>
 #include <ngx_cycle.h>
 #include <ngx_resolver.h>
@@ -119,6 +122,12 @@ NGX_ERROR：表示错误。这时会调用ngx_http_terminate_request终止请求
 
 void ngx_cpuinfo(void);
 
+//ngx_cpu_features中的位
+#define NGX_CPU_SSE2  0x01
+#define NGX_CPU_AVX2  0x02
+
+extern ngx_uint_t  ngx_cpu_features;
+
 #if (NGX_HAVE_OPENAT)
 #define NGX_DISABLE_SYMLINKS_OFF        0
 #define NGX_DISABLE_SYMLINKS_ON         1
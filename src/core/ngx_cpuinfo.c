@@ -8,6 +8,10 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 
+
+// CPU支持的指令集，NGX_CPU_SSE2等，在ngx_cpuinfo中检测，ngx_hash等据此在运行时选择SIMD实现
+ngx_uint_t  ngx_cpu_features;
+
 // 如果 CPU 架构是 i386 或 amd64，并且编译器是 GNU Compiler 或 Intel Compiler，则定义 cngx_puid 函数
 // 否则 ngx_cpuid 函数为空
 #if (( __i386__ || __amd64__ ) && ( __GNUC__ || __INTEL_COMPILER ))
@@ -34,6 +38,7 @@ ngx_cpuid(uint32_t i, uint32_t *buf)
 
     "    mov    %%ebx, %%esi;  "
 
+    "    xor    %%ecx, %%ecx;  "
     "    cpuid;                "
     "    mov    %%eax, (%1);   "
     "    mov    %%ebx, 4(%1);  "
@@ -58,7 +63,7 @@ ngx_cpuid(uint32_t i, uint32_t *buf)
 
         "cpuid"
 
-    : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (i) );
+    : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (i), "c" (0) );
 
     buf[0] = eax;
     buf[1] = ebx;
@@ -70,6 +75,18 @@ ngx_cpuid(uint32_t i, uint32_t *buf)
 #endif
 
 
+// 读取XCR0，看操作系统是否会保存/恢复AVX的ymm寄存器
+static ngx_inline uint32_t
+ngx_xgetbv(void)
+{
+    uint32_t  eax, edx;
+
+    __asm__ ( "xgetbv" : "=a" (eax), "=d" (edx) : "c" (0) );
+
+    return eax;
+}
+
+
 /* auto detect the L2 cache line size of modern and widespread CPUs */
 
 //知道CPU cache行的大小，那么就可以有针对性地设置内存的对齐值，这样可以提高程序的效率
@@ -78,7 +95,7 @@ ngx_cpuinfo(void)
 {
     // 存储厂商识别串，即 Vendor ID
     u_char    *vendor;
-    uint32_t   vbuf[5], cpu[4], model;
+    uint32_t   vbuf[5], cpu[4], ext[4], model;
 
     vbuf[0] = 0;
     vbuf[1] = 0;
@@ -96,6 +113,29 @@ ngx_cpuinfo(void)
 
     ngx_cpuid(1, cpu);
 
+    /*
+     * cpuid(1)的edx第26位为SSE2；
+     * AVX2需要cpuid(1)的ecx第27位(OSXSAVE)、第28位(AVX)，XCR0的第1、2位(xmm/ymm状态)，以及cpuid(7)的ebx第5位
+     * 注意ngx_cpuid返回的顺序是eax、ebx、edx、ecx
+     */
+    ngx_cpu_features = 0;
+
+    if (cpu[2] & (1 << 26)) {
+        ngx_cpu_features |= NGX_CPU_SSE2;
+    }
+
+    if (vbuf[0] >= 7
+        && (cpu[3] & (1 << 27))
+        && (cpu[3] & (1 << 28))
+        && (ngx_xgetbv() & 6) == 6)
+    {
+        ngx_cpuid(7, ext);
+
+        if (ext[1] & (1 << 5)) {
+            ngx_cpu_features |= NGX_CPU_AVX2;
+        }
+    }
+
     //Intel
     if (ngx_strcmp(vendor, "GenuineIntel") == 0) {
 
@@ -21,6 +21,12 @@ static void ngx_destroy_cycle_pools(ngx_conf_t *conf);
 
 //初始化共享内存
 static ngx_int_t ngx_init_zone_pool(ngx_cycle_t *cycle, ngx_shm_zone_t *shm_zone);
+//创建/释放共享内存，开启了hugepage时尽量用大页
+static ngx_int_t ngx_shm_alloc_zone(ngx_cycle_t *cycle, ngx_shm_zone_t *zn);
+#if (NGX_LINUX) && defined(MAP_HUGETLB)
+static size_t ngx_shm_huge_page_size(ngx_log_t *log);
+#endif
+static void ngx_shm_free_zone(ngx_shm_zone_t *zn);
 
 //nginx使用锁机制来实现accept mutex，并且顺序的来访问共享内存。在大多数的系统上，锁都是通过原子操作来实现的，
 //因此会忽略配置文件中的lock_file file指令；而对于其他的一些系统，lock file机制会被使用
@@ -514,6 +520,8 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
                 && !shm_zone[i].noreuse)
             {
                 shm_zone[i].shm.addr = oshm_zone[n].shm.addr;
+                shm_zone[i].backing = oshm_zone[n].backing;
+                shm_zone[i].huge_size = oshm_zone[n].huge_size;
 #if (NGX_WIN32)
                 shm_zone[i].shm.handle = oshm_zone[n].shm.handle;
 #endif
@@ -530,7 +538,7 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
             break;
         }
 
-        if (ngx_shm_alloc(&shm_zone[i].shm) != NGX_OK) {
+        if (ngx_shm_alloc_zone(cycle, &shm_zone[i]) != NGX_OK) {
             goto failed;
         }
 
@@ -761,7 +769,7 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
             break;
         }
 
-        ngx_shm_free(&oshm_zone[i].shm);
+        ngx_shm_free_zone(&oshm_zone[i]);
 
         live_shm_zone:
 
@@ -950,6 +958,182 @@ ngx_destroy_cycle_pools(ngx_conf_t *conf)
     ngx_destroy_pool(conf->pool);
 }
 
+/*
+ * 创建共享内存
+ * 多个worker都会访问的大块共享内存(会话、键值表)用4K页时TLB miss很多，开启hugepage后：
+ * 1. 先用MAP_HUGETLB映射，需要系统预留了足够的大页(vm.nr_hugepages)，
+ *    长度按系统默认的大页大小(/proc/meminfo的Hugepagesize)对齐
+ * 2. 失败则按普通方式映射，再用madvise(MADV_HUGEPAGE)建议内核使用透明大页
+ *    (需要/sys/kernel/mm/transparent_hugepage/shmem_enabled为advise或always)；
+ *    madvise只是建议，内核在缺页时才决定用不用大页，所以这里只能记录为advised，不能说已经用上了大页
+ * 3. 都不行就是普通页
+ * ngx_slab_init仍按ngx_pagesize切分页，大页的起始地址同样是ngx_pagesize对齐的，slab的计算不受影响
+ */
+static ngx_int_t
+ngx_shm_alloc_zone(ngx_cycle_t *cycle, ngx_shm_zone_t *zn)
+{
+#if (NGX_LINUX) && defined(MAP_HUGETLB)
+    u_char  *addr;
+    size_t   size, huge;
+#endif
+
+    zn->backing = NGX_SHM_BACKING_PAGES;
+    zn->huge_size = 0;
+
+    if (!zn->hugepage) {
+        return ngx_shm_alloc(&zn->shm);
+    }
+
+#if (NGX_LINUX) && defined(MAP_HUGETLB)
+
+    //MAP_HUGETLB用的是默认大小的大页，读不到大小时munmap的长度无法确定，直接跳过
+    huge = ngx_shm_huge_page_size(cycle->log);
+
+    if (huge) {
+        size = ngx_align(zn->shm.size, huge);
+
+        addr = (u_char *) mmap(NULL, size, PROT_READ|PROT_WRITE,
+                               MAP_ANON|MAP_SHARED|MAP_HUGETLB, -1, 0);
+
+        if (addr != MAP_FAILED) {
+            zn->shm.addr = addr;
+            zn->backing = NGX_SHM_BACKING_HUGETLB;
+            zn->huge_size = size;
+
+            ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0,
+                          "shared zone \"%V\" is backed by %uzK hugetlb pages",
+                          &zn->shm.name, huge / 1024);
+
+            return NGX_OK;
+        }
+
+        ngx_log_error(NGX_LOG_NOTICE, cycle->log, ngx_errno,
+                      "mmap(MAP_HUGETLB, %uz) for shared zone \"%V\" failed",
+                      size, &zn->shm.name);
+    }
+
+#endif
+
+    if (ngx_shm_alloc(&zn->shm) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+#if (NGX_LINUX) && defined(MADV_HUGEPAGE)
+
+    if (madvise(zn->shm.addr, zn->shm.size, MADV_HUGEPAGE) == 0) {
+        zn->backing = NGX_SHM_BACKING_THP;
+
+        ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0,
+                      "shared zone \"%V\" is advised to use transparent huge pages",
+                      &zn->shm.name);
+
+        return NGX_OK;
+    }
+
+    ngx_log_error(NGX_LOG_NOTICE, cycle->log, ngx_errno,
+                  "madvise(MADV_HUGEPAGE) for shared zone \"%V\" failed",
+                  &zn->shm.name);
+
+#endif
+
+    ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0,
+                  "shared zone \"%V\" is backed by regular pages",
+                  &zn->shm.name);
+
+    return NGX_OK;
+}
+
+
+#if (NGX_LINUX) && defined(MAP_HUGETLB)
+
+/*
+ * 系统默认的大页大小，取/proc/meminfo中的"Hugepagesize:    2048 kB"，
+ * x86_64一般是2M，arm64等平台可能是512M或者别的值；读不到时返回0
+ */
+static size_t
+ngx_shm_huge_page_size(ngx_log_t *log)
+{
+    u_char    *p, *last;
+    size_t     len;
+    ssize_t    n;
+    ngx_fd_t   fd;
+    ngx_int_t  kb;
+    u_char     buf[4096];
+
+    fd = ngx_open_file("/proc/meminfo", NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_NOTICE, log, ngx_errno,
+                      ngx_open_file_n " \"/proc/meminfo\" failed");
+        return 0;
+    }
+
+    //proc文件一次read不一定能读完
+    len = 0;
+
+    while (len < sizeof(buf) - 1) {
+        n = ngx_read_fd(fd, buf + len, sizeof(buf) - 1 - len);
+
+        if (n <= 0) {
+            break;
+        }
+
+        len += n;
+    }
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"/proc/meminfo\" failed");
+    }
+
+    buf[len] = '\0';
+
+    p = (u_char *) ngx_strstr(buf, "Hugepagesize:");
+    if (p == NULL) {
+        return 0;
+    }
+
+    for (p += sizeof("Hugepagesize:") - 1; *p == ' ' || *p == '\t'; p++) {
+        /* void */
+    }
+
+    for (last = p; *last >= '0' && *last <= '9'; last++) {
+        /* void */
+    }
+
+    kb = ngx_atoi(p, last - p);
+    if (kb == NGX_ERROR || kb == 0) {
+        return 0;
+    }
+
+    return (size_t) kb * 1024;
+}
+
+#endif
+
+
+static void
+ngx_shm_free_zone(ngx_shm_zone_t *zn)
+{
+#if (NGX_LINUX) && defined(MAP_HUGETLB)
+
+    //MAP_HUGETLB的映射munmap时长度也必须是大页的整数倍
+    if (zn->backing == NGX_SHM_BACKING_HUGETLB) {
+        if (munmap((void *) zn->shm.addr, zn->huge_size) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, zn->shm.log, ngx_errno,
+                          "munmap(%p, %uz) failed",
+                          zn->shm.addr, zn->huge_size);
+        }
+
+        return;
+    }
+
+#endif
+
+    ngx_shm_free(&zn->shm);
+}
+
+
 static ngx_int_t
 ngx_init_zone_pool(ngx_cycle_t *cycle, ngx_shm_zone_t *zn)
 {
@@ -990,6 +1174,8 @@ ngx_init_zone_pool(ngx_cycle_t *cycle, ngx_shm_zone_t *zn)
 
     sp->end = zn->shm.addr + zn->shm.size;
     sp->min_shift = 3;
+    sp->fine = zn->slab_fine ? 1 : 0;
+    sp->trace = zn->slab_trace ? 1 : 0;
     sp->addr = zn->shm.addr;
 
 #if (NGX_HAVE_ATOMIC_OPS)
@@ -1292,6 +1478,11 @@ ngx_reopen_files(ngx_cycle_t *cycle, ngx_uid_t user)
     }
 
     (void) ngx_log_redirect_stderr(cycle);
+
+#if (NGX_PALLOC_STATS)
+    //切割日志(USR1)时顺便把本进程的内存池统计写到新的日志里
+    ngx_pool_stats_dump(cycle->log);
+#endif
 }
 
 
@@ -1370,6 +1561,11 @@ ngx_shared_memory_add(ngx_conf_t *cf, ngx_str_t *name, size_t size, void *tag)
     shm_zone->init = NULL;
     shm_zone->tag = tag;
     shm_zone->noreuse = 0;
+    shm_zone->slab_fine = 0;
+    shm_zone->slab_trace = 0;
+    shm_zone->hugepage = 0;
+    shm_zone->backing = NGX_SHM_BACKING_PAGES;
+    shm_zone->huge_size = 0;
 
     return shm_zone;
 }
@@ -33,6 +33,11 @@
 
 typedef struct ngx_shm_zone_s ngx_shm_zone_t;
 
+//共享内存实际使用的页，见ngx_shm_zone_t的backing
+#define NGX_SHM_BACKING_PAGES    0 //普通的4K页
+#define NGX_SHM_BACKING_HUGETLB  1 //mmap(MAP_HUGETLB)，使用预留的大页
+#define NGX_SHM_BACKING_THP      2 //普通映射加madvise(MADV_HUGEPAGE)，只是建议内核用透明大页，实际用没用上由内核决定
+
 typedef ngx_int_t (*ngx_shm_zone_init_pt) (ngx_shm_zone_t *zone, void *data);
 
 //所有的共享内存都通过ngx_http_file_cache_s->shpool进行管理
@@ -47,6 +52,16 @@ struct ngx_shm_zone_s {
     ngx_shm_zone_init_ptngx_shm_zone_init_pt init;
     void *tag; //创建的这个共享内存属于哪个模块
     ngx_uint_t noreuse;//取值为0时，则表示可以对此共享内存进行复用；否则不能对此共享内存进行复用。一般用在系统升级时，表示是否可以复用前面创建的共享内存
+    //为1时slab使用更细的chunk分级(ngx_slab_pool_t的fine)，由创建共享内存的模块在ngx_shared_memory_add之后设置
+    ngx_uint_t slab_fine;
+    //为1时在共享内存里记录slab的跟踪信息，见ngx_slab_trace_t
+    ngx_uint_t slab_trace;
+    //为1时尝试用大页创建这块共享内存，先MAP_HUGETLB，失败再用透明大页，都不行就用普通页
+    ngx_uint_t hugepage;
+    //实际使用的页，NGX_SHM_BACKING_*
+    ngx_uint_t backing;
+    //MAP_HUGETLB时实际映射的长度(按/proc/meminfo的Hugepagesize对齐)，munmap要用
+    size_t huge_size;
 };
 
 // nginx核心数据结构，表示nginx的生命周期，含有许多重要参数
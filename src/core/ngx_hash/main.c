@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <time.h>
 #include <ngx_config.h>
 #include <ngx_core.h>
 
@@ -6,6 +7,8 @@
 #define Max_Num 13
 #define Max_Size 1024
 #define Bucket_Size 64  //256, 64
+//bench里max_size取key个数的2倍，和实际配置一样给一个上限，ngx_hash_init的test数组是max_size个u_short
+#define Bench_Max_Size (2 * 1024 * 1024)
 
 #define NGX_HASH_ELT_SIZE(name)               \
     (sizeof(void *) + ngx_align((name)->key.len + 2, sizeof(void *)))
@@ -57,6 +60,7 @@ static ngx_str_t urls2[Max_Num2] = {
 };
 
 void* init_hash(ngx_pool_t *pool, ngx_hash_keys_arrays_t *ha, ngx_hash_combined_t *hash);
+void* init_trie(ngx_pool_t *pool, ngx_hash_keys_arrays_t *ha, ngx_hash_trie_t *trie);
 void dump_pool(ngx_pool_t* pool);
 void dump_hash_array(ngx_array_t* a);
 void dump_combined_hash(ngx_hash_combined_t *hash, ngx_hash_keys_arrays_t *array);
@@ -64,6 +68,11 @@ void dump_hash(ngx_hash_t *hash, ngx_array_t *array);
 void* add_urls_to_array(ngx_pool_t *pool, ngx_hash_keys_arrays_t *ha, ngx_array_t *url, ngx_array_t *value);
 void find_test(ngx_hash_combined_t *hash, ngx_str_t addr[], int num);
 void dump_hash_wildcard(ngx_hash_wildcard_t *wc_hash, ngx_uint_t deepth);
+void bench_hash_init(ngx_uint_t nelts, ngx_uint_t max_size);
+void bench_hash_func(char *corpus, ngx_str_t *names, ngx_uint_t n,
+    char *func, ngx_hash_key_pt key);
+void bench_hash_funcs(void);
+void bench_hash_batch(ngx_uint_t nelts, ngx_uint_t batch);
 
 /* for passing compiling */
 volatile ngx_cycle_t  *ngx_cycle;
@@ -86,11 +95,13 @@ int main(/* int argc, char **argv */)
     ngx_pool_t *pool = NULL;
     ngx_hash_keys_arrays_t array;
     ngx_hash_combined_t hash;
+    ngx_hash_trie_t trie;
     ngx_int_t loop;
     ngx_array_t *url, *value;
     ngx_str_t *temp;
 
     hash.wc_head = hash.wc_tail = NULL;
+    hash.trie = NULL;
 
     printf("--------------------------------\n");
     printf("create a new pool:\n");
@@ -169,6 +180,48 @@ int main(/* int argc, char **argv */)
 
     find_test(&hash, urls2, Max_Num2);
 
+    //trie find test，结果应该和上面完全一样
+    printf("--------------------------------\n");
+    printf("trie find test:\n");
+    printf("--------------------------------\n");
+    if (init_trie(pool, &array, &trie) == NULL)
+    {
+        printf("Failed to initialize trie!\n");
+        return -1;
+    }
+    printf("trie nodes = %lu\n", (unsigned long) trie.nnodes);
+    hash.trie = &trie;
+    find_test(&hash, urls, Max_Num);
+    printf("\n");
+
+    find_test(&hash, urls2, Max_Num2);
+    hash.trie = NULL;
+
+    //build time test
+    printf("--------------------------------\n");
+    printf("ngx_hash_init build time:\n");
+    printf("--------------------------------\n");
+    bench_hash_init(10000, 10000 * 2);
+    bench_hash_init(100000, 100000 * 2);
+    bench_hash_init(1000000, 1000000 * 2);
+    //max_size是key个数的100倍以上，从估计的最小值开始搜索，超过NGX_HASH_LINEAR_TRIES次后跳着试
+    bench_hash_init(10000, 10000 * 200);
+    bench_hash_init(100000, 100000 * 100);
+
+    //hash function test
+    printf("--------------------------------\n");
+    printf("hash function (bkdr vs wyhash):\n");
+    printf("--------------------------------\n");
+    bench_hash_funcs();
+
+    //batch lookup test
+    printf("--------------------------------\n");
+    printf("ngx_hash_find vs ngx_hash_find_n:\n");
+    printf("--------------------------------\n");
+    bench_hash_batch(1000, 16);
+    bench_hash_batch(1000000, 16);
+    bench_hash_batch(1000000, 64);
+
     //release
     return 0;
 }
@@ -229,6 +282,23 @@ void* init_hash(ngx_pool_t *pool, ngx_hash_keys_arrays_t *ha, ngx_hash_combined_
     return NULL;
 }
 
+void* init_trie(ngx_pool_t *pool, ngx_hash_keys_arrays_t *ha, ngx_hash_trie_t *trie)
+{
+    ngx_hash_init_t hinit;
+
+    hinit.hash = NULL;
+    hinit.key = &ngx_hash_key_lc;
+    hinit.name = "server_names_trie";
+    hinit.pool = pool;
+    hinit.temp_pool = ha->temp_pool;
+
+    if (ngx_hash_trie_init(trie, &hinit, ha) != NGX_OK) {
+        return NULL;
+    }
+
+    return trie;
+}
+
 void dump_pool(ngx_pool_t* pool)
 {
     while (pool)
@@ -420,6 +490,347 @@ void find_test(ngx_hash_combined_t *hash, ngx_str_t addr[], int num)
     }
 }
 
+/**
+ * 生成nelts个类似server_name的key，统计ngx_hash_init的耗时
+ * max_size取key个数的小倍数(和实际配置一样)时，key多于10000个ngx_hash_init直接从max_size - 1000开始试；
+ * max_size是key个数的100倍以上时才会从估计的最小值开始，逐个试完NGX_HASH_LINEAR_TRIES个后跳着试
+ */
+void bench_hash_init(ngx_uint_t nelts, ngx_uint_t max_size)
+{
+    u_char *name;
+    ngx_uint_t i, used;
+    ngx_pool_t *pool;
+    ngx_hash_t hash;
+    ngx_hash_key_t *keys;
+    ngx_hash_init_t hinit;
+    struct timespec start, end;
+
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, &ngx_log);
+    keys = ngx_palloc(pool, nelts * sizeof(ngx_hash_key_t));
+
+    for (i = 0; i < nelts; i++) {
+        name = ngx_palloc(pool, 32);
+        keys[i].key.data = name;
+        keys[i].key.len = sprintf((char *) name, "www.host%lu.example.com",
+                                  (unsigned long) i);
+        keys[i].key_hash = ngx_hash_key_lc(name, keys[i].key.len);
+        keys[i].value = &keys[i];
+    }
+
+    ngx_cacheline_size = 64;
+    hinit.hash = &hash;
+    hinit.key = &ngx_hash_key_lc;
+    hinit.max_size = max_size;
+    hinit.bucket_size = 128;
+    hinit.name = "bench_hash";
+    hinit.pool = pool;
+    hinit.temp_pool = NULL;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (ngx_hash_init(&hinit, keys, nelts) != NGX_OK) {
+        printf("Failed to initialize hash for %lu keys!\n", (unsigned long) nelts);
+        ngx_destroy_pool(pool);
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    for (i = 0, used = 0; i < hash.size; i++) {
+        if (hash.buckets[i]) {
+            used++;
+        }
+    }
+
+    printf("keys = %-8lu max_size = %-9lu buckets = %-9lu used = %-8lu "
+           "time = %.3f ms\n",
+           (unsigned long) nelts, (unsigned long) max_size,
+           (unsigned long) hash.size,
+           (unsigned long) used,
+           (end.tv_sec - start.tv_sec) * 1000.0
+           + (end.tv_nsec - start.tv_nsec) / 1000000.0);
+
+    ngx_destroy_pool(pool);
+}
+
+/**
+ * 表里有nelts个key，按随机顺序查找全部key，每batch个key调用一次ngx_hash_find_n，
+ * 和逐个ngx_hash_find比较；1000个key的表在L1/L2里，1000000个key的表有几十MB
+ */
+void bench_hash_batch(ngx_uint_t nelts, ngx_uint_t batch)
+{
+    u_char *name;
+    void **values;
+    uintptr_t sum1, sum2;
+    ngx_uint_t i, j, *qkeys;
+    ngx_str_t *qnames;
+    ngx_pool_t *pool;
+    ngx_hash_t hash;
+    ngx_hash_key_t *keys, tmp;
+    ngx_hash_init_t hinit;
+    struct timespec start, end;
+    double single, batched;
+
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, &ngx_log);
+    keys = ngx_palloc(pool, nelts * sizeof(ngx_hash_key_t));
+
+    for (i = 0; i < nelts; i++) {
+        name = ngx_palloc(pool, 32);
+        keys[i].key.data = name;
+        keys[i].key.len = sprintf((char *) name, "www.host%lu.example.com",
+                                  (unsigned long) i);
+        keys[i].key_hash = ngx_hash_key_lc(name, keys[i].key.len);
+        keys[i].value = &keys[i];
+    }
+
+    ngx_cacheline_size = 64;
+    hinit.hash = &hash;
+    hinit.key = &ngx_hash_key_lc;
+    hinit.max_size = ngx_min(nelts * 2, Bench_Max_Size);
+    hinit.bucket_size = 128;
+    hinit.name = "bench_batch";
+    hinit.pool = pool;
+    hinit.temp_pool = NULL;
+
+    if (ngx_hash_init(&hinit, keys, nelts) != NGX_OK) {
+        printf("Failed to initialize hash for %lu keys!\n", (unsigned long) nelts);
+        ngx_destroy_pool(pool);
+        return;
+    }
+
+    //打乱查找顺序，避免按插入顺序访问时的局部性
+    srand(1);
+    for (i = nelts - 1; i > 0; i--) {
+        j = (((ngx_uint_t) rand() << 16) ^ rand()) % (i + 1);
+        tmp = keys[i];
+        keys[i] = keys[j];
+        keys[j] = tmp;
+    }
+
+    qkeys = ngx_palloc(pool, nelts * sizeof(ngx_uint_t));
+    qnames = ngx_palloc(pool, nelts * sizeof(ngx_str_t));
+    values = ngx_palloc(pool, batch * sizeof(void *));
+
+    for (i = 0; i < nelts; i++) {
+        qkeys[i] = keys[i].key_hash;
+        qnames[i] = keys[i].key;
+    }
+
+    sum1 = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i = 0; i < nelts; i++) {
+        sum1 += (uintptr_t) ngx_hash_find(&hash, qkeys[i], qnames[i].data,
+                                          qnames[i].len);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    single = ((end.tv_sec - start.tv_sec) * 1e9
+              + (end.tv_nsec - start.tv_nsec)) / nelts;
+
+    sum2 = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i = 0; i < nelts; i += batch) {
+        ngx_hash_find_n(&hash, &qkeys[i], &qnames[i], values,
+                        ngx_min(batch, nelts - i));
+
+        for (j = 0; j < batch && i + j < nelts; j++) {
+            sum2 += (uintptr_t) values[j];
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    batched = ((end.tv_sec - start.tv_sec) * 1e9
+               + (end.tv_nsec - start.tv_nsec)) / nelts;
+
+    printf("keys = %-8lu buckets = %-8lu batch = %-3lu single = %6.1f ns "
+           "batch = %6.1f ns speedup = %.2f %s\n",
+           (unsigned long) nelts, (unsigned long) hash.size,
+           (unsigned long) batch, single, batched, single / batched,
+           sum1 == sum2 ? "" : "(MISMATCH)");
+
+    ngx_destroy_pool(pool);
+}
+
+/* 常见的请求/响应头，ngx_http_headers_in/out里的那些 */
+static char *header_names[] = {
+    "Host", "Connection", "If-Modified-Since", "If-Unmodified-Since",
+    "If-Match", "If-None-Match", "User-Agent", "Referer", "Content-Length",
+    "Content-Range", "Content-Type", "Range", "If-Range",
+    "Transfer-Encoding", "TE", "Expect", "Upgrade", "Accept-Encoding", "Via",
+    "Authorization", "Keep-Alive", "X-Forwarded-For", "X-Real-IP", "Accept",
+    "Accept-Language", "Depth", "Destination", "Overwrite", "Date", "Cookie",
+    "Server", "Last-Modified", "Content-Encoding", "Location", "Refresh",
+    "Accept-Ranges", "WWW-Authenticate", "Expires", "Cache-Control", "ETag",
+    "Link", "Set-Cookie", "Pragma", "Vary", "X-Accel-Redirect",
+    "X-Accel-Expires", "X-Accel-Limit-Rate", "X-Accel-Buffering",
+    "X-Accel-Charset", "Status", "Content-Disposition", "Origin",
+    "Access-Control-Allow-Origin", "Access-Control-Request-Method",
+    "Access-Control-Request-Headers", "Strict-Transport-Security",
+    "X-Frame-Options", "X-Content-Type-Options", "X-Requested-With",
+    "Sec-WebSocket-Key", "Sec-WebSocket-Version", "Sec-Fetch-Mode",
+    "Sec-Fetch-Site", "Sec-Fetch-Dest", "Upgrade-Insecure-Requests",
+    "DNT", "Proxy-Authorization", "Proxy-Connection", "Max-Forwards",
+    "Alt-Svc", "Age", "Allow", "Retry-After", "Content-Language",
+    "Content-Location", "Content-Security-Policy", "Forwarded",
+    "X-Forwarded-Proto", "X-Forwarded-Host", "X-Request-ID", NULL
+};
+
+/* 访问量靠前的一些域名，前面再加上常见的主机名前缀组成server_name */
+static char *host_domains[] = {
+    "google.com", "youtube.com", "facebook.com", "baidu.com", "wikipedia.org",
+    "qq.com", "taobao.com", "yahoo.com", "tmall.com", "amazon.com",
+    "twitter.com", "sohu.com", "jd.com", "live.com", "instagram.com",
+    "sina.com.cn", "weibo.com", "reddit.com", "360.cn", "vk.com",
+    "linkedin.com", "netflix.com", "microsoft.com", "bing.com", "ebay.com",
+    "github.com", "stackoverflow.com", "apple.com", "office.com", "zoom.us",
+    "163.com", "csdn.net", "aliexpress.com", "alipay.com", "naver.com",
+    "yandex.ru", "msn.com", "twitch.tv", "imdb.com", "wordpress.com",
+    "tiktok.com", "pinterest.com", "paypal.com", "adobe.com", "dropbox.com",
+    "bilibili.com", "xinhuanet.com", "cnn.com", "nytimes.com", "bbc.co.uk",
+    "espn.com", "spotify.com", "cloudflare.com", "salesforce.com",
+    "booking.com", "tumblr.com", "quora.com", "medium.com", "etsy.com",
+    "walmart.com", "chase.com", "indeed.com", "imgur.com", "fandom.com",
+    "douban.com", "zhihu.com", "iqiyi.com", "youku.com", "ifeng.com",
+    "people.com.cn", "gitee.com", "aliyun.com", "nginx.org", "debian.org",
+    "mozilla.org", "apache.org", "python.org", "golang.org", "rust-lang.org",
+    "example.com", NULL
+};
+
+static char *host_prefixes[] = {
+    "", "www.", "m.", "api.", "cdn.", "static.", "img.", "mail.", NULL
+};
+
+
+/**
+ * 用给定的哈希函数对一组key建表，统计每个桶的元素个数和查找耗时
+ * max_size取key的个数，让两种函数在差不多的桶数下比较；
+ * 探测长度是命中时在桶里比较了几个元素，越小越好
+ */
+void bench_hash_func(char *corpus, ngx_str_t *names, ngx_uint_t n,
+    char *func, ngx_hash_key_pt key)
+{
+    ngx_uint_t i, r, len, max, used, probes, hist[5];
+    ngx_pool_t *pool;
+    ngx_hash_t hash;
+    ngx_hash_key_t *keys;
+    ngx_hash_elt_t *elt;
+    ngx_hash_init_t hinit;
+    struct timespec start, end;
+    volatile uintptr_t found;
+
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, &ngx_log);
+    keys = ngx_palloc(pool, n * sizeof(ngx_hash_key_t));
+
+    for (i = 0; i < n; i++) {
+        keys[i].key = names[i];
+        keys[i].key_hash = key(names[i].data, names[i].len);
+        keys[i].value = &keys[i];
+    }
+
+    ngx_cacheline_size = 64;
+    hinit.hash = &hash;
+    hinit.key = key;
+    hinit.max_size = n;
+    hinit.bucket_size = 128;
+    hinit.name = func;
+    hinit.pool = pool;
+    hinit.temp_pool = NULL;
+
+    if (ngx_hash_init(&hinit, keys, n) != NGX_OK) {
+        printf("Failed to initialize hash!\n");
+        ngx_destroy_pool(pool);
+        return;
+    }
+
+    max = 0;
+    used = 0;
+    probes = 0;
+    ngx_memzero(hist, sizeof(hist));
+
+    for (i = 0; i < hash.size; i++) {
+        len = 0;
+
+        for (elt = hash.buckets[i]; elt && elt->value; len++) {
+            probes += len + 1;
+            elt = (ngx_hash_elt_t *) ngx_align_ptr(&elt->name[0] + elt->len,
+                                                   sizeof(void *));
+        }
+
+        used += len ? 1 : 0;
+        max = ngx_max(max, len);
+        hist[ngx_min(len, 4)]++;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    found = 0;
+
+    for (r = 0; r < 2000; r++) {
+        for (i = 0; i < n; i++) {
+            found += (uintptr_t) ngx_hash_find(&hash,
+                                               key(names[i].data, names[i].len),
+                                               names[i].data, names[i].len);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    printf("%-8s %-7s keys = %-4lu buckets = %-4lu used = %-4lu "
+           "len 0/1/2/3/4+ = %lu/%lu/%lu/%lu/%lu max = %lu probe = %.2f "
+           "lookup = %.1f ns\n",
+           corpus, func, (unsigned long) n, (unsigned long) hash.size,
+           (unsigned long) used, (unsigned long) hist[0],
+           (unsigned long) hist[1], (unsigned long) hist[2],
+           (unsigned long) hist[3], (unsigned long) hist[4],
+           (unsigned long) max,
+           (double) probes / n,
+           ((end.tv_sec - start.tv_sec) * 1e9
+            + (end.tv_nsec - start.tv_nsec)) / (2000.0 * n));
+
+    ngx_destroy_pool(pool);
+}
+
+
+void bench_hash_funcs(void)
+{
+    u_char *p;
+    ngx_uint_t i, j, n;
+    ngx_str_t *names;
+    ngx_pool_t *pool;
+
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, &ngx_log);
+    names = ngx_palloc(pool, 1024 * sizeof(ngx_str_t));
+
+    //key需要是小写的，和ngx_hash_init里存进去的一致
+    for (n = 0; header_names[n]; n++) {
+        names[n].len = ngx_strlen(header_names[n]);
+        names[n].data = ngx_palloc(pool, names[n].len);
+        ngx_strlow(names[n].data, (u_char *) header_names[n], names[n].len);
+    }
+
+    bench_hash_func("headers", names, n, "bkdr", ngx_hash_key_lc);
+    bench_hash_func("headers", names, n, "wyhash", ngx_hash_key_wy_lc);
+
+    n = 0;
+
+    for (i = 0; host_prefixes[i]; i++) {
+        for (j = 0; host_domains[j]; j++) {
+            p = ngx_palloc(pool, 64);
+            names[n].data = p;
+            names[n].len = sprintf((char *) p, "%s%s",
+                                   host_prefixes[i], host_domains[j]);
+            n++;
+        }
+    }
+
+    bench_hash_func("hosts", names, n, "bkdr", ngx_hash_key_lc);
+    bench_hash_func("hosts", names, n, "wyhash", ngx_hash_key_wy_lc);
+
+    ngx_destroy_pool(pool);
+}
+
 /*
 --------------------------------
 create a new pool:
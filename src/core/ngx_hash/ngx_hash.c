@@ -15,26 +15,134 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 
-//通过给定的key和name在hash表中查找对应的<name,value>键值对，并将查找到的value值返回，参数中的key是name通过hash计算出来的。
-// 这个函数的实现很简单，就是通过key找到要查找的键值对在哪个桶中，然后遍历这个桶中的每个元素找key等于name的元素
-void *
-ngx_hash_find(ngx_hash_t *hash, ngx_uint_t key, u_char *name, size_t len)
+
+/*
+ * amd64上用SSE2/AVX2一次处理16/32字节，按ngx_cpu_features在运行时选择，标量版本仍是后备
+ * AVX2的函数用target属性单独编译，不需要整个文件加-mavx2
+ * ngx_hash(key, c)是 key * 31 + c，按块展开后
+ *   key' = key * 31^n + c[0] * 31^(n-1) + ... + c[n-1] * 31^0  (mod 2^64)
+ * 每一项互不依赖，结果和逐字节计算完全相同
+ */
+#if (__amd64__ && __GNUC__)
+
+#define NGX_HASH_SIMD  1
+
+#include <immintrin.h>
+
+/* ngx_hash_pow[i] = 31^(32 - i) mod 2^64，按块的第i个字节取 ngx_hash_pow + (32 - n) + i + 1 */
+static const uint64_t  ngx_hash_pow[33] = {
+    0x32f3abd77dd7bc01, 0xbf943f5988303fdf, 0x79caf9c914e8c841,
+    0x357a291700acab9f, 0xe8f36cae294fe481, 0x49943d4ff0d1075f,
+    0x6dba7597395110c1, 0x6ee4fb8901d9531f, 0xb941316784304d01,
+    0x9a9f0197fc018edf, 0x1dc310914a319941, 0x4b485b5f8685ba9f,
+    0x0aafc0e20c98f581, 0xe7920e7ae7a1d65f, 0xaca19d5ecdaa61c1,
+    0x47a21dd9c491e21f, 0xafbae83050a9de01, 0x0ded414be191dddf,
+    0x08b5129f59db6a41, 0x52dc8cfce1ddc99f, 0x0aee5720ee830681,
+    0x005a44e007b1a55f, 0x0002e97294e4b2c1, 0x0000180bf449711f,
+    0x000000c694446f01, 0x0000000667e12cdf, 0x0000000034e63b41,
+    0x0000000001b4d89f, 0x00000000000e1781, 0x000000000000745f,
+    0x00000000000003c1, 0x000000000000001f, 0x0000000000000001
+};
+
+static ngx_uint_t ngx_hash_key_lc_sse2(u_char *data, size_t len);
+static ngx_uint_t ngx_hash_strlow_sse2(u_char *dst, u_char *src, size_t n);
+static ngx_uint_t ngx_hash_key_lc_avx2(u_char *data, size_t len);
+static ngx_uint_t ngx_hash_strlow_avx2(u_char *dst, u_char *src, size_t n);
+static ngx_uint_t ngx_hash_eq_avx2(u_char *s1, u_char *s2, size_t len);
+
+
+//16字节转小写，和ngx_tolower一样只处理'A'-'Z'，大于0x7f的字节按有符号比较是负数，不会被改
+static ngx_inline __m128i
+ngx_hash_lc16(__m128i v)
 {
-    ngx_uint_t i;
-    ngx_hash_elt_t *elt;
+    __m128i  upper;
 
-    //由key找到所在的bucket(该bucket中保存其elts地址)
-    elt = hash->buckets[key % hash->size];
+    upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)),
+                          _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
 
-    if (elt == NULL) {
-        return NULL;
+    return _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+
+//已经转成小写的16字节p并入key
+static ngx_inline ngx_uint_t
+ngx_hash_block16(ngx_uint_t key, u_char *p)
+{
+    const uint64_t  *pw;
+
+    pw = ngx_hash_pow + 17;
+
+    return key * ngx_hash_pow[16]
+           + (p[0] * pw[0] + p[1] * pw[1] + p[2] * pw[2] + p[3] * pw[3])
+           + (p[4] * pw[4] + p[5] * pw[5] + p[6] * pw[6] + p[7] * pw[7])
+           + (p[8] * pw[8] + p[9] * pw[9] + p[10] * pw[10] + p[11] * pw[11])
+           + (p[12] * pw[12] + p[13] * pw[13] + p[14] * pw[14]
+              + p[15] * pw[15]);
+}
+
+
+//比较长度都是len(>=16)的两个字符串，最后不满16字节的部分和前面重叠着比较，不会越界读
+static ngx_inline ngx_uint_t
+ngx_hash_eq_sse2(u_char *s1, u_char *s2, size_t len)
+{
+    size_t   i;
+    __m128i  a, b;
+
+    for (i = 0; i + 16 < len; i += 16) {
+        a = _mm_loadu_si128((__m128i *) (s1 + i));
+        b = _mm_loadu_si128((__m128i *) (s2 + i));
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) != 0xffff) {
+            return 0;
+        }
     }
 
+    a = _mm_loadu_si128((__m128i *) (s1 + len - 16));
+    b = _mm_loadu_si128((__m128i *) (s2 + len - 16));
+
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) == 0xffff;
+}
+
+#endif
+
+#if (__GNUC__)
+#define ngx_hash_prefetch(p)  __builtin_prefetch(p)
+#else
+#define ngx_hash_prefetch(p)
+#endif
+
+//ngx_hash_find_n一组处理的key个数，每个key有两次预取，太多会超过CPU能同时处理的cache miss数
+#define NGX_HASH_BATCH  16
+
+
+//在elt开始的桶里找name
+static ngx_inline void *
+ngx_hash_find_elt(ngx_hash_elt_t *elt, u_char *name, size_t len)
+{
+    ngx_uint_t i;
+
     while (elt->value) {
         if (len != (size_t) elt->len) { //先判断长度
             goto next;
         }
 
+#if (NGX_HASH_SIMD)
+
+        //长的key一次比较16/32字节
+        if (len >= 16 && (ngx_cpu_features & NGX_CPU_SSE2)) {
+
+            if ((len >= 32 && (ngx_cpu_features & NGX_CPU_AVX2))
+                ? ngx_hash_eq_avx2(name, elt->name, len)
+                : ngx_hash_eq_sse2(name, elt->name, len))
+            {
+                return elt->value;
+            }
+
+            goto next;
+        }
+
+#endif
+
         for (i = 0; i < len; i++) {
             if (name[i] != elt->name[i]) { //接着比较name的内容(此处按字符匹配)
                 goto next;
@@ -53,6 +161,62 @@ ngx_hash_find(ngx_hash_t *hash, ngx_uint_t key, u_char *name, size_t len)
     return NULL;
 }
 
+
+//通过给定的key和name在hash表中查找对应的<name,value>键值对，并将查找到的value值返回，参数中的key是name通过hash计算出来的。
+// 这个函数的实现很简单，就是通过key找到要查找的键值对在哪个桶中，然后遍历这个桶中的每个元素找key等于name的元素
+void *
+ngx_hash_find(ngx_hash_t *hash, ngx_uint_t key, u_char *name, size_t len)
+{
+    ngx_hash_elt_t *elt;
+
+    //由key找到所在的bucket(该bucket中保存其elts地址)
+    elt = hash->buckets[key % hash->size];
+
+    if (elt == NULL) {
+        return NULL;
+    }
+
+    return ngx_hash_find_elt(elt, name, len);
+}
+
+
+/*
+ * 一次查n个key，结果放到values[i]，和逐个调用ngx_hash_find相同。
+ * 逐个查时每个key都要先等buckets[]的cache miss，再等桶里元素的cache miss；
+ * 这里每NGX_HASH_BATCH个一组，先算出所有桶的地址并预取，再取出所有桶的第一个元素并预取，
+ * 最后才比较，这样一组里的cache miss是同时进行的
+ */
+void
+ngx_hash_find_n(ngx_hash_t *hash, ngx_uint_t *keys, ngx_str_t *names,
+    void **values, ngx_uint_t n)
+{
+    ngx_uint_t i, j, m;
+    ngx_hash_elt_t *elt[NGX_HASH_BATCH], **bucket[NGX_HASH_BATCH];
+
+    for (i = 0; i < n; i += m) {
+        m = ngx_min(n - i, NGX_HASH_BATCH);
+
+        for (j = 0; j < m; j++) {
+            bucket[j] = &hash->buckets[keys[i + j] % hash->size];
+            ngx_hash_prefetch(bucket[j]);
+        }
+
+        for (j = 0; j < m; j++) {
+            elt[j] = *bucket[j];
+
+            if (elt[j]) {
+                ngx_hash_prefetch(elt[j]);
+            }
+        }
+
+        for (j = 0; j < m; j++) {
+            values[i + j] = elt[j] ? ngx_hash_find_elt(elt[j], names[i + j].data,
+                                                       names[i + j].len)
+                                   : NULL;
+        }
+    }
+}
+
 //根据name在前缀通配符hash中查找对应的value值
 void *
 ngx_hash_find_wc_head(ngx_hash_wildcard_t *hwc, u_char *name, size_t len)
@@ -200,6 +364,10 @@ ngx_hash_find_combined(ngx_hash_combined_t *hash, ngx_uint_t key, u_char *name,
 {
     void *value;
 
+    if (hash->trie) {
+        return len ? ngx_hash_trie_find(hash->trie, name, len) : NULL;
+    }
+
     if (hash->hash.buckets) {
         value = ngx_hash_find(&hash->hash, key, name, len);
 
@@ -233,24 +401,192 @@ ngx_hash_find_combined(ngx_hash_combined_t *hash, ngx_uint_t key, u_char *name,
     return NULL;
 }
 
+
+//在node的子节点里二分查找label，子节点按ngx_hash_trie_cmp的顺序排列，即按字节比较，短的在前
+static ngx_inline ngx_hash_trie_node_t *
+ngx_hash_trie_child(ngx_hash_trie_t *trie, ngx_hash_trie_node_t *node,
+    u_char *name, size_t len)
+{
+    ngx_int_t rc;
+    ngx_uint_t lo, hi, mid;
+    ngx_hash_trie_node_t *child;
+
+    lo = node->child;
+    hi = lo + node->nchild;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        child = &trie->nodes[mid];
+
+        rc = ngx_memcmp(name, trie->labels + child->label,
+                        ngx_min(len, child->len));
+
+        if (rc == 0) {
+            if (len == child->len) {
+                return child;
+            }
+
+            rc = (len < child->len) ? -1 : 1;
+        }
+
+        if (rc < 0) {
+            hi = mid;
+
+        } else {
+            lo = mid + 1;
+        }
+    }
+
+    return NULL;
+}
+
+
+/*
+ * 先从右往左走head树，每经过一个带wc_value的节点且name前面还有label，就记下来作为候选(越深越长)，
+ * 走完整个name时节点上有value就是精确匹配(或".example.com"匹配"example.com")，直接返回；
+ * 否则返回最长的前置通配，都没有时再从左往右走一遍tail树
+ */
+void *
+ngx_hash_trie_find(ngx_hash_trie_t *trie, u_char *name, size_t len)
+{
+    void *value;
+    size_t start, end;
+    ngx_hash_trie_node_t *node;
+
+    value = NULL;
+    node = &trie->nodes[0];
+    end = len;
+
+    for ( ;; ) {
+        start = end;
+
+        while (start && name[start - 1] != '.') {
+            start--;
+        }
+
+        node = ngx_hash_trie_child(trie, node, &name[start], end - start);
+
+        if (node == NULL) {
+            break;
+        }
+
+        if (start == 0) {
+            if (node->value) {
+                return node->value;
+            }
+
+            break;
+        }
+
+        if (node->wc_value) {
+            value = node->wc_value;
+        }
+
+        end = start - 1;
+    }
+
+    if (value) {
+        return value;
+    }
+
+    //"www.example.*"要求example后面还有'.'
+    node = &trie->nodes[1];
+    start = 0;
+
+    for ( ;; ) {
+        for (end = start; end < len && name[end] != '.'; end++) { /* void */ }
+
+        if (end == len) {
+            break;
+        }
+
+        node = ngx_hash_trie_child(trie, node, &name[start], end - start);
+
+        if (node == NULL) {
+            break;
+        }
+
+        if (node->wc_value) {
+            value = node->wc_value;
+        }
+
+        start = end + 1;
+    }
+
+    return value;
+}
+
+//精确匹配用ngx_hash_find_n批量查，没找到的再逐个查通配符表
+void
+ngx_hash_find_combined_n(ngx_hash_combined_t *hash, ngx_uint_t *keys,
+    ngx_str_t *names, void **values, ngx_uint_t n)
+{
+    ngx_uint_t i;
+
+    if (hash->trie == NULL && hash->hash.buckets) {
+        ngx_hash_find_n(&hash->hash, keys, names, values, n);
+
+    } else {
+        ngx_memzero(values, n * sizeof(void *));
+    }
+
+    for (i = 0; i < n; i++) {
+
+        if (values[i] || names[i].len == 0) {
+            continue;
+        }
+
+        if (hash->trie) {
+            values[i] = ngx_hash_trie_find(hash->trie, names[i].data,
+                                           names[i].len);
+            continue;
+        }
+
+        if (hash->wc_head && hash->wc_head->hash.buckets) {
+            values[i] = ngx_hash_find_wc_head(hash->wc_head, names[i].data,
+                                              names[i].len);
+        }
+
+        if (values[i] == NULL && hash->wc_tail && hash->wc_tail->hash.buckets) {
+            values[i] = ngx_hash_find_wc_tail(hash->wc_tail, names[i].data,
+                                              names[i].len);
+        }
+    }
+}
+
 /* 根据传入的name ( ngx_hash_key_t * ) 计算对应的ngx_hash_elt_t大小, */
 // name->key.len 等于 ngx_hash_elt_t->name数组长度
 // 2代表ngx_hash_elt_t-->len ( short )长度
 #define NGX_HASH_ELT_SIZE(name) \
     (sizeof(void *) + ngx_align((name)->key.len + 2, sizeof(void *)))
 
+//逐个尝试的size个数，之后按size/NGX_HASH_STEP_RATIO跳着试
+#define NGX_HASH_LINEAR_TRIES  1000
+#define NGX_HASH_STEP_RATIO    1024
+//失败时累加过的桶少于size/NGX_HASH_CLEAR_RATIO个才逐个清，否则整段清零
+#define NGX_HASH_CLEAR_RATIO   32
+
+//ngx_hash_init探测桶个数时用的，只放探测要用到的字段
+typedef struct {
+    ngx_uint_t key_hash;
+    ngx_uint_t size;
+    ngx_uint_t key; //在当前size下落到的桶，失败后清桶时不用再做一次除法
+} ngx_hash_probe_t;
+
+
 //names参数是ngx_hash_key_t结构的数组，即键-值对<key,value>数组，nelts表示该数组元素的个数
 //根据hinit及name数组完成精准匹配hash表初始化
 ngx_int_t
 ngx_hash_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names, ngx_uint_t nelts)
 {
     u_char *elts;
-    size_t len;
+    size_t len, total;
     u_short *test;
-    ngx_uint_t i, n, key,
+    ngx_uint_t i, n, m, key,
                 size,   //实际需要桶的个数
-                start, bucket_size;
+                start, step, tries, bucket_size;
     ngx_hash_elt_t *elt, **buckets;
+    ngx_hash_probe_t *probes;
 
     //检查max_size是否合法
     if (hinit->max_size == 0) {
@@ -292,6 +628,29 @@ ngx_hash_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names, ngx_uint_t nelts)
         return NGX_ERROR;
     }
 
+    /*
+     * 探测时只用到key_hash和元素大小，单独拷一份连续存放，比跳着读names[]对cache友好；
+     * 按元素大小排序试过，不合适的size并不会更早发现，排序本身反而要多花时间，所以保持原来的顺序
+     */
+    probes = ngx_alloc(nelts * sizeof(ngx_hash_probe_t) + 1, hinit->pool->log);
+    if (probes == NULL) {
+        ngx_free(test);
+        return NGX_ERROR;
+    }
+
+    total = 0;
+
+    for (m = 0, n = 0; n < nelts; n++) {
+        if (names[n].key.data == NULL) {
+            continue;
+        }
+
+        probes[m].key_hash = names[n].key_hash;
+        probes[m].size = NGX_HASH_ELT_SIZE(&names[n]);
+        total += probes[m].size;
+        m++;
+    }
+
     // 实际可用空间为定义的bucket_size减去末尾的void *(结尾标识)，末尾的void* 指向NULL
     bucket_size = hinit->bucket_size - sizeof(void *);
     //每个桶能放多少个元素(nelt)，从而由总元素推算出需要多少个桶
@@ -303,6 +662,12 @@ ngx_hash_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names, ngx_uint_t nelts)
      */
     start = nelts / (bucket_size / (2 * sizeof(void *)));
     start = start ? start : 1;
+
+    //所有元素加起来都放不下的size肯定不行，直接跳过
+    if (start < total / bucket_size) {
+        start = total / bucket_size;
+    }
+
     /*
      * 调整max_size，即bucket数量的最大值，依据是：bucket超过10000，且总的bucket数量与元素个数比值小于100
      * 那么bucket最大值减少1000，至于这几个判断值的由来，尚不清楚，经验值或者理论值。
@@ -311,22 +676,43 @@ ngx_hash_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names, ngx_uint_t nelts)
         start = hinit->max_size - 1000;
     }
 
+    /*
+     * 原来每试一个size都要把test清零size个，size很大时光清零就是O(size^2)；
+     * 现在test先清一次，失败时检查过的元素不多就只把这次累加过的桶清零，代价和检查过的元素个数成正比
+     */
+    ngx_memzero(test, hinit->max_size * sizeof(u_short));
+
+    step = 1;
+    tries = 0;
+
     //size从start开始，逐渐加大bucket的个数，直到恰好满足所有具有相同hash％size的元素都在同一个bucket，这样hash的size就能确定了
-    for (size = start; size <= hint->max_size; size++) {
+    for (size = start; size <= hinit->max_size; size += step) {
 
-        //每次递归新的size的时候需要将旧test的数据清空
-        ngx_memzero(test, size * sizeof(u_short));
+        tries++;
 
-        for (n = 0; n < nelts; n++) {
-            //标记1：此块代码是检查bucket大小是否够分配hash数据
-            if (names[n].key.data == NULL) {
-                continue;
-            }
+        /*
+         * 前NGX_HASH_LINEAR_TRIES个size逐个尝试，和原来一样找最小的；
+         * 之后每次跳过size/NGX_HASH_STEP_RATIO个，几十万上百万个key时尝试次数从上百万次降到几千次。
+         * 能放下的size并不是连续的，跳着试找到的不一定是最小的，会多用一些桶：
+         * main.c的bench里10万个key、max_size为key个数的100倍时得到135990个桶，逐个试是104317个；
+         * max_size小于key个数的100倍时上面直接从max_size - 1000开始，走不到这里
+         */
+        if (tries > NGX_HASH_LINEAR_TRIES) {
+            step = size / NGX_HASH_STEP_RATIO;
+            step = step ? step : 1;
+        }
+
+        //不要跳过max_size
+        if (size < hinit->max_size && size + step > hinit->max_size) {
+            step = hinit->max_size - size;
+        }
 
+        for (n = 0; n < m; n++) {
             //计算key和names中所有name长度，并保存在test[key]中
-            key = names[n].key_hash % size;
+            key = probes[n].key_hash % size;
+            probes[n].key = key;
             //开始叠加每个bucket的size
-            test[key] = (u_short) (test[key] + NGX_HASH_ELT_SIZE(&names[n]));
+            test[key] = (u_short) (test[key] + probes[n].size);
 
             //这里终于用到了bucket_size，大于这个值，则说明这个size不合适啊goto next，调整一下桶的数目
             //如果某个bucket的size超过了bucket_size，那么加大bucket的个数，使得元素分布更分散一些
@@ -334,11 +720,23 @@ ngx_hash_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names, ngx_uint_t nelts)
                 goto next;
             }
         }
+
         goto found;
 
     next:
 
-        continue;
+        /*
+         * 累加过的桶(包括第n个)相对size不多时只清这些桶；
+         * 否则逐个随机写反而比顺序清零size个u_short慢，比如max_size - 1000开始的情况
+         */
+        if (n < size / NGX_HASH_CLEAR_RATIO) {
+            for (i = 0; i <= n; i++) {
+                test[probes[i].key] = 0;
+            }
+
+        } else {
+            ngx_memzero(test, size * sizeof(u_short));
+        }
     }
 
     //按照最大的分配
@@ -353,6 +751,12 @@ ngx_hash_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names, ngx_uint_t nelts)
                   hinit->name, hinit->bucket_size, hinit->name);
 //找到合适的bucket
 found:
+
+    ngx_log_debug3(NGX_LOG_DEBUG_CORE, hinit->pool->log, 0,
+                   "%s: %ui buckets after %ui tries", hinit->name, size, tries);
+
+    ngx_free(probes);
+
     //到这里后把所有的test[i]数组赋值为8，预留给NULL指针
     for (i = 0; i < size; i++) {
         //将test数组前size个元素初始化为8，提前赋值8的原因是，hash桶的成员列表尾部会有一个NULL，提前把这8字节空间预留
@@ -360,7 +764,7 @@ found:
     }
 
     for (n = 0; n < nelts; n++) {
-        if (name[n].key.data == NULL) {
+        if (names[n].key.data == NULL) {
             continue;
         }
         //计算key和names中所有name长度，并保存在test[key]中
@@ -630,57 +1034,769 @@ ngx_hash_wildcard_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names, ngx_uint_t
     return NGX_OK;
 }
 
-//对数据字符串data计算出key值
-ngx_uint_t
-ngx_hash_key(u_char *data, size_t len)
+#define NGX_HASH_TRIE_EXACT  0 //"www.example.com"
+#define NGX_HASH_TRIE_DOT    1 //".example.com"
+#define NGX_HASH_TRIE_WC     2 //"*.example.com"和"www.example.*"
+
+//ngx_hash_trie_init的临时key，key是还没处理的部分，head树中label已经倒过来了
+typedef struct {
+    ngx_str_t key;
+    void *value;
+    ngx_uint_t type;
+} ngx_hash_trie_key_t;
+
+
+/*
+ * 逐个label比较，'.'比任何字符都小，这样"com"、"com.example"、"com-x"的顺序是
+ * "com" < "com.example" < "com-x"，第一个label相同的key排在一起，
+ * 同一层的label之间就是按字节比较、短的在前，和ngx_hash_trie_child二分的顺序一致
+ */
+static int
+ngx_hash_trie_cmp(const void *one, const void *two)
 {
-    ngx_uint_t i, key;
+    u_char c1, c2;
+    size_t i, n;
+    ngx_hash_trie_key_t *first, *second;
 
-    key = 0;
+    first = (ngx_hash_trie_key_t *) one;
+    second = (ngx_hash_trie_key_t *) two;
 
-    for (i = 0; i < len; i++) {
-        key = ngx_hash(key, data[i]);
-    }
+    n = ngx_min(first->key.len, second->key.len);
 
-    return key;
-}
+    for (i = 0; i < n; i++) {
+        c1 = first->key.data[i];
+        c2 = second->key.data[i];
 
-ngx_uint_t
-ngx_hash_key_lc(u_char *data, size_t len)
-{
-    ngx_uint_t  i, key;
+        if (c1 == c2) {
+            continue;
+        }
 
-    key = 0;
+        if (c1 == '.') {
+            return -1;
+        }
 
-    for (i = 0; i < len; i++) {
-        key = ngx_hash(key, ngx_tolower(data[i]));
+        if (c2 == '.') {
+            return 1;
+        }
+
+        return (int) c1 - (int) c2;
     }
 
-    return key;
+    if (first->key.len != second->key.len) {
+        return (first->key.len < second->key.len) ? -1 : 1;
+    }
+
+    return (int) first->type - (int) second->type;
 }
 
-//这里在求Hash的同时，将src转化成小写
-ngx_uint_t
-ngx_hash_strlow(u_char *dst, u_char *src, size_t n)
+
+//keys[j]的第一个label长度放到len，返回第一个label不同的key的下标
+static ngx_uint_t
+ngx_hash_trie_group(ngx_hash_trie_key_t *keys, ngx_uint_t j, ngx_uint_t n,
+    size_t *len)
 {
-    ngx_uint_t key;
+    u_char *p;
+    size_t l;
+    ngx_uint_t next;
 
-    key = 0;
+    p = ngx_strlchr(keys[j].key.data, keys[j].key.data + keys[j].key.len, '.');
+    l = p ? (size_t) (p - keys[j].key.data) : keys[j].key.len;
 
-    while (n--) {
-        *dst = ngx_tolower(*src);
-        key = ngx_hash(key, *dst);
-        dst++;
-        src++;
+    for (next = j + 1; next < n; next++) {
+        if (keys[next].key.len < l
+            || ngx_memcmp(keys[next].key.data, keys[j].key.data, l) != 0
+            || (keys[next].key.len > l && keys[next].key.data[l] != '.'))
+        {
+            break;
+        }
     }
 
-    return key;
+    *len = l;
+
+    return next;
 }
 
-ngx_int_t
-ngx_hash_keys_array_init(ngx_hash_keys_arrays_t *ha, ngx_uint_t type)
-{
-    ngx_uint_t asize;
+
+/*
+ * keys已排好序，并且都已经去掉了parent路径上的label。
+ * 先处理在parent结束的key，再把剩下的按第一个label分组，每组一个子节点，
+ * 子节点一次性push到nodes里保证连续，再对每个子节点递归。
+ * nodes可能在push时被重新分配，所以只记下标
+ */
+static ngx_int_t
+ngx_hash_trie_build(ngx_array_t *nodes, ngx_array_t *labels, ngx_uint_t parent,
+    ngx_hash_trie_key_t *keys, ngx_uint_t n)
+{
+    u_char *p;
+    size_t len;
+    ngx_uint_t i, j, m, next, c, nchild;
+    ngx_hash_trie_node_t *node, *child;
+
+    node = (ngx_hash_trie_node_t *) nodes->elts + parent;
+
+    //排序时同一路径上EXACT在DOT前面，精确匹配优先
+    for (i = 0; i < n && keys[i].key.len == 0; i++) {
+
+        if (keys[i].type != NGX_HASH_TRIE_WC && node->value == NULL) {
+            node->value = keys[i].value;
+        }
+
+        if (keys[i].type != NGX_HASH_TRIE_EXACT && node->wc_value == NULL) {
+            node->wc_value = keys[i].value;
+        }
+    }
+
+    nchild = 0;
+
+    for (j = i; j < n; j = ngx_hash_trie_group(keys, j, n, &len)) {
+        nchild++;
+    }
+
+    if (nchild == 0) {
+        return NGX_OK;
+    }
+
+    c = nodes->nelts;
+
+    child = ngx_array_push_n(nodes, nchild);
+    if (child == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(child, nchild * sizeof(ngx_hash_trie_node_t));
+
+    node = (ngx_hash_trie_node_t *) nodes->elts + parent;
+    node->child = (uint32_t) c;
+    node->nchild = (uint32_t) nchild;
+
+    for (j = i; j < n; j = next, c++) {
+        next = ngx_hash_trie_group(keys, j, n, &len);
+
+        p = ngx_array_push_n(labels, len);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_memcpy(p, keys[j].key.data, len);
+
+        child = (ngx_hash_trie_node_t *) nodes->elts + c;
+        child->label = (uint32_t) (labels->nelts - len);
+        child->len = (uint32_t) len;
+
+        //去掉这一层的label和后面的'.'
+        for (m = j; m < next; m++) {
+            keys[m].key.data += len;
+            keys[m].key.len -= len;
+
+            if (keys[m].key.len) {
+                keys[m].key.data++;
+                keys[m].key.len--;
+            }
+        }
+
+        if (ngx_hash_trie_build(nodes, labels, c, &keys[j], next - j)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+/*
+ * ha->keys里是"www.example.com"，倒成"com.example.www"；
+ * ha->dns_wc_head里已经是"com.example."(*.example.com)和"com.example"(.example.com)，
+ * 最后的'.'去掉并记为NGX_HASH_TRIE_WC；ha->dns_wc_tail里是"www.example"。
+ * 临时数据放在hinit->temp_pool，nodes和labels最后拷贝到hinit->pool
+ */
+ngx_int_t
+ngx_hash_trie_init(ngx_hash_trie_t *trie, ngx_hash_init_t *hinit,
+    ngx_hash_keys_arrays_t *ha)
+{
+    u_char *p, *last, *dot;
+    size_t len;
+    ngx_uint_t i, n;
+    ngx_array_t nodes, labels;
+    ngx_hash_key_t *src;
+    ngx_hash_trie_key_t *head, *tail;
+    ngx_hash_trie_node_t *root;
+
+    n = ha->keys.nelts + ha->dns_wc_head.nelts;
+
+    head = ngx_palloc(hinit->temp_pool,
+                      (n + ha->dns_wc_tail.nelts) * sizeof(ngx_hash_trie_key_t));
+    if (head == NULL) {
+        return NGX_ERROR;
+    }
+
+    tail = head + n;
+
+    src = ha->keys.elts;
+
+    for (i = 0; i < ha->keys.nelts; i++) {
+        len = src[i].key.len;
+
+        p = ngx_pnalloc(hinit->temp_pool, len);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        head[i].key.data = p;
+        head[i].key.len = len;
+        head[i].value = src[i].value;
+        head[i].type = NGX_HASH_TRIE_EXACT;
+
+        //从右往左逐个label拷贝，label之间补上'.'
+        last = src[i].key.data + len;
+        dot = last;
+
+        while (dot > src[i].key.data) {
+            dot--;
+
+            if (*dot == '.') {
+                p = ngx_cpymem(p, dot + 1, last - dot - 1);
+                *p++ = '.';
+                last = dot;
+            }
+        }
+
+        ngx_memcpy(p, src[i].key.data, last - src[i].key.data);
+    }
+
+    src = ha->dns_wc_head.elts;
+
+    for (i = 0; i < ha->dns_wc_head.nelts; i++) {
+        head[ha->keys.nelts + i].key = src[i].key;
+        head[ha->keys.nelts + i].value = src[i].value;
+        head[ha->keys.nelts + i].type = NGX_HASH_TRIE_DOT;
+
+        if (src[i].key.len && src[i].key.data[src[i].key.len - 1] == '.') {
+            head[ha->keys.nelts + i].key.len--;
+            head[ha->keys.nelts + i].type = NGX_HASH_TRIE_WC;
+        }
+    }
+
+    src = ha->dns_wc_tail.elts;
+
+    for (i = 0; i < ha->dns_wc_tail.nelts; i++) {
+        tail[i].key = src[i].key;
+        tail[i].value = src[i].value;
+        tail[i].type = NGX_HASH_TRIE_WC;
+    }
+
+    ngx_qsort(head, n, sizeof(ngx_hash_trie_key_t), ngx_hash_trie_cmp);
+    ngx_qsort(tail, ha->dns_wc_tail.nelts, sizeof(ngx_hash_trie_key_t),
+              ngx_hash_trie_cmp);
+
+    if (ngx_array_init(&nodes, hinit->temp_pool, 2 + n,
+                       sizeof(ngx_hash_trie_node_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    if (ngx_array_init(&labels, hinit->temp_pool, 1024, 1) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    root = ngx_array_push_n(&nodes, 2);
+    if (root == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(root, 2 * sizeof(ngx_hash_trie_node_t));
+
+    if (ngx_hash_trie_build(&nodes, &labels, 0, head, n) != NGX_OK
+        || ngx_hash_trie_build(&nodes, &labels, 1, tail, ha->dns_wc_tail.nelts)
+           != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    trie->nodes = ngx_palloc(hinit->pool,
+                             nodes.nelts * sizeof(ngx_hash_trie_node_t));
+    trie->labels = ngx_pnalloc(hinit->pool, labels.nelts + 1);
+
+    if (trie->nodes == NULL || trie->labels == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(trie->nodes, nodes.elts,
+               nodes.nelts * sizeof(ngx_hash_trie_node_t));
+    ngx_memcpy(trie->labels, labels.elts, labels.nelts);
+    trie->nnodes = nodes.nelts;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_CORE, hinit->pool->log, 0,
+                   "%s trie: %ui nodes, %ui label bytes",
+                   hinit->name, nodes.nelts, labels.nelts);
+
+    return NGX_OK;
+}
+
+//对数据字符串data计算出key值
+ngx_uint_t
+ngx_hash_key(u_char *data, size_t len)
+{
+    ngx_uint_t i, key;
+
+    key = 0;
+
+    for (i = 0; i < len; i++) {
+        key = ngx_hash(key, data[i]);
+    }
+
+    return key;
+}
+
+ngx_uint_t
+ngx_hash_key_lc(u_char *data, size_t len)
+{
+    ngx_uint_t  i, key;
+
+#if (NGX_HASH_SIMD)
+
+    if (len >= 32 && (ngx_cpu_features & NGX_CPU_AVX2)) {
+        return ngx_hash_key_lc_avx2(data, len);
+    }
+
+    if (len >= 16 && (ngx_cpu_features & NGX_CPU_SSE2)) {
+        return ngx_hash_key_lc_sse2(data, len);
+    }
+
+#endif
+
+    key = 0;
+
+    for (i = 0; i < len; i++) {
+        key = ngx_hash(key, ngx_tolower(data[i]));
+    }
+
+    return key;
+}
+
+//这里在求Hash的同时，将src转化成小写
+ngx_uint_t
+ngx_hash_strlow(u_char *dst, u_char *src, size_t n)
+{
+    ngx_uint_t key;
+
+#if (NGX_HASH_SIMD)
+
+    if (n >= 32 && (ngx_cpu_features & NGX_CPU_AVX2)) {
+        return ngx_hash_strlow_avx2(dst, src, n);
+    }
+
+    if (n >= 16 && (ngx_cpu_features & NGX_CPU_SSE2)) {
+        return ngx_hash_strlow_sse2(dst, src, n);
+    }
+
+#endif
+
+    key = 0;
+
+    while (n--) {
+        *dst = ngx_tolower(*src);
+        key = ngx_hash(key, *dst);
+        dst++;
+        src++;
+    }
+
+    return key;
+}
+
+
+#if (NGX_HASH_SIMD)
+
+//每次转16字节小写到临时缓冲区再并入key，不足16字节的尾部逐字节处理
+static ngx_uint_t
+ngx_hash_key_lc_sse2(u_char *data, size_t len)
+{
+    u_char      buf[16];
+    ngx_uint_t  key;
+
+    key = 0;
+
+    while (len >= 16) {
+        _mm_storeu_si128((__m128i *) buf,
+                         ngx_hash_lc16(_mm_loadu_si128((__m128i *) data)));
+
+        key = ngx_hash_block16(key, buf);
+
+        data += 16;
+        len -= 16;
+    }
+
+    while (len--) {
+        key = ngx_hash(key, ngx_tolower(*data));
+        data++;
+    }
+
+    return key;
+}
+
+
+static ngx_uint_t
+ngx_hash_strlow_sse2(u_char *dst, u_char *src, size_t n)
+{
+    ngx_uint_t  key;
+
+    key = 0;
+
+    while (n >= 16) {
+        _mm_storeu_si128((__m128i *) dst,
+                         ngx_hash_lc16(_mm_loadu_si128((__m128i *) src)));
+
+        key = ngx_hash_block16(key, dst);
+
+        dst += 16;
+        src += 16;
+        n -= 16;
+    }
+
+    while (n--) {
+        *dst = ngx_tolower(*src);
+        key = ngx_hash(key, *dst);
+        dst++;
+        src++;
+    }
+
+    return key;
+}
+
+
+__attribute__((target("avx2"))) static ngx_inline __m256i
+ngx_hash_lc32(__m256i v)
+{
+    __m256i  upper;
+
+    upper = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('A' - 1)),
+                             _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), v));
+
+    return _mm256_or_si256(v, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+}
+
+
+/*
+ * 已经转成小写的32字节p并入key
+ * 每4个字节扩展成4个64位，和对应的31的幂相乘；AVX2只有32x32->64位的乘法，
+ * 幂分成高低32位：c * pow = c * lo + ((c * hi) << 32)  (mod 2^64)
+ */
+__attribute__((target("avx2"))) static ngx_inline ngx_uint_t
+ngx_hash_block32(ngx_uint_t key, u_char *p)
+{
+    uint64_t    sum[4];
+    ngx_uint_t  i;
+    __m256i     c, pw, acc;
+
+    acc = _mm256_setzero_si256();
+
+    for (i = 0; i < 32; i += 4) {
+        c = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(*(int *) (p + i)));
+        pw = _mm256_loadu_si256((__m256i *) (ngx_hash_pow + 1 + i));
+
+        acc = _mm256_add_epi64(acc, _mm256_mul_epu32(c, pw));
+        acc = _mm256_add_epi64(acc,
+                  _mm256_slli_epi64(
+                      _mm256_mul_epu32(c, _mm256_srli_epi64(pw, 32)), 32));
+    }
+
+    _mm256_storeu_si256((__m256i *) sum, acc);
+
+    return key * ngx_hash_pow[0] + sum[0] + sum[1] + sum[2] + sum[3];
+}
+
+
+__attribute__((target("avx2"))) static ngx_uint_t
+ngx_hash_key_lc_avx2(u_char *data, size_t len)
+{
+    u_char      buf[32];
+    ngx_uint_t  key;
+
+    key = 0;
+
+    while (len >= 32) {
+        _mm256_storeu_si256((__m256i *) buf,
+                        ngx_hash_lc32(_mm256_loadu_si256((__m256i *) data)));
+
+        key = ngx_hash_block32(key, buf);
+
+        data += 32;
+        len -= 32;
+    }
+
+    if (len >= 16) {
+        _mm_storeu_si128((__m128i *) buf,
+                         ngx_hash_lc16(_mm_loadu_si128((__m128i *) data)));
+
+        key = ngx_hash_block16(key, buf);
+
+        data += 16;
+        len -= 16;
+    }
+
+    while (len--) {
+        key = ngx_hash(key, ngx_tolower(*data));
+        data++;
+    }
+
+    return key;
+}
+
+
+__attribute__((target("avx2"))) static ngx_uint_t
+ngx_hash_strlow_avx2(u_char *dst, u_char *src, size_t n)
+{
+    ngx_uint_t  key;
+
+    key = 0;
+
+    while (n >= 32) {
+        _mm256_storeu_si256((__m256i *) dst,
+                        ngx_hash_lc32(_mm256_loadu_si256((__m256i *) src)));
+
+        key = ngx_hash_block32(key, dst);
+
+        dst += 32;
+        src += 32;
+        n -= 32;
+    }
+
+    if (n >= 16) {
+        _mm_storeu_si128((__m128i *) dst,
+                         ngx_hash_lc16(_mm_loadu_si128((__m128i *) src)));
+
+        key = ngx_hash_block16(key, dst);
+
+        dst += 16;
+        src += 16;
+        n -= 16;
+    }
+
+    while (n--) {
+        *dst = ngx_tolower(*src);
+        key = ngx_hash(key, *dst);
+        dst++;
+        src++;
+    }
+
+    return key;
+}
+
+
+//同ngx_hash_eq_sse2，len >= 32
+__attribute__((target("avx2"))) static ngx_uint_t
+ngx_hash_eq_avx2(u_char *s1, u_char *s2, size_t len)
+{
+    size_t   i;
+    __m256i  a, b;
+
+    for (i = 0; i + 32 < len; i += 32) {
+        a = _mm256_loadu_si256((__m256i *) (s1 + i));
+        b = _mm256_loadu_si256((__m256i *) (s2 + i));
+
+        if ((uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b))
+            != 0xffffffff)
+        {
+            return 0;
+        }
+    }
+
+    a = _mm256_loadu_si256((__m256i *) (s1 + len - 32));
+    b = _mm256_loadu_si256((__m256i *) (s2 + len - 32));
+
+    return (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b))
+           == 0xffffffff;
+}
+
+#endif
+
+
+/*
+ * wyhash (final4版本，种子为0，默认secret)，短字符串上比BKDR快、冲突少
+ * 按本机字节序读8字节，大端机器上的结果和小端的不同，只在进程内用不影响
+ * lc为1时读进来的每个字节都先转小写，结果和先ngx_strlow再计算完全相同
+ */
+static const uint64_t  ngx_hash_wy_secret[4] = {
+    0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL,
+    0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL
+};
+
+
+//64x64->128位乘法，低64位放回a，高64位放回b
+static ngx_inline void
+ngx_hash_wy_mum(uint64_t *a, uint64_t *b)
+{
+#if (__SIZEOF_INT128__)
+
+    __uint128_t  r;
+
+    r = *a;
+    r *= *b;
+
+    *a = (uint64_t) r;
+    *b = (uint64_t) (r >> 64);
+
+#else
+
+    uint64_t  ha, hb, la, lb, rh, rm0, rm1, rl, t, lo, c;
+
+    ha = *a >> 32; hb = *b >> 32; la = (uint32_t) *a; lb = (uint32_t) *b;
+
+    rh = ha * hb; rm0 = ha * lb; rm1 = hb * la; rl = la * lb;
+
+    t = rl + (rm0 << 32);
+    c = t < rl;
+    lo = t + (rm1 << 32);
+    c += lo < t;
+
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+
+#endif
+}
+
+
+static ngx_inline uint64_t
+ngx_hash_wy_mix(uint64_t a, uint64_t b)
+{
+    ngx_hash_wy_mum(&a, &b);
+
+    return a ^ b;
+}
+
+
+//按字节把'A'-'Z'转成小写，同ngx_tolower，大于0x7f的字节不变
+static ngx_inline uint64_t
+ngx_hash_wy_lc(uint64_t v)
+{
+    uint64_t  h, ge, gt;
+
+    h = v & 0x7f7f7f7f7f7f7f7fULL;
+    ge = h + 0x3f3f3f3f3f3f3f3fULL; /* 最高位为1: >= 'A' */
+    gt = h + 0x2525252525252525ULL; /* 最高位为1: > 'Z' */
+
+    return v | (((ge & ~gt & ~v) & 0x8080808080808080ULL) >> 2);
+}
+
+
+static ngx_inline uint64_t
+ngx_hash_wy_r8(u_char *p, ngx_uint_t lc)
+{
+    uint64_t  v;
+
+    ngx_memcpy(&v, p, 8);
+
+    return lc ? ngx_hash_wy_lc(v) : v;
+}
+
+
+static ngx_inline uint64_t
+ngx_hash_wy_r4(u_char *p, ngx_uint_t lc)
+{
+    uint32_t  v;
+
+    ngx_memcpy(&v, p, 4);
+
+    return lc ? ngx_hash_wy_lc(v) : v;
+}
+
+
+static ngx_inline uint64_t
+ngx_hash_wy(u_char *p, size_t len, ngx_uint_t lc)
+{
+    size_t           i;
+    uint64_t         a, b, seed, see1, see2;
+    const uint64_t  *s;
+
+    s = ngx_hash_wy_secret;
+
+    seed = ngx_hash_wy_mix(s[0], s[1]);
+
+    if (len <= 16) {
+        if (len >= 4) {
+            a = (ngx_hash_wy_r4(p, lc) << 32)
+                | ngx_hash_wy_r4(p + ((len >> 3) << 2), lc);
+            b = (ngx_hash_wy_r4(p + len - 4, lc) << 32)
+                | ngx_hash_wy_r4(p + len - 4 - ((len >> 3) << 2), lc);
+
+        } else if (len > 0) {
+            a = lc ? ((uint64_t) ngx_tolower(p[0]) << 16)
+                     | ((uint64_t) ngx_tolower(p[len >> 1]) << 8)
+                     | ngx_tolower(p[len - 1])
+                   : ((uint64_t) p[0] << 16)
+                     | ((uint64_t) p[len >> 1] << 8)
+                     | p[len - 1];
+            b = 0;
+
+        } else {
+            a = 0;
+            b = 0;
+        }
+
+    } else {
+        i = len;
+
+        if (i > 48) {
+            see1 = seed;
+            see2 = seed;
+
+            do {
+                seed = ngx_hash_wy_mix(ngx_hash_wy_r8(p, lc) ^ s[1],
+                                       ngx_hash_wy_r8(p + 8, lc) ^ seed);
+                see1 = ngx_hash_wy_mix(ngx_hash_wy_r8(p + 16, lc) ^ s[2],
+                                       ngx_hash_wy_r8(p + 24, lc) ^ see1);
+                see2 = ngx_hash_wy_mix(ngx_hash_wy_r8(p + 32, lc) ^ s[3],
+                                       ngx_hash_wy_r8(p + 40, lc) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+
+            seed ^= see1 ^ see2;
+        }
+
+        while (i > 16) {
+            seed = ngx_hash_wy_mix(ngx_hash_wy_r8(p, lc) ^ s[1],
+                                   ngx_hash_wy_r8(p + 8, lc) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+
+        a = ngx_hash_wy_r8(p + i - 16, lc);
+        b = ngx_hash_wy_r8(p + i - 8, lc);
+    }
+
+    a ^= s[1];
+    b ^= seed;
+
+    ngx_hash_wy_mum(&a, &b);
+
+    return ngx_hash_wy_mix(a ^ s[0] ^ len, b ^ s[1]);
+}
+
+
+ngx_uint_t
+ngx_hash_key_wy(u_char *data, size_t len)
+{
+    return (ngx_uint_t) ngx_hash_wy(data, len, 0);
+}
+
+
+ngx_uint_t
+ngx_hash_key_wy_lc(u_char *data, size_t len)
+{
+    return (ngx_uint_t) ngx_hash_wy(data, len, 1);
+}
+
+
+ngx_int_t
+ngx_hash_keys_array_init(ngx_hash_keys_arrays_t *ha, ngx_uint_t type)
+{
+    ngx_uint_t asize;
+
+    //精确匹配的key默认用BKDR，调用方可以在这之后换成ngx_hash_key_wy等
+    ha->key = ngx_hash_key;
 
     if(type == NGX_HASH_SMALL) {
         asize = 4;
@@ -852,7 +1968,7 @@ ngx_hash_add_key(ngx_hash_keys_arrays_t *ha, ngx_str_t *key, void *value, ngx_ui
     }
     //ha->keys中存放的是key  value对
     hk->key = *key;
-    hk->key_hash = ngx_hash_key(key->data, last);
+    hk->key_hash = ha->key(key->data, last);
     hk->value = value;
 
     return NGX_OK;
@@ -70,6 +70,30 @@ typedef struct {
 // 哈希函数
 typedef ngx_uint_t (*ngx_hash_key_pt) (u_char *data, size_t len);
 
+// BKDR，每个字符 key = key * 31 + c
+#define ngx_hash(key, c)   ((ngx_uint_t) key * 31 + c)
+
+/*
+ * 编译好的label树，ngx_hash_trie_init根据ngx_hash_keys_arrays_t里的三类key生成
+ * nodes[0]是head树的根，label从右往左存("www.example.com"依次是com、example、www)，精确匹配和前置通配符都在这里
+ * nodes[1]是tail树的根，label从左往右存，放后置通配符
+ * 一个节点的子节点在nodes里是连续的，按label排好序，查找时二分，不需要计算hash
+ */
+typedef struct {
+    void *value;    //name正好在这个节点结束时的value，"www.example.com"或".example.com"
+    void *wc_value; //name在这个节点之后还有label时的value，"*.example.com"、".example.com"和"www.example.*"
+    uint32_t label; //label在labels中的偏移
+    uint32_t len;   //label长度
+    uint32_t child; //第一个子节点在nodes中的下标
+    uint32_t nchild;//子节点个数
+} ngx_hash_trie_node_t;
+
+typedef struct {
+    ngx_hash_trie_node_t *nodes;
+    u_char *labels; //所有label连续存放
+    ngx_uint_t nnodes;
+} ngx_hash_trie_t;
+
 /*
 Nginx对于server- name主机名通配符的支持规则。
     首先，选择所有字符串完全匹配的server name，如www.testweb.com。
@@ -81,6 +105,7 @@ typedef struct {
     ngx_hash_t hash; //普通hash，完全匹配
     ngx_hash_wildcard_t *wc_head; //前置通配符hash
     ngx_hash_wildcard_t *wc_tail; //后置通配符hash
+    ngx_hash_trie_t *trie; //不为NULL时ngx_hash_find_combined只查这棵树，它包含了上面三个表的所有key
 } ngx_hash_combined_t;
 
 //hash初始化结构
@@ -117,6 +142,9 @@ typedef struct {
 typedef struct {
     //散列中槽总数  如果是大hash桶方式，则hsize=NGX_HASH_LARGE_HSIZE,小hash桶方式，hsize=107
     ngx_uint_t hsize; //用于指定桶大小
+    //计算keys中key_hash的哈希函数，ngx_hash_keys_array_init设为ngx_hash_key，查找时要用同一个函数计算key
+    //通配符的key不受影响，ngx_hash_find_wc_head/tail里是按BKDR逐字节算的
+    ngx_hash_key_pt key;
 
     ngx_pool_t *pool;
     ngx_pool_t *temp_pool;
@@ -158,5 +186,25 @@ void *ngx_hash_find_wc_tail(ngx_hash_wildcard_t *hwc, u_char *name, size_t len);
 //先完全匹配，完后前正则匹配，最后是后正则匹配
 void *ngx_hash_find_combined(ngx_hash_combined_t *hash, ngx_uint_t key, u_char *name, size_t len);
 
+//批量查找n个key，values[i]是keys[i]/names[i]的结果，结果和逐个调用ngx_hash_find/ngx_hash_find_combined相同
+void ngx_hash_find_n(ngx_hash_t *hash, ngx_uint_t *keys, ngx_str_t *names, void **values, ngx_uint_t n);
+void ngx_hash_find_combined_n(ngx_hash_combined_t *hash, ngx_uint_t *keys, ngx_str_t *names, void **values,
+    ngx_uint_t n);
+
 ngx_int_t ngx_hash_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names, ngx_uint_t );
+
+//计算key，_lc的先转小写，ngx_hash_strlow同时把小写结果写到dst；长度够时按ngx_cpu_features用SSE2/AVX2
+ngx_uint_t ngx_hash_key(u_char *data, size_t len);
+ngx_uint_t ngx_hash_key_lc(u_char *data, size_t len);
+ngx_uint_t ngx_hash_strlow(u_char *dst, u_char *src, size_t n);
+
+//用ha中的精确、前置通配、后置通配key编译出trie，ha里的三个数组不需要事先排序
+ngx_int_t ngx_hash_trie_init(ngx_hash_trie_t *trie, ngx_hash_init_t *hinit, ngx_hash_keys_arrays_t *ha);
+
+//name需要是小写的，优先级和ngx_hash_find_combined相同: 精确匹配，最长的前置通配，最长的后置通配
+void *ngx_hash_trie_find(ngx_hash_trie_t *trie, u_char *name, size_t len);
+
+//wyhash，可以代替ngx_hash_key/ngx_hash_key_lc用于精确匹配的hash表，_lc的按小写计算
+ngx_uint_t ngx_hash_key_wy(u_char *data, size_t len);
+ngx_uint_t ngx_hash_key_wy_lc(u_char *data, size_t len);
 #endif //NGX_HASH_NGX_HASH_H
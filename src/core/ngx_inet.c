@@ -12,6 +12,24 @@
 static ngx_int_t ngx_parse_unix_domain_url(ngx_pool_t *pool, ngx_url_t *u);
 static ngx_int_t ngx_parse_inet_url(ngx_pool_t *pool, ngx_url_t *u);
 static ngx_int_t ngx_parse_inet6_url(ngx_pool_t *pool, ngx_url_t *u);
+//ngx_cidr_match_n一组同时查找的地址个数
+#define NGX_CIDR_BATCH  16
+
+#if (__GNUC__)
+#define ngx_cidr_prefetch(p)  __builtin_prefetch(p)
+#else
+#define ngx_cidr_prefetch(p)
+#endif
+
+static ngx_uint_t ngx_cidr_rank(ngx_uint_t family);
+static int ngx_libc_cdecl ngx_cidr_cmp(const void *one, const void *two);
+static ngx_uint_t ngx_cidr_contains(ngx_cidr_t *outer, ngx_cidr_t *inner);
+static ngx_int_t ngx_cidr_search(ngx_cidr_t *cidr, ngx_uint_t n,
+    in_addr_t inaddr);
+#if (NGX_HAVE_INET6)
+static ngx_int_t ngx_cidr_search6(ngx_cidr_t *cidr, ngx_uint_t n,
+    struct in6_addr *inaddr6);
+#endif
 
 //将一个字符串IP 转为 in_addr_t 数字
 in_addr_t
@@ -477,7 +495,7 @@ ngx_cidr_match(struct sockaddr *sa, ngx_array_t *cidrs)
 #endif
     in_addr_t         inaddr;
     ngx_cidr_t       *cidr;
-    ngx_uint_t        family, i;
+    ngx_uint_t        family, i, nv4, nv6;
 #if (NGX_HAVE_INET6)
     ngx_uint_t        n;
     struct in6_addr  *inaddr6;
@@ -515,7 +533,28 @@ ngx_cidr_match(struct sockaddr *sa, ngx_array_t *cidrs)
     }
 #endif
 
-    for (cidr = cidrs->elts, i = 0; i < cidrs->nelts; i++) {
+    cidr = cidrs->elts;
+    i = 0;
+
+    //ngx_cidr_compile整理过的数组，IPv4和IPv6二分查找，其它family仍然逐个比较
+    if (cidrs->nelts && cidr[0].family == AF_UNSPEC) {
+        nv4 = cidr[0].u.in.addr;
+        nv6 = cidr[0].u.in.mask;
+
+        if (family == AF_INET) {
+            return ngx_cidr_search(&cidr[1], nv4, inaddr);
+        }
+
+#if (NGX_HAVE_INET6)
+        if (family == AF_INET6) {
+            return ngx_cidr_search6(&cidr[1 + nv4], nv6, inaddr6);
+        }
+#endif
+
+        i = 1 + nv4 + nv6;
+    }
+
+    for ( /* void */ ; i < cidrs->nelts; i++) {
         if (cidr[i].family != family) {
             goto next;
         }
@@ -556,6 +595,328 @@ ngx_cidr_match(struct sockaddr *sa, ngx_array_t *cidrs)
 }
 
 
+/*
+ * 批量匹配n个地址，rc[i]和ngx_cidr_match(sa[i], cidrs)相同
+ * 整理过的数组里，每NGX_CIDR_BATCH个IPv4地址一组同时二分查找：
+ * 每一步所有地址都在同样长度的区间里比较一次，没有分支，并预取下一步要读的网段；
+ * 其它地址和没整理过的数组逐个调用ngx_cidr_match
+ */
+void
+ngx_cidr_match_n(struct sockaddr **sa, ngx_array_t *cidrs, ngx_int_t *rc,
+    ngx_uint_t n)
+{
+    in_addr_t    addr[NGX_CIDR_BATCH];
+    ngx_cidr_t  *cidr, *c;
+    ngx_uint_t   i, j, m, k, nv4, len, half;
+    ngx_uint_t   base[NGX_CIDR_BATCH], lane[NGX_CIDR_BATCH];
+
+    cidr = cidrs->elts;
+
+    if (cidrs->nelts == 0 || cidr[0].family != AF_UNSPEC
+        || cidr[0].u.in.addr == 0)
+    {
+        for (i = 0; i < n; i++) {
+            rc[i] = ngx_cidr_match(sa[i], cidrs);
+        }
+
+        return;
+    }
+
+    nv4 = cidr[0].u.in.addr;
+    cidr++;
+
+    for (i = 0; i < n; i += m) {
+        m = ngx_min(n - i, NGX_CIDR_BATCH);
+
+        //k个AF_INET的地址放进lane里，其它的直接算
+        for (j = 0, k = 0; j < m; j++) {
+            if (sa[i + j]->sa_family != AF_INET) {
+                rc[i + j] = ngx_cidr_match(sa[i + j], cidrs);
+                continue;
+            }
+
+            lane[k] = i + j;
+            addr[k] = ntohl(((struct sockaddr_in *) sa[i + j])->sin_addr.s_addr);
+            base[k] = 0;
+            k++;
+        }
+
+        //base最后是起始地址不大于addr的最后一个网段，没有的话是0
+        for (len = nv4; len > 1; len -= half) {
+            half = len / 2;
+
+            for (j = 0; j < k; j++) {
+                base[j] = (ntohl(cidr[base[j] + half].u.in.addr) <= addr[j])
+                          ? base[j] + half : base[j];
+                ngx_cidr_prefetch(&cidr[base[j] + (len - half) / 2]);
+            }
+        }
+
+        for (j = 0; j < k; j++) {
+            c = &cidr[base[j]];
+
+            rc[lane[j]] = (ntohl(c->u.in.addr) <= addr[j]
+                           && (htonl(addr[j]) & c->u.in.mask) == c->u.in.addr)
+                          ? NGX_OK : NGX_DECLINED;
+        }
+    }
+}
+
+
+/*
+ * 整理cidrs，之后ngx_cidr_match对IPv4和IPv6是O(log n)的二分查找:
+ * 按family和起始地址排序，去掉被前面的网段包含的网段，剩下的同一family的网段互不重叠，
+ * 地址只可能落在起始地址不大于它的最后一个网段里。
+ * 数组开头插入一个family为AF_UNSPEC的头，u.in.addr和u.in.mask是IPv4和IPv6网段的个数，
+ * 后面依次是IPv4、IPv6和其它family(AF_UNIX)的网段；
+ * 头不会和任何地址匹配，直接遍历数组的代码结果不变。已经整理过的数组直接返回
+ */
+ngx_int_t
+ngx_cidr_compile(ngx_array_t *cidrs)
+{
+    ngx_cidr_t  *cidr;
+    ngx_uint_t   i, n, nv4, nv6;
+
+    cidr = cidrs->elts;
+
+    if (cidrs->nelts == 0 || cidr[0].family == AF_UNSPEC) {
+        return NGX_OK;
+    }
+
+    if (ngx_array_push(cidrs) == NULL) {
+        return NGX_ERROR;
+    }
+
+    //数组可能被搬到了新的地方
+    cidr = cidrs->elts;
+
+    ngx_memmove(&cidr[1], &cidr[0], (cidrs->nelts - 1) * sizeof(ngx_cidr_t));
+
+    ngx_qsort(&cidr[1], cidrs->nelts - 1, sizeof(ngx_cidr_t), ngx_cidr_cmp);
+
+    /*
+     * 起始地址相同时短的前缀排在前面，所以被包含的网段一定紧跟在
+     * 包含它的网段或者同样被包含的网段后面，只需要和上一个留下的比较
+     */
+    nv4 = 0;
+    nv6 = 0;
+
+    for (i = 1, n = 1; i < cidrs->nelts; i++) {
+        if (n > 1 && ngx_cidr_contains(&cidr[n - 1], &cidr[i])) {
+            continue;
+        }
+
+        if (cidr[i].family == AF_INET) {
+            nv4++;
+
+#if (NGX_HAVE_INET6)
+        } else if (cidr[i].family == AF_INET6) {
+            nv6++;
+#endif
+        }
+
+        cidr[n++] = cidr[i];
+    }
+
+    cidrs->nelts = n;
+
+    ngx_memzero(&cidr[0], sizeof(ngx_cidr_t));
+    cidr[0].family = AF_UNSPEC;
+    cidr[0].u.in.addr = (in_addr_t) nv4;
+    cidr[0].u.in.mask = (in_addr_t) nv6;
+
+    return NGX_OK;
+}
+
+
+//IPv4在前，IPv6其次，其它family在最后
+static ngx_uint_t
+ngx_cidr_rank(ngx_uint_t family)
+{
+    switch (family) {
+
+    case AF_INET:
+        return 0;
+
+#if (NGX_HAVE_INET6)
+    case AF_INET6:
+        return 1;
+#endif
+
+    default:
+        return 2;
+    }
+}
+
+
+static int ngx_libc_cdecl
+ngx_cidr_cmp(const void *one, const void *two)
+{
+    int          rc;
+    in_addr_t    a, b;
+    ngx_uint_t   r1, r2;
+    ngx_cidr_t  *first, *second;
+
+    first = (ngx_cidr_t *) one;
+    second = (ngx_cidr_t *) two;
+
+    r1 = ngx_cidr_rank(first->family);
+    r2 = ngx_cidr_rank(second->family);
+
+    if (r1 != r2) {
+        return r1 < r2 ? -1 : 1;
+    }
+
+    switch (first->family) {
+
+#if (NGX_HAVE_INET6)
+    case AF_INET6:
+        //网络字节序按字节比较就是按数值比较，掩码小的前缀短
+        rc = ngx_memcmp(first->u.in6.addr.s6_addr, second->u.in6.addr.s6_addr,
+                        16);
+        if (rc != 0) {
+            return rc;
+        }
+
+        return ngx_memcmp(first->u.in6.mask.s6_addr,
+                          second->u.in6.mask.s6_addr, 16);
+#endif
+
+    case AF_INET:
+        a = ntohl(first->u.in.addr);
+        b = ntohl(second->u.in.addr);
+
+        if (a == b) {
+            a = ntohl(first->u.in.mask);
+            b = ntohl(second->u.in.mask);
+        }
+
+        return (a < b) ? -1 : (a > b);
+
+    default:
+        return 0;
+    }
+}
+
+
+//inner是否整个落在outer里
+static ngx_uint_t
+ngx_cidr_contains(ngx_cidr_t *outer, ngx_cidr_t *inner)
+{
+#if (NGX_HAVE_INET6)
+    ngx_uint_t  n;
+#endif
+
+    if (outer->family != inner->family) {
+        return 0;
+    }
+
+    switch (outer->family) {
+
+#if (NGX_HAVE_INET6)
+    case AF_INET6:
+        for (n = 0; n < 16; n++) {
+            if ((inner->u.in6.addr.s6_addr[n] & outer->u.in6.mask.s6_addr[n])
+                != outer->u.in6.addr.s6_addr[n])
+            {
+                return 0;
+            }
+        }
+
+        return 1;
+#endif
+
+    case AF_INET:
+        return (inner->u.in.addr & outer->u.in.mask) == outer->u.in.addr;
+
+    default:
+        //AF_UNIX匹配所有的unix域连接，重复的没有用
+        return 1;
+    }
+}
+
+
+//cidr是n个互不重叠、按起始地址排好序的IPv4网段
+static ngx_int_t
+ngx_cidr_search(ngx_cidr_t *cidr, ngx_uint_t n, in_addr_t inaddr)
+{
+    in_addr_t   addr;
+    ngx_uint_t  lo, hi, mid;
+
+    addr = ntohl(inaddr);
+
+    //找第一个起始地址大于addr的网段，它前面的那个是唯一可能包含addr的
+    lo = 0;
+    hi = n;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+
+        if (ntohl(cidr[mid].u.in.addr) <= addr) {
+            lo = mid + 1;
+
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo == 0) {
+        return NGX_DECLINED;
+    }
+
+    cidr = &cidr[lo - 1];
+
+    if ((inaddr & cidr->u.in.mask) != cidr->u.in.addr) {
+        return NGX_DECLINED;
+    }
+
+    return NGX_OK;
+}
+
+
+#if (NGX_HAVE_INET6)
+
+static ngx_int_t
+ngx_cidr_search6(ngx_cidr_t *cidr, ngx_uint_t n, struct in6_addr *inaddr6)
+{
+    ngx_uint_t  lo, hi, mid, i;
+
+    lo = 0;
+    hi = n;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+
+        if (ngx_memcmp(cidr[mid].u.in6.addr.s6_addr, inaddr6->s6_addr, 16)
+            <= 0)
+        {
+            lo = mid + 1;
+
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo == 0) {
+        return NGX_DECLINED;
+    }
+
+    cidr = &cidr[lo - 1];
+
+    for (i = 0; i < 16; i++) {
+        if ((inaddr6->s6_addr[i] & cidr->u.in6.mask.s6_addr[i])
+            != cidr->u.in6.addr.s6_addr[i])
+        {
+            return NGX_DECLINED;
+        }
+    }
+
+    return NGX_OK;
+}
+
+#endif
+
+
 ngx_int_t
 ngx_parse_addr(ngx_pool_t *pool, ngx_addr_t *addr, u_char *text, size_t len)
 {
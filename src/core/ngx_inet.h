@@ -128,6 +128,11 @@ ngx_int_t ngx_ptocidr(ngx_str_t *text, ngx_cidr_t *cidr);
 
 // 用于确定是否在给定的CIDR范围内发生IPv4地址
 ngx_int_t ngx_cidr_match(struct sockaddr *sa, ngx_array_t *cidrs);
+// 配置解析完后调用一次，把cidrs整理成ngx_cidr_match可以二分查找的形式，之后不能再往里加
+ngx_int_t ngx_cidr_compile(ngx_array_t *cidrs);
+// 批量匹配n个地址，rc[i]和ngx_cidr_match(sa[i], cidrs)的返回值相同
+void ngx_cidr_match_n(struct sockaddr **sa, ngx_array_t *cidrs, ngx_int_t *rc,
+    ngx_uint_t n);
 
 
 ngx_int_t ngx_parse_addr(ngx_pool_t *pool, ngx_addr_t *addr, u_char *text,
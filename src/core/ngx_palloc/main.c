@@ -26,6 +26,7 @@ void dump_pool(ngx_pool_t* pool)
 int main() {
 
     ngx_pool_t *pool;
+    void *p, *q;
 
     printf("--------------------------------\n");
     printf("create a new pool:\n");
@@ -51,5 +52,13 @@ int main() {
     ngx_palloc(pool, 512);
     dump_pool(pool);
 
+    printf("--------------------------------\n");
+    printf("pfree a 5000 bytes large block and alloc 5000 bytes again:\n");
+    printf("--------------------------------\n");
+    p = ngx_palloc(pool, 5000);
+    ngx_pfree(pool, p);
+    q = ngx_palloc(pool, 5000);
+    printf("reuse freed block: %s\n\n", p == q ? "yes" : "no");
+
     ngx_destroy_pool(pool);
 }
\ No newline at end of file
@@ -23,16 +23,119 @@ static ngx_inline void *ngx_palloc_small(ngx_pool_t *pool, size_t size,
 static void *ngx_palloc_block(ngx_pool_t *pool, size_t size);
 //当分配的内存块大小超出pool->max限制的时候,需要分配在pool->large上
 static void *ngx_palloc_large(ngx_pool_t *pool, size_t size);
+//把large节点按alloc地址加入pool->large_hash，桶不够时翻倍
+static ngx_int_t ngx_pool_large_add(ngx_pool_t *pool, ngx_pool_large_t *large);
+//在pool->large_hash中查找alloc地址对应的large节点
+static ngx_pool_large_t *ngx_pool_large_find(ngx_pool_t *pool, void *alloc);
+//把large节点从pool->large_hash中摘掉
+static void ngx_pool_large_delete(ngx_pool_t *pool, ngx_pool_large_t *large);
+//从回收缓存或者系统申请一个size大小的内存池块
+static void *ngx_pool_block_alloc(size_t size, ngx_log_t *log);
+//把内存池块放回回收缓存，缓存已满或者不可缓存时直接释放
+static void ngx_pool_block_free(void *block, size_t size);
+
+#if (NGX_PALLOC_STATS)
+
+//查找或者登记一个ngx_create_pool调用点
+static ngx_pool_site_t *ngx_pool_stats_site(char *file, ngx_uint_t line);
+//内存池销毁时把统计累加到调用点上
+static void ngx_pool_stats_account(ngx_pool_t *pool);
+
+//更新内存池当前占用的内存和最大值
+#define ngx_pool_stat_grow(pool, n)                                           \
+    do {                                                                      \
+        (pool)->stat.footprint += (n);                                        \
+        if ((pool)->stat.footprint > (pool)->stat.peak) {                     \
+            (pool)->stat.peak = (pool)->stat.footprint;                       \
+        }                                                                     \
+    } while (0)
+
+/*
+ * 调用点表，以文件名指针和行号做开放寻址，__FILE__是字符串常量，比较指针即可；
+ * 表满之后新的调用点都计入ngx_pool_site_other
+ */
+static ngx_pool_site_t ngx_pool_sites[NGX_POOL_STATS_SITES];
+static ngx_pool_site_t ngx_pool_site_other = { "other", 0 };
+
+#endif
+
+/*
+ * large_hash的哈希值，malloc返回的地址至少16字节对齐，去掉低4位；
+ * 大块内存走mmap时按页对齐，再混入页号，避免都落到同一个桶
+ */
+#define ngx_pool_large_key(p)                                                 \
+    (((uintptr_t) (p) >> 4) ^ ((uintptr_t) (p) >> 12))
+
+#define NGX_POOL_CACHE_SLOTS                                                  \
+    (NGX_POOL_CACHE_MAX_SHIFT - NGX_POOL_CACHE_MIN_SHIFT + 1)
+
+/*
+ * 内存池块回收缓存的一个尺寸分级
+ * 空闲块之间通过块头部的 d.next 串成单链表
+ */
+typedef struct {
+    ngx_pool_t *free; //空闲块链表
+    ngx_uint_t nfree; //空闲块个数
+    ngx_uint_t low; //上次回收以来空闲块个数的最低值，这部分块整个周期都没有被用到
+} ngx_pool_cache_slot_t;
+
+typedef struct {
+    ngx_pool_cache_slot_t slots[NGX_POOL_CACHE_SLOTS];
+    ngx_uint_t max; //每个分级最多缓存的块数，0表示不缓存
+} ngx_pool_cache_t;
+
+/*
+ * 每个worker是单线程的事件循环，所以用进程内的静态变量即可，不需要加锁；
+ * 缓存在ngx_event_process_init中才开启，master进程不会缓存任何块
+ */
+static ngx_pool_cache_t ngx_pool_cache;
+
+//计算能容纳size的最小分级对应的位移，即 2^shift >= size
+static ngx_inline ngx_uint_t
+ngx_pool_cache_shift(size_t size)
+{
+    ngx_uint_t shift;
+
+    for (shift = NGX_POOL_CACHE_MIN_SHIFT;
+         ((size_t) 1 << shift) < size;
+         shift++)
+    {
+        /* void */
+    }
+
+    return shift;
+}
+
+#if (NGX_PALLOC_STATS)
+
+ngx_pool_t *
+ngx_create_pool_stats(size_t size, ngx_log_t *log, char *file,
+    ngx_uint_t line)
+
+#else
 
 ngx_pool_t *
 ngx_create_pool(size_t size, ngx_log_t *log)
+
+#endif
 {
     ngx_pool_t *p;
 
+    /*
+     * 开启了回收缓存时，把size向上取整到所在分级的大小，这样同一分级的块可以互相复用，
+     * 多出来的部分直接作为内存池的可用空间
+     */
+    if (ngx_pool_cache.max
+        && size <= ((size_t) 1 << NGX_POOL_CACHE_MAX_SHIFT))
+    {
+        size = ngx_max(size, (size_t) 1 << NGX_POOL_CACHE_MIN_SHIFT);
+        size = (size_t) 1 << ngx_pool_cache_shift(size);
+    }
+
     /**
-      * 相当于分配一块内存 ngx_alloc(size, log)
+      * 相当于分配一块内存 ngx_alloc(size, log)，开启缓存时优先复用已销毁内存池的块
       */
-    p = ngx_memalign(NGX_POOL_ALIGNMENT, size, log);
+    p = ngx_pool_block_alloc(size, log);
     if ( p == NULL ) {
         return NULL;
     }
@@ -56,9 +159,25 @@ ngx_create_pool(size_t size, ngx_log_t *log)
     p->current = p;
     p->chain = NULL;
     p->large = NULL;
+    p->large_hash = NULL;
+    p->large_hash_size = 0;
+    p->nlarge = 0;
+    p->free_large = NULL;
+    p->free_large_size = 0;
     p->cleanup = NULL;
     p->log = log;
 
+#if (NGX_PALLOC_STATS)
+    ngx_memzero(&p->stat, sizeof(ngx_pool_stat_t));
+
+    p->stat.footprint = (size_t) (p->d.end - (u_char *) p);
+    p->stat.peak = p->stat.footprint;
+    p->stat.blocks = 1;
+    p->stat.site = ngx_pool_stats_site(file, line);
+    p->stat.site->pools++;
+    p->stat.site->active++;
+#endif
+
     return p;
 }
 
@@ -71,6 +190,11 @@ ngx_destroy_pool(ngx_pool_t *pool)
     ngx_pool_t *p, *n;
     ngx_pool_large_t *l;
     ngx_pool_cleanup_t *c;
+
+#if (NGX_PALLOC_STATS)
+    ngx_pool_stats_account(pool);
+#endif
+
     /* 首先清理pool->cleanup链表 */
     for (c = pool->cleanup; c; c= c->next) {
         /* handler 为一个清理的回调函数 */
@@ -85,10 +209,15 @@ ngx_destroy_pool(ngx_pool_t *pool)
             ngx_free(l->alloc);
         }
     }
-    /* 对内存池的data数据区域进行释放 */
+
+    if (pool->large_hash) {
+        ngx_free(pool->large_hash);
+    }
+
+    /* 对内存池的data数据区域进行释放，开启缓存时放回回收缓存 */
     for (p = pool, n = pool->d.next;;
             p = n, n= n->d.next) {
-        ngx_free(p);
+        ngx_pool_block_free(p, (size_t) (p->d.end - (u_char *) p));
 
         if(n == NULL) {
             break;
@@ -107,6 +236,9 @@ ngx_reset_pool(ngx_pool_t *pool)
     /* 清理pool->large链表（pool->large为单独的大数据内存块）  */
     for (l = pool->large; l; l = l->next) {
         if (l->alloc){
+#if (NGX_PALLOC_STATS)
+            pool->stat.footprint -= l->size;
+#endif
             ngx_free(l->alloc);
         }
     }
@@ -119,6 +251,15 @@ ngx_reset_pool(ngx_pool_t *pool)
     pool->current = pool;
     pool->chain = NULL;
     pool->large = NULL;
+    /* large_hash是单独malloc的，留给重用这个内存池的请求，只清空 */
+    if (pool->large_hash) {
+        ngx_memzero(pool->large_hash,
+                    pool->large_hash_size * sizeof(ngx_pool_large_t *));
+    }
+    pool->nlarge = 0;
+    /* 空闲链表数组是从内存池中分配的，上面的块都已经释放 */
+    pool->free_large = NULL;
+    pool->free_large_size = 0;
 }
 
 /**
@@ -127,6 +268,10 @@ ngx_reset_pool(ngx_pool_t *pool)
 void *
 ngx_palloc(ngx_pool_t *pool, size_t size)
 {
+#if (NGX_PALLOC_STATS)
+    pool->stat.requested += size;
+#endif
+
 #if !(NGX_DEBUG_PALLOC)
     /* 判断每次分配的内存大小，如果超出pool->max的限制，则需要走大数据内存分配策略 */
     if (size <= pool->max) {
@@ -145,6 +290,10 @@ ngx_palloc(ngx_pool_t *pool, size_t size)
 void *
 ngx_pnalloc(ngx_pool_t *pool, size_t size)
 {
+#if (NGX_PALLOC_STATS)
+    pool->stat.requested += size;
+#endif
+
 #if !(NGX_DEBUG_PALLOC)
     if (size <= pool->max) {
         return ngx_palloc_small(pool, size, 0);
@@ -202,14 +351,19 @@ ngx_palloc_block(ngx_pool_t *pool, size_t size)
 
     //当前内存池大小
     psize = (size_t) (pool->d.end - (u_char *) pool);
-    /* 申请新的块 */
-    m = ngx_memalign(NGX_POOL_ALIGNMENT, psize, pool->log);
+    /* 申请新的块，和第一个块大小相同，所以同样可以从回收缓存中取 */
+    m = ngx_pool_block_alloc(psize, pool->log);
     if (m == NULL) {
         return NULL;
     }
 
     new = (ngx_pool_t *) m;
 
+#if (NGX_PALLOC_STATS)
+    pool->stat.blocks++;
+    ngx_pool_stat_grow(pool, psize);
+#endif
+
     new->d.end = m + psize;
     new->d.next = NULL;
     new->d.failed = 0;
@@ -228,8 +382,14 @@ ngx_palloc_block(ngx_pool_t *pool, size_t size)
       * 将pool->current设置成最新的子节点之后，每次最大循环4次，不会去遍历整个缓存池链表
       */
     for (p = pool->current; p->d.next; p = p->d.next) {
+#if (NGX_PALLOC_STATS)
+        pool->stat.failed++;
+#endif
         if (p->d.failed++ > 4) {
             pool->current = p->d.next;  //失败4次以上移动current指针
+#if (NGX_PALLOC_STATS)
+            pool->stat.moved++;
+#endif
         }
     }
 
@@ -240,27 +400,66 @@ ngx_palloc_block(ngx_pool_t *pool, size_t size)
 
 /**
  * 当分配的内存块大小超出pool->max限制的时候,需要分配在pool->large上
+ * 优先从本内存池ngx_pfree过的同级空闲块中复用
  */
 static void *
 ngx_palloc_large(ngx_pool_t *pool, size_t size)
 {
-    void *p;
-    ngx_uint_t n;
+    u_char *p;
+    ngx_uint_t n, shift;
     ngx_pool_large_t *large;
+    ngx_pool_large_hdr_t *h, **fl;
 
-    // 分配 size 大小的内存
-    p = ngx_alloc(size, pool->log);
+    /*
+     * 在分级范围内的块按所在级的大小(能容纳size的最小2的幂次方)分配，
+     * ngx_pfree按块大小挂回同一级，下次同样大小的请求才能取到它；
+     * 否则5000字节的块会挂在4K级，而5000字节的请求去8K级找，永远复用不上
+     */
+    if (size <= ((size_t) 1 << NGX_POOL_LARGE_MAX_SHIFT)) {
+
+        for (shift = NGX_POOL_LARGE_MIN_SHIFT;
+             ((size_t) 1 << shift) < size;
+             shift++)
+        {
+            /* void */
+        }
+
+        size = (size_t) 1 << shift;
+
+        fl = pool->free_large
+             ? &pool->free_large[shift - NGX_POOL_LARGE_MIN_SHIFT] : NULL;
+
+        if (fl && *fl) {
+            h = *fl;
+            *fl = h->next;
+            h->magic = (uintptr_t) pool ^ NGX_POOL_LARGE_MAGIC;
+            pool->free_large_size -= h->size;
+
+#if (NGX_PALLOC_STATS)
+            pool->stat.large++;
+#endif
+
+            return (u_char *) h + sizeof(ngx_pool_large_hdr_t);
+        }
+    }
+
+    // 分配 size 大小的内存，前面留出ngx_pool_large_hdr_t头部
+    p = ngx_alloc(sizeof(ngx_pool_large_hdr_t) + size, pool->log);
     if(p == NULL) {
         return NULL;
     }
 
+#if (NGX_PALLOC_STATS)
+    pool->stat.large++;
+    ngx_pool_stat_grow(pool, size);
+#endif
+
     n = 0;
     // 在 pool 的 large 链中寻找存储区为空的节点，把新分配的内存区首地址赋给它
     for (large = pool->large; large; large = large->next) {
         // 找到 large 链末尾，在其后插入之，并返回给外部使用
         if (large->alloc == NULL) {
-            large->alloc = p;
-            return p;
+            goto found;
         }
         // 查看的 large 节点超过 3 个，不再尝试和寻找，由下面代码实现创建新 large 节点的逻辑
         if(n++ > 3) {
@@ -270,18 +469,46 @@ ngx_palloc_large(ngx_pool_t *pool, size_t size)
     // 创建 large 链的一个新节点，如果失败则释放刚才创建的 size 大小的内存，并返回 NULL
     large = ngx_palloc_small(pool, sizeof(ngx_pool_large_t), 1);
     if(large == NULL) {
+#if (NGX_PALLOC_STATS)
+        pool->stat.footprint -= size;
+#endif
         ngx_free(p);
         return NULL;
     }
 
-    large->alloc = p;
     large->next = pool->large;
     pool->large = large;
 
-    return p;
+found:
+
+    large->alloc = p;
+
+    if (ngx_pool_large_add(pool, large) != NGX_OK) {
+#if (NGX_PALLOC_STATS)
+        pool->stat.footprint -= size;
+#endif
+        large->alloc = NULL;
+        ngx_free(p);
+        return NULL;
+    }
+
+#if (NGX_PALLOC_STATS)
+    large->size = size;
+#endif
+
+    h = (ngx_pool_large_hdr_t *) p;
+    h->magic = (uintptr_t) pool ^ NGX_POOL_LARGE_MAGIC;
+    h->large = large;
+    h->size = size;
+    h->next = NULL;
+
+    return p + sizeof(ngx_pool_large_hdr_t);
 }
 
-//类似于ngx_palloc_large 不过不再执行large链表尾部添加逻辑
+/*
+ * 类似于ngx_palloc_large 不过不再执行large链表尾部添加逻辑，也不从空闲链表中复用；
+ * 不带ngx_pool_large_hdr_t头部，否则头部要占满一个alignment，按页对齐时内存翻倍
+ */
 void *
 ngx_pmemalign(ngx_pool_t *pool, size_t size, size_t alignment)
 {
@@ -289,20 +516,44 @@ ngx_pmemalign(ngx_pool_t *pool, size_t size, size_t alignment)
     ngx_pool_large_t  *large;
 
     // 创建一块 size 大小的内存，内存以 alignment 字节对齐
+#if (NGX_PALLOC_STATS)
+    pool->stat.requested += size;
+#endif
+
     p = ngx_memalign(alignment, size, pool->log);
     if (p == NULL) {
         return NULL;
     }
 
+#if (NGX_PALLOC_STATS)
+    pool->stat.large++;
+    ngx_pool_stat_grow(pool, size);
+#endif
+
     //创建一个 large 节点
     large = ngx_palloc_small(pool, sizeof(ngx_pool_large_t), 1);
     if (large == NULL) {
+#if (NGX_PALLOC_STATS)
+        pool->stat.footprint -= size;
+#endif
         ngx_free(p);
         return NULL;
     }
 
     // 将这个新的 large 节点交付给 pool 的 large 字段
     large->alloc = p;
+
+    if (ngx_pool_large_add(pool, large) != NGX_OK) {
+#if (NGX_PALLOC_STATS)
+        pool->stat.footprint -= size;
+#endif
+        ngx_free(p);
+        return NULL;
+    }
+
+#if (NGX_PALLOC_STATS)
+    large->size = size;
+#endif
     large->next = pool->large;
     pool->large = large;
 
@@ -311,24 +562,177 @@ ngx_pmemalign(ngx_pool_t *pool, size_t size, size_t alignment)
 
 /**
  * 大内存块释放  pool->large
+ * 先按地址在pool->large_hash中确认p是本内存池的大块内存，之后才读它的头部，小块内存和别的内存池的指针都不会被读；
+ * 大小在缓存范围内的块挂到空闲链表上留给本内存池复用，内存直到ngx_reset_pool/ngx_destroy_pool才真正释放，
+ * 空闲链表上的字节数超过NGX_POOL_LARGE_RETAIN时，以及ngx_pmemalign分配的块，直接free
  */
 ngx_int_t
 ngx_pfree(ngx_pool_t *pool, void *p)
 {
-    ngx_pool_large_t  *l;
-    /* 在pool->large链上循环搜索，并且只释放内容区域，不释放ngx_pool_large_t数据结构*/
-    for (l = pool->large; l; l = l->next) {
-        if (p == l->alloc) {
-            ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, pool->log, 0,
-                           "free: %p", l->alloc);
-            ngx_free(l->alloc);
-            l->alloc = NULL;
+    ngx_uint_t             shift;
+    ngx_pool_large_t      *l;
+    ngx_pool_large_hdr_t  *h;
+
+    //ngx_pmemalign的块没有头部，和原来一样直接释放
+    l = ngx_pool_large_find(pool, p);
+    if (l) {
+        goto free;
+    }
+
+    //这里只是算地址，确认h是某个large节点的alloc之前不会去读它
+    h = (ngx_pool_large_hdr_t *) p - 1;
+
+    l = ngx_pool_large_find(pool, h);
+
+    //不是本内存池的大块内存，或者已经free过(已经从large_hash中摘掉)
+    if (l == NULL) {
+        return NGX_DECLINED;
+    }
+
+    //已经挂在空闲链表上的块magic为0，重复ngx_pfree时不会再挂一次
+    if (h->magic != ((uintptr_t) pool ^ NGX_POOL_LARGE_MAGIC)) {
+        return NGX_DECLINED;
+    }
+
+    if (h->size >= ((size_t) 1 << NGX_POOL_LARGE_MIN_SHIFT)
+        && h->size < ((size_t) 1 << (NGX_POOL_LARGE_MAX_SHIFT + 1))
+        && pool->free_large_size + h->size <= NGX_POOL_LARGE_RETAIN)
+    {
+        if (pool->free_large == NULL) {
+            pool->free_large = ngx_palloc_small(pool,
+                              NGX_POOL_LARGE_CLASSES
+                              * sizeof(ngx_pool_large_hdr_t *), 1);
+
+            if (pool->free_large) {
+                ngx_memzero(pool->free_large, NGX_POOL_LARGE_CLASSES
+                                              * sizeof(ngx_pool_large_hdr_t *));
+            }
+        }
+
+        if (pool->free_large) {
+            //分级范围内的块大小就是所在级的2的幂次方，范围外的块大小不会落到这里
+            for (shift = NGX_POOL_LARGE_MIN_SHIFT;
+                 ((size_t) 1 << (shift + 1)) <= h->size;
+                 shift++)
+            {
+                /* void */
+            }
+
+            h->magic = 0;
+            h->next = pool->free_large[shift - NGX_POOL_LARGE_MIN_SHIFT];
+            pool->free_large[shift - NGX_POOL_LARGE_MIN_SHIFT] = h;
+            pool->free_large_size += h->size;
 
             return NGX_OK;
         }
     }
 
-    return NGX_DECLINED;
+free:
+
+    ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, pool->log, 0,
+                   "free: %p", l->alloc);
+
+    /* 只释放内容区域，不释放ngx_pool_large_t数据结构，留给后面的ngx_palloc_large复用 */
+#if (NGX_PALLOC_STATS)
+    pool->stat.footprint -= l->size;
+#endif
+    ngx_pool_large_delete(pool, l);
+    ngx_free(l->alloc);
+    l->alloc = NULL;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_pool_large_add(ngx_pool_t *pool, ngx_pool_large_t *large)
+{
+    ngx_uint_t          i, n, k;
+    ngx_pool_large_t  **hash, *l, *next;
+
+    if (pool->nlarge >= pool->large_hash_size) {
+
+        n = pool->large_hash_size ? pool->large_hash_size * 2
+                                  : NGX_POOL_LARGE_HASH;
+
+        hash = ngx_alloc(n * sizeof(ngx_pool_large_t *), pool->log);
+
+        if (hash == NULL) {
+            if (pool->large_hash == NULL) {
+                return NGX_ERROR;
+            }
+
+            //扩容失败就继续用原来的表，只是冲突链长一些
+            goto add;
+        }
+
+        ngx_memzero(hash, n * sizeof(ngx_pool_large_t *));
+
+        for (i = 0; i < pool->large_hash_size; i++) {
+            for (l = pool->large_hash[i]; l; l = next) {
+                next = l->hnext;
+                k = ngx_pool_large_key(l->alloc) & (n - 1);
+                l->hnext = hash[k];
+                hash[k] = l;
+            }
+        }
+
+        if (pool->large_hash) {
+            ngx_free(pool->large_hash);
+        }
+
+        pool->large_hash = hash;
+        pool->large_hash_size = n;
+    }
+
+add:
+
+    k = ngx_pool_large_key(large->alloc) & (pool->large_hash_size - 1);
+
+    large->hnext = pool->large_hash[k];
+    pool->large_hash[k] = large;
+    pool->nlarge++;
+
+    return NGX_OK;
+}
+
+
+static ngx_pool_large_t *
+ngx_pool_large_find(ngx_pool_t *pool, void *alloc)
+{
+    ngx_pool_large_t  *l;
+
+    if (pool->large_hash == NULL) {
+        return NULL;
+    }
+
+    l = pool->large_hash[ngx_pool_large_key(alloc)
+                         & (pool->large_hash_size - 1)];
+
+    for ( /* void */ ; l; l = l->hnext) {
+        if (l->alloc == alloc) {
+            return l;
+        }
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_pool_large_delete(ngx_pool_t *pool, ngx_pool_large_t *large)
+{
+    ngx_pool_large_t  **pl;
+
+    pl = &pool->large_hash[ngx_pool_large_key(large->alloc)
+                           & (pool->large_hash_size - 1)];
+
+    while (*pl != large) {
+        pl = &(*pl)->hnext;
+    }
+
+    *pl = large->hnext;
+    pool->nlarge--;
 }
 
 //封装 palloc 为 pcalloc，实现分配内存并初始化为 0
@@ -444,3 +848,204 @@ ngx_pool_run_cleanup_file(ngx_pool_t *p, ngx_fd_t fd)
         }
     }
 }
+
+
+/**
+ * 开启或关闭本进程的内存池块回收缓存
+ * 关闭时会把已缓存的块全部释放
+ */
+void
+ngx_pool_cache_init(ngx_uint_t max)
+{
+    ngx_pool_cache.max = max;
+
+    if (max == 0) {
+        ngx_pool_cache_trim(1);
+    }
+}
+
+/**
+ * 回收缓存的定时清理
+ * 每个分级的low记录了从上次清理到现在空闲块个数的最低值，这么多块在整个周期内都没有被取走过，
+ * 说明是多余的，直接还给系统；这样连接数回落之后缓存也会跟着缩小
+ */
+void
+ngx_pool_cache_trim(ngx_uint_t all)
+{
+    ngx_uint_t i, n;
+    ngx_pool_t *p;
+    ngx_pool_cache_slot_t *slot;
+
+    for (i = 0; i < NGX_POOL_CACHE_SLOTS; i++) {
+        slot = &ngx_pool_cache.slots[i];
+
+        n = all ? slot->nfree : slot->low;
+
+        while (n--) {
+            p = slot->free;
+            slot->free = p->d.next;
+            slot->nfree--;
+
+            ngx_free(p);
+        }
+
+        slot->low = slot->nfree;
+    }
+}
+
+/**
+ * 申请一个内存池块
+ * 只有大小正好是某个分级的块才可能从缓存里取到，否则和原来一样走ngx_memalign
+ */
+static void *
+ngx_pool_block_alloc(size_t size, ngx_log_t *log)
+{
+    ngx_uint_t shift;
+    ngx_pool_t *p;
+    ngx_pool_cache_slot_t *slot;
+
+    if (ngx_pool_cache.max
+        && size <= ((size_t) 1 << NGX_POOL_CACHE_MAX_SHIFT))
+    {
+        shift = ngx_pool_cache_shift(size);
+
+        if (((size_t) 1 << shift) == size) {
+            slot = &ngx_pool_cache.slots[shift - NGX_POOL_CACHE_MIN_SHIFT];
+
+            if (slot->free) {
+                p = slot->free;
+                slot->free = p->d.next;
+
+                if (--slot->nfree < slot->low) {
+                    slot->low = slot->nfree;
+                }
+
+                ngx_log_debug2(NGX_LOG_DEBUG_ALLOC, log, 0,
+                               "pool cache hit: %p:%uz", p, size);
+
+                return p;
+            }
+        }
+    }
+
+    return ngx_memalign(NGX_POOL_ALIGNMENT, size, log);
+}
+
+/**
+ * 释放一个内存池块
+ * 块大小正好是某个分级并且该分级没有缓存满的时候挂到空闲链表上，否则直接free
+ */
+static void
+ngx_pool_block_free(void *block, size_t size)
+{
+    ngx_uint_t shift;
+    ngx_pool_t *p;
+    ngx_pool_cache_slot_t *slot;
+
+    if (ngx_pool_cache.max
+        && size >= ((size_t) 1 << NGX_POOL_CACHE_MIN_SHIFT)
+        && size <= ((size_t) 1 << NGX_POOL_CACHE_MAX_SHIFT))
+    {
+        shift = ngx_pool_cache_shift(size);
+        slot = &ngx_pool_cache.slots[shift - NGX_POOL_CACHE_MIN_SHIFT];
+
+        if (((size_t) 1 << shift) == size
+            && slot->nfree < ngx_pool_cache.max)
+        {
+            p = block;
+            p->d.next = slot->free;
+            slot->free = p;
+            slot->nfree++;
+
+            return;
+        }
+    }
+
+    ngx_free(block);
+}
+
+
+#if (NGX_PALLOC_STATS)
+
+static ngx_pool_site_t *
+ngx_pool_stats_site(char *file, ngx_uint_t line)
+{
+    ngx_uint_t i, n;
+    ngx_pool_site_t *site;
+
+    n = ((uintptr_t) file ^ (line * 31)) % NGX_POOL_STATS_SITES;
+
+    for (i = 0; i < NGX_POOL_STATS_SITES; i++) {
+        site = &ngx_pool_sites[(n + i) % NGX_POOL_STATS_SITES];
+
+        if (site->file == file && site->line == line) {
+            return site;
+        }
+
+        if (site->file == NULL) {
+            site->file = file;
+            site->line = line;
+            return site;
+        }
+    }
+
+    return &ngx_pool_site_other;
+}
+
+static void
+ngx_pool_stats_account(ngx_pool_t *pool)
+{
+    ngx_pool_site_t *site;
+
+    site = pool->stat.site;
+
+    site->active--;
+    site->requested += pool->stat.requested;
+    site->blocks += pool->stat.blocks;
+    site->large += pool->stat.large;
+    site->failed += pool->stat.failed;
+
+    if (pool->stat.peak > site->peak) {
+        site->peak = pool->stat.peak;
+    }
+
+    ngx_log_debug8(NGX_LOG_DEBUG_ALLOC, pool->log, 0,
+                   "pool stats %s:%ui requested:%uz peak:%uz "
+                   "blocks:%ui large:%ui failed:%ui moved:%ui",
+                   site->file, site->line, pool->stat.requested,
+                   pool->stat.peak, pool->stat.blocks, pool->stat.large,
+                   pool->stat.failed, pool->stat.moved);
+}
+
+/**
+ * 输出各个调用点的内存池统计
+ * avg是已销毁内存池平均申请的字节数，peak是单个内存池占用的最大内存，
+ * 两者和配置的池大小对比就能看出池是配大了还是配小了；
+ * blocks和failed偏高说明池太小，请求经常要追加新块
+ */
+void
+ngx_pool_stats_dump(ngx_log_t *log)
+{
+    ngx_uint_t i, done;
+    ngx_pool_site_t *site;
+
+    for (i = 0; i <= NGX_POOL_STATS_SITES; i++) {
+        site = (i < NGX_POOL_STATS_SITES) ? &ngx_pool_sites[i]
+                                          : &ngx_pool_site_other;
+
+        if (site->pools == 0) {
+            continue;
+        }
+
+        done = site->pools - site->active;
+
+        ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                      "pool %s:%ui pools:%ui active:%ui avg:%uz peak:%uz "
+                      "blocks:%ui large:%ui failed:%ui",
+                      site->file, site->line, site->pools, site->active,
+                      done ? site->requested / done : 0, site->peak,
+                      site->blocks, site->large, site->failed);
+    }
+}
+
+#endif
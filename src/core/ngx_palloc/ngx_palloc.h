@@ -35,6 +35,34 @@
 //TODO  ????
 #define NGX_MIN_POOL_SIZE ngx_align((sizeof(ngx_pool_t) + 2 * sizeof(ngx_pool_large_t)),NGX_POOL_ALIGNMENT)
 
+/*
+ * 每个worker进程的内存池块回收缓存按块大小分级，每级是2的幂次方，
+ * 从256字节(2^8)到64K(2^16)，超过64K的块不缓存，直接走malloc/free
+ */
+#define NGX_POOL_CACHE_MIN_SHIFT 8
+#define NGX_POOL_CACHE_MAX_SHIFT 16
+
+/*
+ * ngx_pfree释放的大块内存按大小挂到内存池自己的空闲链表上，供后面的ngx_palloc_large复用，
+ * 分级同样是2的幂次方，大小在[2^8, 2^21)之间的块才会缓存；
+ * 不超过2^20的大块内存分配时就按所在级的大小向上取整，释放和复用落在同一级
+ */
+#define NGX_POOL_LARGE_MIN_SHIFT 8
+#define NGX_POOL_LARGE_MAX_SHIFT 20
+#define NGX_POOL_LARGE_CLASSES                                                \
+    (NGX_POOL_LARGE_MAX_SHIFT - NGX_POOL_LARGE_MIN_SHIFT + 1)
+
+//每个内存池空闲链表上最多留着的字节数，超过后ngx_pfree的块直接free，0表示不缓存
+#ifndef NGX_POOL_LARGE_RETAIN
+#define NGX_POOL_LARGE_RETAIN (1024 * 1024)
+#endif
+
+//pool->large_hash的初始桶数，节点数达到桶数时翻倍，必须是2的幂次方
+#define NGX_POOL_LARGE_HASH 8
+
+//ngx_pool_large_hdr_t中magic的取值为 (uintptr_t) pool ^ NGX_POOL_LARGE_MAGIC
+#define NGX_POOL_LARGE_MAGIC ((uintptr_t) 0x5a5a5a5a)
+
 typedef void (*ngx_pool_cleanup_pt)(void *data);
 
 typedef struct ngx_pool_cleanup_s ngx_pool_cleanup_t;
@@ -51,8 +79,61 @@ struct ngx_pool_large_s {/*大块内存数据结构*/
     /*其实是一个头插法的单链表，每次分配一个大块内存都将列表节点插入到这个链表的表头*/
     ngx_pool_large_t *next;
     void *alloc; /*大块内存是直接用malloc来分配的，alloc就是用来保存分配到的内存地址*/
+    ngx_pool_large_t *hnext; /*pool->large_hash同一个桶里的下一个节点，alloc为NULL的节点不在表里*/
+#if (NGX_PALLOC_STATS)
+    size_t size; /*大块内存的大小，ngx_pfree时用来更新统计*/
+#endif
 };
 
+typedef struct ngx_pool_large_hdr_s ngx_pool_large_hdr_t;
+
+/*
+ * ngx_palloc_large分配的大块内存的头部，紧挨着放在返回给调用者的地址前面，
+ * 记录块的大小和空闲链表指针；
+ * ngx_pfree先在pool->large_hash中按地址确认p确实是本内存池的大块内存，才会读头部，
+ * ngx_pmemalign分配的块没有头部，仍按原来的方式直接释放
+ */
+struct ngx_pool_large_hdr_s {
+    uintptr_t magic; //所属内存池地址异或NGX_POOL_LARGE_MAGIC，挂在空闲链表上时为0
+    ngx_pool_large_t *large; //对应的large节点，large->alloc是实际malloc到的地址
+    size_t size; //可用大小
+    ngx_pool_large_hdr_t *next; //空闲链表
+};
+
+#if (NGX_PALLOC_STATS)
+
+/*
+ * 内存池统计，编译时定义NGX_PALLOC_STATS才开启
+ * 每个ngx_create_pool调用点(文件+行号)对应一个ngx_pool_site_t，内存池销毁时把自己的统计累加进去，
+ * 用来按数据确定connection_pool_size、request_pool_size这类配置，找出浪费内存的内存池
+ */
+#define NGX_POOL_STATS_SITES 256
+
+typedef struct {
+    char *file; //调用ngx_create_pool的源文件
+    ngx_uint_t line; //调用ngx_create_pool的行号
+    ngx_uint_t pools; //创建过的内存池个数
+    ngx_uint_t active; //还没有销毁的内存池个数
+    size_t requested; //已销毁内存池累计申请的字节数
+    size_t peak; //单个内存池占用内存的最大值
+    ngx_uint_t blocks; //已销毁内存池累计的块数
+    ngx_uint_t large; //已销毁内存池累计的大块内存分配次数
+    ngx_uint_t failed; //已销毁内存池累计的 d.failed 增加次数
+} ngx_pool_site_t;
+
+typedef struct {
+    size_t requested; //通过ngx_palloc等接口申请的字节数
+    size_t footprint; //当前占用的内存，包括所有块和大块内存
+    size_t peak; //footprint的最大值
+    ngx_uint_t blocks; //块数，包括第一个块
+    ngx_uint_t large; //走ngx_palloc_large/ngx_pmemalign的次数
+    ngx_uint_t failed; //ngx_palloc_block中 d.failed 增加的次数
+    ngx_uint_t moved; //pool->current 因为失败次数过多而后移的次数
+    ngx_pool_site_t *site; //所属的调用点
+} ngx_pool_stat_t;
+
+#endif
+
 /*一个内存池是由多个pool节点组成的链，这个结构用来链接各个pool节点和保存pool节点可用的内存区域起止地址*/
 typedef struct {
     u_char *last; // 数据存储的已用区尾地址
@@ -67,8 +148,16 @@ struct ngx_pool_s {
     ngx_pool_t *current;  // 内存池
     ngx_chain_t *chain; //缓冲区链表
     ngx_pool_large_t *large; // 用于存储大数据，链表结构
+    ngx_pool_large_t **large_hash; // 以alloc地址为键的large节点哈希表，ngx_pfree用来O(1)确认归属
+    ngx_uint_t large_hash_size; // 桶数，2的幂次方
+    ngx_uint_t nlarge; // large_hash中的节点数
+    ngx_pool_large_hdr_t **free_large; // 按大小分级的大块内存空闲链表，第一次ngx_pfree时才分配
+    size_t free_large_size; // 空闲链表上的块的总字节数，不超过NGX_POOL_LARGE_RETAIN
     ngx_pool_cleanup_t *cleanup;  // 用于清理，链表结构
     ngx_log_t *log;
+#if (NGX_PALLOC_STATS)
+    ngx_pool_stat_t stat; // 内存池统计，只在第一个块中使用
+#endif
 };
 
 typedef struct {
@@ -82,7 +171,15 @@ void *ngx_alloc(size_t size, ngx_log_t *log);
 void *ngx_calloc(size_t size, ngx_log_t *log);
 
 //创建一个内存池
+#if (NGX_PALLOC_STATS)
+//开启统计时记录调用点，按调用点汇总统计
+ngx_pool_t *ngx_create_pool_stats(size_t size, ngx_log_t *log, char *file,
+    ngx_uint_t line);
+#define ngx_create_pool(size, log)                                            \
+    ngx_create_pool_stats(size, log, __FILE__, __LINE__)
+#else
 ngx_pool_t *ngx_create_pool(size_t size, ngx_log_t *log);
+#endif
 //销毁内存池 pool
 void ngx_destroy_pool(ngx_pool_t *pool);
 //重置内存池
@@ -112,5 +209,15 @@ void ngx_pool_cleanup_file(void *data);
 //从文件系统删除文件，data 指针指向一个 ngx_pool_cleanup_file_t 类型的数据
 void ngx_pool_delete_file(void *data);
 
+//开启本进程的内存池块回收缓存，max为每个尺寸分级最多缓存的块数，0表示关闭
+void ngx_pool_cache_init(ngx_uint_t max);
+//释放缓存中一直空闲的块，all为1时释放全部缓存块
+void ngx_pool_cache_trim(ngx_uint_t all);
+
+#if (NGX_PALLOC_STATS)
+//把各个调用点的内存池统计输出到日志中
+void ngx_pool_stats_dump(ngx_log_t *log);
+#endif
+
 
 #endif //NGX_PALLOC_NGX_PALLOC_H
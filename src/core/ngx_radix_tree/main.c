@@ -1,7 +1,34 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 #include <ngx_core.h>
 
+/*
+ * 模拟完整的IPv6 BGP路由表：4万个分配给运营商的/28~/36，
+ * 再在它们下面随机切出16万个/40、/44、/48，都在2000::/3里
+ */
+#define Bgp6_Allocs   40000
+#define Bgp6_Routes   200000
+#define Lookup_Num    1000000
+
+/* 模拟IPv4的geo/ACL表，90万个前缀，大部分是/24 */
+#define Ipv4_Routes   900000
+#define Ipv4_Lookups  10000000
+
+/* 共享内存快照：几个读者进程一直查，父进程在它们查的同时不停地发布新快照 */
+#define Shm_Readers    4
+#define Shm_Pool_Size  (512 * 1024 * 1024)
+
+void bench_radix32dir(void);
+void bench_radix_shm(void);
+void bench_radix_batch(void);
+void bench_radix128(void);
+
+static ngx_log_t bench_log;
+
 void travel_radix_tree(ngx_radix_node_t *root)
 {
     if (root->left != NULL)
@@ -39,6 +66,9 @@ int main() {
     ngx_pagesize = getpagesize();
     printf("pagesize = %d\n", ngx_pagesize);
 
+    //平时在ngx_os_init里检测，批量查找按它选择AVX2
+    ngx_cpuinfo();
+
     /*创建基数树，prealloc=0时，只创建结构体ngx_radix_tree_t,没有创建任何基数树节点*/
     ngx_radix_tree_t *tree = ngx_radix_tree_create(pool, -1);
     if(tree == NULL) {
@@ -47,9 +77,9 @@ int main() {
     }
 
     ngx_uint_t deep = 5; //树的最大深度为4
-    ngx_uint_t mask = 0;
-    ngx_uint_t inc  = 0x80000000;
-    ngx_uint_t key = 0;
+    uint32_t   mask = 0;
+    uint32_t   inc  = 0x80000000;
+    uint32_t   key = 0;
     ngx_uint_t cunt = 0;
 
     while (deep--)
@@ -113,5 +143,616 @@ int main() {
         printf("not find the the value with the key = %x\n", tkey);
     }
 
+    bench_radix32dir();
+    bench_radix_batch();
+    bench_radix_shm();
+    bench_radix128();
+
     return 0;
-}
\ No newline at end of file
+}
+
+static ngx_uint_t
+bench_rand(void)
+{
+    return ((ngx_uint_t) rand() << 16) ^ rand();
+}
+
+//addr前len位不变，后面的位随机填上
+static void
+bench_fill(u_char *addr, ngx_uint_t len)
+{
+    ngx_uint_t i;
+    u_char keep;
+
+    for (i = len / 8; i < 16; i++) {
+        keep = (i == len / 8) ? (u_char) (0xff00 >> (len % 8)) : 0;
+        addr[i] = (addr[i] & keep) | (bench_rand() & ~keep);
+    }
+}
+
+static void
+bench_prefix(u_char *key, u_char *mask, ngx_uint_t len)
+{
+    ngx_uint_t i;
+
+    ngx_memzero(mask, 16);
+
+    for (i = 0; i < len; i++) {
+        mask[i / 8] |= 0x80 >> (i % 8);
+    }
+
+    for (i = 0; i < 16; i++) {
+        key[i] &= mask[i];
+    }
+}
+
+static double
+bench_ms(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1e3
+           + (end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static uint32_t
+bench_mask32(ngx_uint_t len)
+{
+    return len ? (uint32_t) (0xffffffff << (32 - len)) : 0;
+}
+
+/*
+ * 生成Ipv4_Routes个前缀和Ipv4_Lookups个要查的地址，都在1.0.0.0 ~ 223.255.255.255，
+ * 70%的地址落在某个前缀里
+ */
+static void
+bench_ipv4_table(ngx_pool_t *pool, uint32_t **keys, ngx_uint_t **lens,
+    uint32_t **addrs)
+{
+    ngx_uint_t i, j;
+    //按BGP表里前缀长度的大致比例抽样
+    static ngx_uint_t v4_lens[] = { 16, 18, 19, 20, 21, 22, 22, 23, 23,
+                                    24, 24, 24, 24, 24, 24, 24, 24, 24, 24,
+                                    24, 24, 25, 27, 28, 29, 32 };
+
+    *keys = ngx_palloc(pool, Ipv4_Routes * sizeof(uint32_t));
+    *lens = ngx_palloc(pool, Ipv4_Routes * sizeof(ngx_uint_t));
+    *addrs = ngx_palloc(pool, Ipv4_Lookups * sizeof(uint32_t));
+
+    srand(2);
+
+    for (i = 0; i < Ipv4_Routes; i++) {
+        (*lens)[i] = v4_lens[bench_rand() % (sizeof(v4_lens) / sizeof(v4_lens[0]))];
+        (*keys)[i] = (uint32_t) ((1 + bench_rand() % 223) << 24 | (bench_rand() & 0xffffff));
+        (*keys)[i] &= bench_mask32((*lens)[i]);
+    }
+
+    for (i = 0; i < Ipv4_Lookups; i++) {
+        if (bench_rand() % 10 < 7) {
+            j = bench_rand() % Ipv4_Routes;
+            (*addrs)[i] = (*keys)[j] | ((uint32_t) bench_rand() & ~bench_mask32((*lens)[j]));
+
+        } else {
+            (*addrs)[i] = (uint32_t) ((1 + bench_rand() % 223) << 24 | (bench_rand() & 0xffffff));
+        }
+    }
+}
+
+//把表插入新建的树，value是base + 前缀下标，返回插入成功的个数
+static ngx_uint_t
+bench_ipv4_tree(ngx_radix_tree_t *tree, uint32_t *keys, ngx_uint_t *lens,
+    uintptr_t base)
+{
+    ngx_uint_t i, n;
+
+    n = 0;
+    for (i = 0; i < Ipv4_Routes; i++) {
+        n += (ngx_radix32tree_insert(tree, keys[i], bench_mask32(lens[i]), base + i) == NGX_OK);
+    }
+
+    return n;
+}
+
+void bench_radix32dir(void)
+{
+    uint32_t *keys, *addrs;
+    ngx_uint_t i, n, diff, *lens;
+    uintptr_t sum1, sum2;
+    ngx_pool_t *pool;
+    ngx_radix_tree_t *tree;
+    ngx_radix_dir_t *dir;
+    struct timespec start, end;
+    double insert, build, find1, find2;
+
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, NULL);
+    bench_ipv4_table(pool, &keys, &lens, &addrs);
+
+    tree = ngx_radix_tree_create(pool, 0);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    n = bench_ipv4_tree(tree, keys, lens, 0);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    insert = bench_ms(&start, &end);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    dir = ngx_radix32dir_create(tree, &bench_log);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    build = bench_ms(&start, &end);
+
+    if (dir == NULL) {
+        printf("create radix dir failed!\n");
+        ngx_destroy_pool(pool);
+        return;
+    }
+
+    sum1 = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < Ipv4_Lookups; i++) {
+        sum1 += ngx_radix32tree_find(tree, addrs[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    find1 = bench_ms(&start, &end) * 1e6 / Ipv4_Lookups;
+
+    sum2 = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < Ipv4_Lookups; i++) {
+        sum2 += ngx_radix32dir_find(dir, addrs[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    find2 = bench_ms(&start, &end) * 1e6 / Ipv4_Lookups;
+
+    diff = 0;
+    for (i = 0; i < Ipv4_Lookups; i++) {
+        diff += (ngx_radix32tree_find(tree, addrs[i])
+                 != ngx_radix32dir_find(dir, addrs[i]));
+    }
+
+    printf("--------------------------------\n");
+    printf("IPv4 table: %lu prefixes, %d lookups\n", (unsigned long) n, Ipv4_Lookups);
+    printf("--------------------------------\n");
+    printf("radix32tree  insert %8.2fms  find %6.1fns  %8lu KB\n",
+           insert, find1, (unsigned long) (dir->tree_size >> 10));
+    printf("radix32dir   build  %8.2fms  find %6.1fns  %8lu KB  (%lu tbl8 groups)\n",
+           build, find2, (unsigned long) (dir->size >> 10),
+           (unsigned long) dir->ngroups);
+    printf("mismatches: %lu%s\n", (unsigned long) diff,
+           sum1 == sum2 ? "" : "  (checksum differs!)");
+
+    ngx_radix32dir_destroy(dir);
+    ngx_destroy_pool(pool);
+}
+
+static double
+bench_ns(struct timespec *start, struct timespec *end, ngx_uint_t n)
+{
+    return bench_ms(start, end) * 1e6 / n;
+}
+
+/*
+ * 逐个查找和批量查找的吞吐量对比，批量的每次传Batch_Size个key，和一次accept到的一批连接差不多；
+ * CIDR表用同样的前缀，每个都是ngx_cidr_t，整理后去掉了被包含的网段
+ */
+#define Batch_Size    64
+#define Cidr_Lookups  1000000
+
+void bench_radix_batch(void)
+{
+    uint32_t *keys, *addrs;
+    ngx_uint_t i, n, *lens, diff, avx2, features;
+    uintptr_t *v1, *v2;
+    ngx_int_t *rc1, *rc2;
+    ngx_pool_t *pool;
+    ngx_radix_tree_t *tree;
+    ngx_radix_dir_t *dir;
+    ngx_array_t *cidrs;
+    ngx_cidr_t *cidr;
+    struct sockaddr_in *sin;
+    struct sockaddr **sa;
+    struct timespec start, end;
+    double one, batch;
+
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, NULL);
+    bench_ipv4_table(pool, &keys, &lens, &addrs);
+
+    tree = ngx_radix_tree_create(pool, 0);
+    n = bench_ipv4_tree(tree, keys, lens, 0);
+    dir = ngx_radix32dir_create(tree, &bench_log);
+
+    v1 = ngx_palloc(pool, Ipv4_Lookups * sizeof(uintptr_t));
+    v2 = ngx_palloc(pool, Ipv4_Lookups * sizeof(uintptr_t));
+
+    printf("--------------------------------\n");
+    printf("batch lookup: %lu prefixes, batches of %d (ns/lookup)\n",
+           (unsigned long) n, Batch_Size);
+    printf("--------------------------------\n");
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < Ipv4_Lookups; i++) {
+        v1[i] = ngx_radix32tree_find(tree, addrs[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    one = bench_ns(&start, &end, Ipv4_Lookups);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < Ipv4_Lookups; i += Batch_Size) {
+        ngx_radix32tree_find_n(tree, addrs + i, v2 + i,
+                               ngx_min(Ipv4_Lookups - i, Batch_Size));
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    batch = bench_ns(&start, &end, Ipv4_Lookups);
+
+    for (diff = 0, i = 0; i < Ipv4_Lookups; i++) {
+        diff += (v1[i] != v2[i]);
+    }
+
+    printf("radix32tree  one %6.1f  batch %6.1f  mismatches %lu\n",
+           one, batch, (unsigned long) diff);
+
+    if (dir) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (i = 0; i < Ipv4_Lookups; i++) {
+            v1[i] = ngx_radix32dir_find(dir, addrs[i]);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        one = bench_ns(&start, &end, Ipv4_Lookups);
+
+        //NGX_RADIX_GATHER打开时，先关掉AVX2测逐个查的版本，再打开测gather的版本
+        features = ngx_cpu_features;
+        avx2 = NGX_RADIX_GATHER ? (features & NGX_CPU_AVX2) : 0;
+        ngx_cpu_features &= ~NGX_CPU_AVX2;
+
+        for ( ;; ) {
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (i = 0; i < Ipv4_Lookups; i += Batch_Size) {
+                ngx_radix32dir_find_n(dir, addrs + i, v2 + i,
+                                      ngx_min(Ipv4_Lookups - i, Batch_Size));
+            }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            batch = bench_ns(&start, &end, Ipv4_Lookups);
+
+            for (diff = 0, i = 0; i < Ipv4_Lookups; i++) {
+                diff += (v1[i] != v2[i]);
+            }
+
+            printf("radix32dir   one %6.1f  batch %6.1f  mismatches %lu%s\n",
+                   one, batch, (unsigned long) diff,
+                   (ngx_cpu_features & NGX_CPU_AVX2) ? "  (avx2 gather)" : "");
+
+            if (!avx2 || (ngx_cpu_features & NGX_CPU_AVX2)) {
+                break;
+            }
+
+            ngx_cpu_features |= NGX_CPU_AVX2;
+        }
+
+        ngx_cpu_features = features;
+
+        ngx_radix32dir_destroy(dir);
+    }
+
+    cidrs = ngx_array_create(pool, Ipv4_Routes, sizeof(ngx_cidr_t));
+    sa = ngx_palloc(pool, Cidr_Lookups * sizeof(struct sockaddr *));
+    sin = ngx_pcalloc(pool, Cidr_Lookups * sizeof(struct sockaddr_in));
+    rc1 = ngx_palloc(pool, Cidr_Lookups * sizeof(ngx_int_t));
+    rc2 = ngx_palloc(pool, Cidr_Lookups * sizeof(ngx_int_t));
+
+    for (i = 0; i < Ipv4_Routes; i++) {
+        cidr = ngx_array_push(cidrs);
+        cidr->family = AF_INET;
+        cidr->u.in.addr = htonl(keys[i]);
+        cidr->u.in.mask = htonl(bench_mask32(lens[i]));
+    }
+
+    for (i = 0; i < Cidr_Lookups; i++) {
+        sin[i].sin_family = AF_INET;
+        sin[i].sin_addr.s_addr = htonl(addrs[i]);
+        sa[i] = (struct sockaddr *) &sin[i];
+    }
+
+    if (ngx_cidr_compile(cidrs) == NGX_OK) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (i = 0; i < Cidr_Lookups; i++) {
+            rc1[i] = ngx_cidr_match(sa[i], cidrs);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        one = bench_ns(&start, &end, Cidr_Lookups);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (i = 0; i < Cidr_Lookups; i += Batch_Size) {
+            ngx_cidr_match_n(sa + i, cidrs, rc2 + i,
+                             ngx_min(Cidr_Lookups - i, Batch_Size));
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        batch = bench_ns(&start, &end, Cidr_Lookups);
+
+        for (diff = 0, i = 0; i < Cidr_Lookups; i++) {
+            diff += (rc1[i] != rc2[i]);
+        }
+
+        printf("cidr_match   one %6.1f  batch %6.1f  mismatches %lu  (%lu cidrs)\n",
+               one, batch, (unsigned long) diff,
+               (unsigned long) cidrs->nelts - 1);
+    }
+
+    ngx_destroy_pool(pool);
+}
+
+//平时由ngx_shared_memory_add和ngx_init_zone_pool完成
+static ngx_slab_pool_t *
+bench_shm_pool(size_t size)
+{
+    u_char *mem;
+    ngx_uint_t n;
+    ngx_slab_pool_t *sp;
+
+    mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_SHARED, -1, 0);
+    if (mem == MAP_FAILED) {
+        return NULL;
+    }
+
+    for (n = ngx_pagesize, ngx_pagesize_shift = 0; n >>= 1; ngx_pagesize_shift++) { /* void */ }
+
+    sp = (ngx_slab_pool_t *) mem;
+    sp->end = mem + size;
+    sp->min_shift = 3;
+    sp->addr = mem;
+
+    if (ngx_shmtx_create(&sp->mutex, &sp->lock, NULL) != NGX_OK) {
+        return NULL;
+    }
+
+    ngx_slab_init(sp);
+
+    return sp;
+}
+
+/*
+ * 读者每次查找都enter/leave一次，结果和进程内的树比较：
+ * 两个快照的value分别是i和Ipv4_Routes + i，对Ipv4_Routes取模后应该和树里的一样
+ */
+static ngx_uint_t
+bench_shm_reader(ngx_radix_shm_t *rs, ngx_uint_t slot, ngx_radix_tree_t *tree,
+    uint32_t *addrs, ngx_uint_t n)
+{
+    ngx_uint_t i, errors;
+    uintptr_t v, expect;
+    ngx_radix_snap_t *snap;
+
+    errors = 0;
+
+    for (i = 0; i < n; i++) {
+        snap = ngx_radix_shm_enter(rs, slot);
+        v = ngx_radix32snap_find(snap, addrs[i]);
+        ngx_radix_shm_leave(rs, slot);
+
+        expect = ngx_radix32tree_find(tree, addrs[i]);
+
+        if (expect == NGX_RADIX_NO_VALUE) {
+            errors += (v != NGX_RADIX_NO_VALUE);
+
+        } else {
+            errors += (v >= 2 * Ipv4_Routes || v % Ipv4_Routes != expect);
+        }
+    }
+
+    return errors;
+}
+
+void bench_radix_shm(void)
+{
+    uint32_t *keys, *addrs;
+    ngx_uint_t i, r, n, *lens, publishes, errors, running;
+    uintptr_t sum1, sum2;
+    int status;
+    pid_t pids[Shm_Readers];
+    ngx_pool_t *pool;
+    ngx_radix_tree_t *tree[2];
+    ngx_slab_pool_t *sp;
+    ngx_radix_shm_t *rs;
+    ngx_radix_snap_t *snap;
+    struct timespec start, end;
+    double publish, find1, find2;
+
+    sp = bench_shm_pool(Shm_Pool_Size);
+    if (sp == NULL) {
+        printf("create shared memory failed!\n");
+        return;
+    }
+
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, NULL);
+    bench_ipv4_table(pool, &keys, &lens, &addrs);
+
+    tree[0] = ngx_radix_tree_create(pool, 0);
+    tree[1] = ngx_radix_tree_create(pool, 0);
+    n = bench_ipv4_tree(tree[0], keys, lens, 0);
+    (void) bench_ipv4_tree(tree[1], keys, lens, Ipv4_Routes);
+
+    rs = ngx_radix_shm_create(sp);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (rs == NULL || ngx_radix_shm_publish(rs, tree[0]) != NGX_OK) {
+        printf("publish radix snapshot failed!\n");
+        ngx_destroy_pool(pool);
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    publish = bench_ms(&start, &end);
+
+    //单进程比较查找速度，快照这边包括每次的enter/leave
+    sum1 = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < Ipv4_Lookups; i++) {
+        sum1 += ngx_radix32tree_find(tree[0], addrs[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    find1 = bench_ms(&start, &end) * 1e6 / Ipv4_Lookups;
+
+    sum2 = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < Ipv4_Lookups; i++) {
+        snap = ngx_radix_shm_enter(rs, 0);
+        sum2 += ngx_radix32snap_find(snap, addrs[i]);
+        ngx_radix_shm_leave(rs, 0);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    find2 = bench_ms(&start, &end) * 1e6 / Ipv4_Lookups;
+
+    snap = (ngx_radix_snap_t *) rs->current;
+
+    printf("--------------------------------\n");
+    printf("shared radix snapshot: %lu prefixes, %d readers\n",
+           (unsigned long) n, Shm_Readers);
+    printf("--------------------------------\n");
+    //快照的节点和树的节点一一对应
+    printf("radix32tree  find %6.1fns  %8lu KB in every worker\n", find1,
+           (unsigned long) (snap->nnodes * sizeof(ngx_radix_node_t) >> 10));
+    printf("radix32snap  find %6.1fns  %8lu KB shared, publish %.2fms\n", find2,
+           (unsigned long) (snap->size >> 10), publish);
+
+    //读者在查的同时父进程交替发布两棵树，fork前先把缓冲的输出写出去，免得子进程退出时再写一遍
+    fflush(stdout);
+
+    for (r = 0; r < Shm_Readers; r++) {
+        pids[r] = fork();
+
+        if (pids[r] == 0) {
+            errors = bench_shm_reader(rs, r + 1, tree[0],
+                                      addrs + r * (Ipv4_Lookups / Shm_Readers),
+                                      Ipv4_Lookups / Shm_Readers);
+            exit(errors ? 1 : 0);
+        }
+    }
+
+    publishes = 0;
+    errors = 0;
+    running = Shm_Readers;
+
+    while (running) {
+        if (ngx_radix_shm_publish(rs, tree[++publishes % 2]) != NGX_OK) {
+            printf("publish radix snapshot failed!\n");
+        }
+
+        for (r = 0; r < Shm_Readers; r++) {
+            if (pids[r] && waitpid(pids[r], &status, WNOHANG) == pids[r]) {
+                errors += (!WIFEXITED(status) || WEXITSTATUS(status) != 0);
+                pids[r] = 0;
+                running--;
+            }
+        }
+    }
+
+    //读者都退出了，除了当前快照都应该能回收
+    (void) ngx_radix_shm_reclaim(rs);
+
+    printf("%lu publishes while reading, %lu readers failed, %s\n",
+           (unsigned long) publishes, (unsigned long) errors,
+           rs->retired ? "retired snapshots left!" : "all retired snapshots freed");
+    printf("checksum %s\n", sum1 == sum2 ? "ok" : "differs!");
+
+    munmap(sp, Shm_Pool_Size);
+    ngx_destroy_pool(pool);
+}
+
+/*
+ * ngx_radix128tree每位一个节点，/48要走48层；
+ * ngx_radix128ptree只在分叉处有节点，同样的表层数少得多
+ */
+void bench_radix128(void)
+{
+    u_char (*keys)[16], (*masks)[16], (*addrs)[16];
+    ngx_uint_t i, j, len, *lens, n, diff;
+    uintptr_t sum1, sum2;
+    ngx_pool_t *pool;
+    ngx_radix_tree_t *tree;
+    ngx_radix_ptree_t *ptree;
+    struct timespec start, end;
+    double insert1, insert2, find1, find2;
+    static ngx_uint_t sub_lens[] = { 40, 44, 48, 48, 48, 48, 48 };
+
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, NULL);
+    keys = ngx_palloc(pool, Bgp6_Routes * 16);
+    masks = ngx_palloc(pool, Bgp6_Routes * 16);
+    lens = ngx_palloc(pool, Bgp6_Routes * sizeof(ngx_uint_t));
+    addrs = ngx_palloc(pool, Lookup_Num * 16);
+
+    srand(1);
+
+    for (i = 0; i < Bgp6_Routes; i++) {
+        if (i < Bgp6_Allocs) {
+            keys[i][0] = 0x20;
+            bench_fill(keys[i], 3);
+            len = (i % 5 < 3) ? 32 : 28 + bench_rand() % 9;
+
+        } else {
+            j = bench_rand() % Bgp6_Allocs;
+            ngx_memcpy(keys[i], keys[j], 16);
+            bench_fill(keys[i], lens[j]);
+            len = sub_lens[bench_rand() % (sizeof(sub_lens) / sizeof(sub_lens[0]))];
+        }
+
+        lens[i] = len;
+        bench_prefix(keys[i], masks[i], len);
+    }
+
+    //70%的地址落在某条路由里，其余的在2000::/3里随机
+    for (i = 0; i < Lookup_Num; i++) {
+        if (bench_rand() % 10 < 7) {
+            j = bench_rand() % Bgp6_Routes;
+            ngx_memcpy(addrs[i], keys[j], 16);
+            bench_fill(addrs[i], lens[j]);
+
+        } else {
+            addrs[i][0] = 0x20;
+            bench_fill(addrs[i], 3);
+        }
+    }
+
+    tree = ngx_radix_tree_create(pool, 0);
+    ptree = ngx_radix_ptree_create(pool);
+
+    n = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < Bgp6_Routes; i++) {
+        n += (ngx_radix128tree_insert(tree, keys[i], masks[i], i) == NGX_OK);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    insert1 = bench_ms(&start, &end);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < Bgp6_Routes; i++) {
+        ngx_radix128ptree_insert(ptree, keys[i], masks[i], i);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    insert2 = bench_ms(&start, &end);
+
+    sum1 = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < Lookup_Num; i++) {
+        sum1 += ngx_radix128tree_find(tree, addrs[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    find1 = bench_ms(&start, &end) * 1e6 / Lookup_Num;
+
+    sum2 = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < Lookup_Num; i++) {
+        sum2 += ngx_radix128ptree_find(ptree, addrs[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    find2 = bench_ms(&start, &end) * 1e6 / Lookup_Num;
+
+    //两棵树查到的结果必须一样
+    diff = 0;
+    for (i = 0; i < Lookup_Num; i++) {
+        diff += (ngx_radix128tree_find(tree, addrs[i])
+                 != ngx_radix128ptree_find(ptree, addrs[i]));
+    }
+
+    printf("--------------------------------\n");
+    printf("IPv6 table: %lu routes, %d lookups\n", (unsigned long) n, Lookup_Num);
+    printf("--------------------------------\n");
+    printf("radix128tree   insert %8.2fms  find %6.1fns\n", insert1, find1);
+    printf("radix128ptree  insert %8.2fms  find %6.1fns\n", insert2, find2);
+    printf("mismatches: %lu%s\n", (unsigned long) diff,
+           sum1 == sum2 ? "" : "  (checksum differs!)");
+
+    ngx_destroy_pool(pool);
+}
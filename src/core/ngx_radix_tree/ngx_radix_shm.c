@@ -0,0 +1,287 @@
+/*
+* @author:    daemon.xie
+* @license:   Apache Licence
+* @contact:   xieyugui
+* @software:  CLion
+* @file:      ngx_radix_shm.c
+* @date:      2026/10/17 下午5:20
+* @desc:
+*/
+
+//
+// Created by daemon.xie on 2026/10/17.
+//
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+static ngx_uint_t ngx_radix_snap_count(ngx_radix_node_t *node);
+static uint32_t ngx_radix_snap_fill(ngx_radix_snap_t *snap,
+    ngx_radix_node_t *node);
+static size_t ngx_radix_shm_reclaim_locked(ngx_radix_shm_t *rs);
+static size_t ngx_radix_shm_reclaim_handler(ngx_slab_pool_t *pool,
+    size_t size, void *data);
+
+
+ngx_radix_shm_t *
+ngx_radix_shm_create(ngx_slab_pool_t *shpool)
+{
+    ngx_radix_shm_t *rs;
+
+    rs = ngx_slab_calloc(shpool, sizeof(ngx_radix_shm_t));
+    if (rs == NULL) {
+        return NULL;
+    }
+
+    rs->epoch = 1;
+    rs->shpool = shpool;
+
+    /*
+     * 和shpool上已有的回收回调(比如同一块共享内存里的LRU缓存)并存，
+     * 旧快照释放得不够时slab接着调用它们，后台回收的low/high也保持不变；
+     * 同一个shpool上再次创建时替换掉之前那个ngx_radix_shm_t
+     */
+    if (ngx_slab_set_reclaim(shpool, ngx_radix_shm_reclaim_handler, rs, 0, 0)
+        != NGX_OK)
+    {
+        ngx_slab_free(shpool, rs);
+        return NULL;
+    }
+
+    return rs;
+}
+
+
+ngx_int_t
+ngx_radix_shm_publish(ngx_radix_shm_t *rs, ngx_radix_tree_t *tree)
+{
+    size_t size;
+    ngx_uint_t n;
+    ngx_atomic_uint_t epoch;
+    ngx_radix_snap_t *snap, *old;
+
+    //编译在锁外做，ngx_slab_alloc分配不到时会通过回收回调释放旧快照
+    n = ngx_radix_snap_count(tree->root);
+    size = offsetof(ngx_radix_snap_t, nodes) + n * sizeof(ngx_radix_snap_node_t);
+
+    snap = ngx_slab_alloc(rs->shpool, size);
+    if (snap == NULL) {
+        return NGX_ERROR;
+    }
+
+    snap->next = NULL;
+    snap->epoch = 0;
+    snap->size = size;
+    snap->nnodes = 0;
+
+    (void) ngx_radix_snap_fill(snap, tree->root);
+
+    ngx_shmtx_lock(&rs->shpool->mutex);
+
+    old = (ngx_radix_snap_t *) rs->current;
+
+    /*
+     * 先替换current再加epoch，fetch_add是完整的内存屏障：
+     * 之后用新epoch进入的读者一定读到新快照，只有epoch不大于旧值的读者可能还在读old
+     */
+    rs->current = (ngx_atomic_uint_t) snap;
+    epoch = ngx_atomic_fetch_add(&rs->epoch, 1);
+
+    if (old) {
+        old->epoch = epoch;
+        old->next = rs->retired;
+        rs->retired = old;
+    }
+
+    (void) ngx_radix_shm_reclaim_locked(rs);
+
+    ngx_shmtx_unlock(&rs->shpool->mutex);
+
+    return NGX_OK;
+}
+
+
+size_t
+ngx_radix_shm_reclaim(ngx_radix_shm_t *rs)
+{
+    size_t size;
+
+    ngx_shmtx_lock(&rs->shpool->mutex);
+    size = ngx_radix_shm_reclaim_locked(rs);
+    ngx_shmtx_unlock(&rs->shpool->mutex);
+
+    return size;
+}
+
+
+static size_t
+ngx_radix_shm_reclaim_locked(ngx_radix_shm_t *rs)
+{
+    size_t size;
+    ngx_uint_t i;
+    ngx_atomic_uint_t min, e;
+    ngx_radix_snap_t *snap, **pp;
+
+    if (rs->retired == NULL) {
+        return 0;
+    }
+
+    //正在读的读者里最小的epoch，替换时的epoch比它小的快照不会再有人读
+    min = (ngx_atomic_uint_t) -1;
+
+    for (i = 0; i < NGX_RADIX_SHM_SLOTS; i++) {
+        e = rs->slots[i].epoch;
+
+        if (e && e < min) {
+            min = e;
+        }
+    }
+
+    size = 0;
+    pp = &rs->retired;
+
+    while (*pp) {
+        snap = *pp;
+
+        if (snap->epoch < min) {
+            *pp = snap->next;
+            size += snap->size;
+            ngx_slab_free_locked(rs->shpool, snap);
+            continue;
+        }
+
+        pp = &snap->next;
+    }
+
+    return size;
+}
+
+
+//slab分配失败时的回收回调，已经持有pool->mutex
+static size_t
+ngx_radix_shm_reclaim_handler(ngx_slab_pool_t *pool, size_t size, void *data)
+{
+    return ngx_radix_shm_reclaim_locked(data);
+}
+
+
+static ngx_uint_t
+ngx_radix_snap_count(ngx_radix_node_t *node)
+{
+    ngx_uint_t n;
+
+    n = 1;
+
+    if (node->left) {
+        n += ngx_radix_snap_count(node->left);
+    }
+
+    if (node->right) {
+        n += ngx_radix_snap_count(node->right);
+    }
+
+    return n;
+}
+
+
+//按前序把node的子树放到nodes里，返回node的下标
+static uint32_t
+ngx_radix_snap_fill(ngx_radix_snap_t *snap, ngx_radix_node_t *node)
+{
+    uint32_t i;
+
+    i = (uint32_t) snap->nnodes++;
+
+    snap->nodes[i].value = node->value;
+    snap->nodes[i].child[0] = node->left ? ngx_radix_snap_fill(snap, node->left) : 0;
+    snap->nodes[i].child[1] = node->right ? ngx_radix_snap_fill(snap, node->right) : 0;
+
+    return i;
+}
+
+
+uintptr_t
+ngx_radix32snap_find(ngx_radix_snap_t *snap, uint32_t key)
+{
+    uint32_t bit, i;
+    uintptr_t value;
+    ngx_radix_snap_node_t *node;
+
+    value = NGX_RADIX_NO_VALUE;
+
+    if (snap == NULL) {
+        return value;
+    }
+
+    bit = 0x80000000;
+    node = &snap->nodes[0];
+
+    for ( ;; ) {
+        if (node->value != NGX_RADIX_NO_VALUE) {
+            value = node->value;
+        }
+
+        i = node->child[(key & bit) != 0];
+
+        if (i == 0) {
+            break;
+        }
+
+        node = &snap->nodes[i];
+        bit >>= 1;
+    }
+
+    return value;
+}
+
+
+#if (NGX_HAVE_INET6)
+
+uintptr_t
+ngx_radix128snap_find(ngx_radix_snap_t *snap, u_char *key)
+{
+    u_char bit;
+    uint32_t i, n;
+    uintptr_t value;
+    ngx_radix_snap_node_t *node;
+
+    value = NGX_RADIX_NO_VALUE;
+
+    if (snap == NULL) {
+        return value;
+    }
+
+    n = 0;
+    bit = 0x80;
+    node = &snap->nodes[0];
+
+    for ( ;; ) {
+        if (node->value != NGX_RADIX_NO_VALUE) {
+            value = node->value;
+        }
+
+        //128位都比较完了
+        if (n == 16) {
+            break;
+        }
+
+        i = node->child[(key[n] & bit) != 0];
+
+        if (i == 0) {
+            break;
+        }
+
+        node = &snap->nodes[i];
+        bit >>= 1;
+
+        if (bit == 0) {
+            n++;
+            bit = 0x80;
+        }
+    }
+
+    return value;
+}
+
+#endif
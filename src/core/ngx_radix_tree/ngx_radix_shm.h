@@ -0,0 +1,119 @@
+/*
+* @author:    daemon.xie
+* @license:   Apache Licence
+* @contact:   xieyugui
+* @software:  CLion
+* @file:      ngx_radix_shm.h
+* @date:      2026/10/17 下午5:20
+* @desc:
+ * 放在共享内存里的只读基数树快照，所有worker共用一份，不用每个进程各建一棵ngx_radix_tree_t
+ * 更新时在进程内存里改好ngx_radix_tree_t，再编译成新快照发布：
+ * 原子地替换current指针，旧快照等所有正在读它的进程离开后才释放(epoch回收)，不需要reload
+*/
+
+//
+// Created by daemon.xie on 2026/10/17.
+//
+
+#ifndef NGX_RADIX_TREE_NGX_RADIX_SHM_H
+#define NGX_RADIX_TREE_NGX_RADIX_SHM_H
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+//读者的个数上限，下标一般用ngx_process_slot，和NGX_MAX_PROCESSES一样
+#define NGX_RADIX_SHM_SLOTS  1024
+
+/*
+ * 快照里的节点按前序排在一个数组里，左子节点紧跟在父节点后面，
+ * child是数组下标，0表示没有(根的下标是0，不会是别的节点的子节点)
+ * 每个节点16字节，ngx_radix_node_t是32字节
+ */
+typedef struct {
+    uint32_t   child[2];
+    uintptr_t  value;
+} ngx_radix_snap_node_t;
+
+typedef struct ngx_radix_snap_s ngx_radix_snap_t;
+
+struct ngx_radix_snap_s {
+    ngx_radix_snap_t       *next;   //等待回收的链表
+    ngx_atomic_uint_t       epoch;  //被替换下来时的epoch
+    size_t                  size;   //整个快照占的字节数
+    ngx_uint_t              nnodes;
+    ngx_radix_snap_node_t   nodes[1];
+};
+
+//每个读者一个cache line，读者之间不会互相干扰
+typedef struct {
+    ngx_atomic_t  epoch;  //正在读时是进入时的epoch，不在读时是0
+    u_char        pad[64 - sizeof(ngx_atomic_t)];
+} ngx_radix_shm_slot_t;
+
+/*
+ * 发布和回收都在shpool->mutex里做，多个进程同时发布时按加锁顺序生效；
+ * 回收时找出所有正在读的slot里最小的epoch，比它小的旧快照都没有人在读了
+ */
+typedef struct {
+    ngx_atomic_t           current;  //当前的ngx_radix_snap_t *，还没发布过为0
+    ngx_atomic_t           epoch;    //从1开始，每发布一次加1
+    ngx_radix_snap_t      *retired;  //已经替换下来还没释放的快照
+    ngx_slab_pool_t       *shpool;
+
+    ngx_radix_shm_slot_t   slots[NGX_RADIX_SHM_SLOTS];
+} ngx_radix_shm_t;
+
+/*
+ * 在共享内存zone的init回调里创建，同时把回收旧快照注册为shpool的回收回调，
+ * 分配不到内存时会先释放没人读的旧快照；
+ * shpool上已经有别的回收回调时不会覆盖它，旧快照释放得不够时slab会接着调用别的回调。
+ * 回调登记在调用进程里，要在master的init回调中创建，fork出来的worker才都有；
+ * 每个shpool只调用一次，reload复用共享内存时应该沿用zone->data里的ngx_radix_shm_t，
+ * master里之前的登记还在，不需要重新设置
+ */
+ngx_radix_shm_t *ngx_radix_shm_create(ngx_slab_pool_t *shpool);
+
+/*
+ * 把tree编译成快照并发布，tree可以是32位或128位的，编译完tree还归调用方所有；
+ * value直接复制，必须在所有进程里都有意义，比如整数或者指向这块共享内存的指针
+ */
+ngx_int_t ngx_radix_shm_publish(ngx_radix_shm_t *rs, ngx_radix_tree_t *tree);
+
+//释放没人在读的旧快照，返回释放的字节数，会加锁
+size_t ngx_radix_shm_reclaim(ngx_radix_shm_t *rs);
+
+/*
+ * 读之前enter，拿到的快照在leave之前一直有效，同一个slot不能嵌套enter；
+ * 用法:
+ *     snap = ngx_radix_shm_enter(rs, ngx_process_slot);
+ *     value = ngx_radix32snap_find(snap, key);
+ *     ngx_radix_shm_leave(rs, ngx_process_slot);
+ * 不要在enter和leave之间阻塞，否则旧快照一直不能释放；
+ * 进程在enter之后异常退出时slot里会留下它进入时的epoch，目前没有地方在回收进程时清掉它
+ * (这棵源码树里没有ngx_process.c)，在这之后替换下来的快照都不能释放，共享内存会一直涨；
+ * 直到复用这个ngx_process_slot的新worker调用一次ngx_radix_shm_leave才恢复。
+ * 这期间新worker的enter里cmp_set会失败，slot保留的是更早的epoch，读到的快照仍然受保护
+ */
+static ngx_inline ngx_radix_snap_t *
+ngx_radix_shm_enter(ngx_radix_shm_t *rs, ngx_uint_t slot)
+{
+    //原子操作同时是完整的内存屏障，保证读current在写slot之后
+    (void) ngx_atomic_cmp_set(&rs->slots[slot].epoch, 0, rs->epoch);
+
+    return (ngx_radix_snap_t *) rs->current;
+}
+
+static ngx_inline void
+ngx_radix_shm_leave(ngx_radix_shm_t *rs, ngx_uint_t slot)
+{
+    ngx_memory_barrier();
+    rs->slots[slot].epoch = 0;
+}
+
+//snap为NULL(还没发布过)时返回NGX_RADIX_NO_VALUE
+uintptr_t ngx_radix32snap_find(ngx_radix_snap_t *snap, uint32_t key);
+#if (NGX_HAVE_INET6)
+uintptr_t ngx_radix128snap_find(ngx_radix_snap_t *snap, u_char *key);
+#endif
+
+#endif //NGX_RADIX_TREE_NGX_RADIX_SHM_H
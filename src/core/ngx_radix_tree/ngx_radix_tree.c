@@ -16,8 +16,33 @@
 #include <ngx_core.h>
 #include <ngx_radix_tree.h>
 
+/* AVX2的gather和ngx_hash一样用target属性单独编译，按ngx_cpu_features选择，见NGX_RADIX_GATHER */
+#if (NGX_RADIX_GATHER && __amd64__ && __GNUC__)
+#define NGX_RADIX_SIMD  1
+#include <immintrin.h>
+#endif
+
+#if (__GNUC__)
+#define ngx_radix_prefetch(p)  __builtin_prefetch(p)
+#else
+#define ngx_radix_prefetch(p)
+#endif
+
 //为基数树申请节点
 static ngx_radix_node_t *ngx_radix_alloc(ngx_radix_tree_t *tree);
+static void ngx_radix32dir_count(ngx_radix_dir_t *dir, ngx_radix_node_t *node,
+    ngx_uint_t depth);
+static void ngx_radix32dir_fill(ngx_radix_dir_t *dir, ngx_radix_node_t *node,
+    uint32_t *slot, ngx_uint_t n, ngx_uint_t depth, uint32_t v);
+#if (NGX_RADIX_SIMD)
+static void ngx_radix32dir_find_avx2(ngx_radix_dir_t *dir, uint32_t *keys,
+    uintptr_t *values, ngx_uint_t n);
+#endif
+#if (NGX_HAVE_INET6)
+static ngx_radix_pnode_t *ngx_radix_palloc(ngx_radix_ptree_t *tree);
+static void ngx_radix_pcompact(ngx_radix_ptree_t *tree,
+    ngx_radix_pnode_t *node);
+#endif
 
 //创建基数树，preallocate是预分配树的层数
 ngx_radix_tree_t *
@@ -36,6 +61,7 @@ ngx_radix_tree_create(ngx_pool_t *pool, ngx_int_t preallocate)
     tree->free = NULL;
     tree->start = NULL;
     tree->size = 0;
+    tree->version = 0;
 
     //申请一个基数节点
     tree->root = ngx_radix_alloc(tree);
@@ -118,7 +144,7 @@ ngx_radix32tree_insert(ngx_radix_tree_t *tree, uint32_t key, uint32_t mask,
             next = node->left;
         }
 
-        if(next = NULL) {
+        if(next == NULL) {
             break;
         }
 
@@ -132,6 +158,7 @@ ngx_radix32tree_insert(ngx_radix_tree_t *tree, uint32_t key, uint32_t mask,
         }
 
         node->value = value;
+        tree->version++;
         return NGX_OK;
     }
 
@@ -162,6 +189,7 @@ ngx_radix32tree_insert(ngx_radix_tree_t *tree, uint32_t key, uint32_t mask,
 
     node->value = value;
 
+    tree->version++;
     return NGX_OK;
 }
 
@@ -194,6 +222,7 @@ ngx_radix32tree_delete(ngx_radix_tree_t *tree, uint32_t key, uint32_t mask)
     if(node->right || node->left) {
         if(node->value != NGX_RADIX_NO_VALUE) {
             node->value = NGX_RADIX_NO_VALUE;
+            tree->version++;
             return NGX_OK;
         }
 
@@ -230,6 +259,7 @@ ngx_radix32tree_delete(ngx_radix_tree_t *tree, uint32_t key, uint32_t mask)
         }
     }
 
+    tree->version++;
     return NGX_OK;
 }
 
@@ -252,7 +282,7 @@ ngx_radix32tree_find(ngx_radix_tree_t *tree, uint32_t key)
         if(key & bit) {
             node = node->right;
         } else {
-            node = node->right;
+            node = node->left;
         }
 
         bit >>= 1;
@@ -261,6 +291,249 @@ ngx_radix32tree_find(ngx_radix_tree_t *tree, uint32_t key)
     return value;
 }
 
+void
+ngx_radix32tree_find_n(ngx_radix_tree_t *tree, uint32_t *keys,
+    uintptr_t *values, ngx_uint_t n)
+{
+    uint32_t bit;
+    ngx_uint_t i, j, m, active;
+    ngx_radix_node_t *node[NGX_RADIX_BATCH];
+
+    for (i = 0; i < n; i += m) {
+        m = ngx_min(n - i, NGX_RADIX_BATCH);
+
+        for (j = 0; j < m; j++) {
+            node[j] = tree->root;
+            values[i + j] = NGX_RADIX_NO_VALUE;
+        }
+
+        bit = 0x80000000;
+
+        //每一轮所有还没走完的路径各往下走一层，路径之间没有依赖，预取能重叠起来
+        do {
+            active = 0;
+
+            for (j = 0; j < m; j++) {
+                if (node[j] == NULL) {
+                    continue;
+                }
+
+                if (node[j]->value != NGX_RADIX_NO_VALUE) {
+                    values[i + j] = node[j]->value;
+                }
+
+                if (keys[i + j] & bit) {
+                    node[j] = node[j]->right;
+                } else {
+                    node[j] = node[j]->left;
+                }
+
+                if (node[j]) {
+                    ngx_radix_prefetch(node[j]);
+                    active++;
+                }
+            }
+
+            bit >>= 1;
+        } while (active);
+    }
+}
+
+ngx_radix_dir_t *
+ngx_radix32dir_create(ngx_radix_tree_t *tree, ngx_log_t *log)
+{
+    ngx_radix_dir_t *dir;
+
+    dir = ngx_alloc(sizeof(ngx_radix_dir_t), log);
+    if (dir == NULL) {
+        return NULL;
+    }
+
+    //第一遍先数出有多少个value和tbl8组，一次把内存分配好
+    dir->ngroups = 0;
+    dir->nvalues = 1;
+    dir->tree_size = 0;
+
+    ngx_radix32dir_count(dir, tree->root, 0);
+
+    dir->tbl24 = ngx_alloc((1 << 24) * sizeof(uint32_t), log);
+    //没有tbl8组时也多分配1个字节，免得ngx_alloc(0)返回NULL
+    dir->tbl8 = ngx_alloc((dir->ngroups << 8) * sizeof(uint32_t) + 1, log);
+    dir->values = ngx_alloc(dir->nvalues * sizeof(uintptr_t), log);
+
+    if (dir->tbl24 == NULL || dir->tbl8 == NULL || dir->values == NULL) {
+        ngx_radix32dir_destroy(dir);
+        return NULL;
+    }
+
+    dir->size = sizeof(ngx_radix_dir_t)
+                + (1 << 24) * sizeof(uint32_t)
+                + (dir->ngroups << 8) * sizeof(uint32_t)
+                + dir->nvalues * sizeof(uintptr_t);
+
+    //第二遍填表，ngroups和nvalues重新从头开始当作分配的游标
+    dir->values[0] = NGX_RADIX_NO_VALUE;
+    dir->ngroups = 0;
+    dir->nvalues = 1;
+
+    ngx_radix32dir_fill(dir, tree->root, dir->tbl24, 1 << 24, 0, 0);
+
+    dir->version = tree->version;
+
+    ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                  "radix dir: %ui values, %ui tbl8 groups, %uz bytes, "
+                  "tree %uz bytes", dir->nvalues - 1, dir->ngroups,
+                  dir->size, dir->tree_size);
+
+    return dir;
+}
+
+void
+ngx_radix32dir_destroy(ngx_radix_dir_t *dir)
+{
+    if (dir->tbl24) {
+        ngx_free(dir->tbl24);
+    }
+
+    if (dir->tbl8) {
+        ngx_free(dir->tbl8);
+    }
+
+    if (dir->values) {
+        ngx_free(dir->values);
+    }
+
+    ngx_free(dir);
+}
+
+//统计value的个数和需要的tbl8组数，depth是node的前缀长度
+static void
+ngx_radix32dir_count(ngx_radix_dir_t *dir, ngx_radix_node_t *node,
+    ngx_uint_t depth)
+{
+    dir->tree_size += sizeof(ngx_radix_node_t);
+
+    if (node->value != NGX_RADIX_NO_VALUE) {
+        dir->nvalues++;
+    }
+
+    //深度24的节点下面还有节点，说明这个/24里有更长的前缀
+    if (depth == 24 && (node->left || node->right)) {
+        dir->ngroups++;
+    }
+
+    if (node->left) {
+        ngx_radix32dir_count(dir, node->left, depth + 1);
+    }
+
+    if (node->right) {
+        ngx_radix32dir_count(dir, node->right, depth + 1);
+    }
+}
+
+/*
+ * node的前缀覆盖slot开始的n项，v是上层最长前缀的value下标
+ * 深度小于24时slot在tbl24里，每项是一个/24；到深度24还有子节点时换到一个新的tbl8组，
+ * 每项是一个地址；没有子节点的地方整段填成v
+ */
+static void
+ngx_radix32dir_fill(ngx_radix_dir_t *dir, ngx_radix_node_t *node,
+    uint32_t *slot, ngx_uint_t n, ngx_uint_t depth, uint32_t v)
+{
+    ngx_uint_t i, g;
+
+    if (node && node->value != NGX_RADIX_NO_VALUE) {
+        dir->values[dir->nvalues] = node->value;
+        v = (uint32_t) dir->nvalues++;
+    }
+
+    if (node == NULL || (node->left == NULL && node->right == NULL)) {
+        for (i = 0; i < n; i++) {
+            slot[i] = v;
+        }
+
+        return;
+    }
+
+    if (depth == 24) {
+        g = dir->ngroups++;
+        *slot = NGX_RADIX_DIR_GROUP | (uint32_t) g;
+        slot = &dir->tbl8[g << 8];
+        n = 256;
+    }
+
+    ngx_radix32dir_fill(dir, node->left, slot, n / 2, depth + 1, v);
+    ngx_radix32dir_fill(dir, node->right, slot + n / 2, n / 2, depth + 1, v);
+}
+
+void
+ngx_radix32dir_find_n(ngx_radix_dir_t *dir, uint32_t *keys,
+    uintptr_t *values, ngx_uint_t n)
+{
+    ngx_uint_t i;
+
+#if (NGX_RADIX_SIMD)
+    //tbl8的下标(组号 << 8)要放得进gather的有符号32位下标
+    if ((ngx_cpu_features & NGX_CPU_AVX2) && dir->ngroups < (1 << 23)) {
+        ngx_radix32dir_find_avx2(dir, keys, values, n);
+        return;
+    }
+#endif
+
+    /*
+     * 每次查找只有两三次互不依赖的访存，乱序执行已经能让相邻的查找重叠，
+     * 分几遍先预取再读反而更慢，这里就是逐个查
+     */
+    for (i = 0; i < n; i++) {
+        values[i] = ngx_radix32dir_find(dir, keys[i]);
+    }
+}
+
+#if (NGX_RADIX_SIMD)
+
+//每次8个key：gather tbl24，有组号的再gather tbl8，最后分两半gather 64位的values
+__attribute__((target("avx2"))) static void
+ngx_radix32dir_find_avx2(ngx_radix_dir_t *dir, uint32_t *keys,
+    uintptr_t *values, ngx_uint_t n)
+{
+    ngx_uint_t i;
+    __m256i k, e, g, idx, low, group;
+
+    low = _mm256_set1_epi32(0xff);
+    group = _mm256_set1_epi32((int) NGX_RADIX_DIR_GROUP);
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        k = _mm256_loadu_si256((__m256i *) &keys[i]);
+
+        e = _mm256_i32gather_epi32((const int *) dir->tbl24,
+                                   _mm256_srli_epi32(k, 8), 4);
+
+        //最高位为1的lane全1
+        g = _mm256_srai_epi32(e, 31);
+
+        if (!_mm256_testz_si256(g, g)) {
+            idx = _mm256_add_epi32(
+                      _mm256_slli_epi32(_mm256_andnot_si256(group, e), 8),
+                      _mm256_and_si256(k, low));
+            e = _mm256_mask_i32gather_epi32(e, (const int *) dir->tbl8, idx,
+                                            g, 4);
+        }
+
+        _mm256_storeu_si256((__m256i *) &values[i],
+            _mm256_i32gather_epi64((const long long *) dir->values,
+                                   _mm256_castsi256_si128(e), 8));
+        _mm256_storeu_si256((__m256i *) &values[i + 4],
+            _mm256_i32gather_epi64((const long long *) dir->values,
+                                   _mm256_extracti128_si256(e, 1), 8));
+    }
+
+    for ( /* void */ ; i < n; i++) {
+        values[i] = ngx_radix32dir_find(dir, keys[i]);
+    }
+}
+
+#endif
+
 #if (NGX_HAVE_INET6)
 
 ngx_int_t
@@ -455,6 +728,338 @@ ngx_radix128tree_find(ngx_radix_tree_t *tree, u_char *key)
     return value;
 }
 
+
+//k的第i位(从最高位开始数)
+#define ngx_radix_pbit(k, i)                                                  \
+    (ngx_uint_t) (((k)[(i) >> 6] >> (63 - ((i) & 63))) & 1)
+
+//高len位是1的掩码，len为0~64
+#define ngx_radix_pmask(len)                                                  \
+    ((len) ? (uint64_t) -1 << (64 - (len)) : 0)
+
+
+static ngx_inline ngx_uint_t
+ngx_radix_pclz(uint64_t x)
+{
+#if (__GNUC__)
+    return __builtin_clzll(x);
+#else
+    ngx_uint_t  n;
+
+    for (n = 0; !(x & 0x8000000000000000ULL); n++) {
+        x <<= 1;
+    }
+
+    return n;
+#endif
+}
+
+
+//网络字节序的16字节地址转成两个64位整数
+static ngx_inline void
+ngx_radix_pkey(uint64_t *k, u_char *p)
+{
+    ngx_uint_t  i;
+
+    k[0] = 0;
+    k[1] = 0;
+
+    for (i = 0; i < 8; i++) {
+        k[0] = (k[0] << 8) | p[i];
+        k[1] = (k[1] << 8) | p[i + 8];
+    }
+}
+
+
+//掩码中前面1的个数，同时把key在掩码之外的位清零
+static ngx_uint_t
+ngx_radix_pprefix(uint64_t *k, u_char *key, u_char *mask)
+{
+    uint64_t    m[2];
+    ngx_uint_t  plen;
+
+    ngx_radix_pkey(k, key);
+    ngx_radix_pkey(m, mask);
+
+    if (~m[0]) {
+        plen = ngx_radix_pclz(~m[0]);
+
+    } else {
+        plen = ~m[1] ? 64 + ngx_radix_pclz(~m[1]) : 128;
+    }
+
+    k[0] &= m[0];
+    k[1] &= m[1];
+
+    return plen;
+}
+
+
+//k的前node->plen位是不是和节点的前缀一样
+static ngx_inline ngx_uint_t
+ngx_radix_pmatch(uint64_t *k, ngx_radix_pnode_t *node)
+{
+    if (node->plen <= 64) {
+        return ((k[0] ^ node->key[0]) & ngx_radix_pmask(node->plen)) == 0;
+    }
+
+    return k[0] == node->key[0]
+           && ((k[1] ^ node->key[1]) & ngx_radix_pmask(node->plen - 64)) == 0;
+}
+
+
+ngx_radix_ptree_t *
+ngx_radix_ptree_create(ngx_pool_t *pool)
+{
+    ngx_radix_ptree_t  *tree;
+
+    tree = ngx_palloc(pool, sizeof(ngx_radix_ptree_t));
+    if (tree == NULL) {
+        return NULL;
+    }
+
+    tree->root = NULL;
+    tree->pool = pool;
+    tree->free = NULL;
+    tree->start = NULL;
+    tree->size = 0;
+
+    return tree;
+}
+
+
+/*
+ * 从根往下走，直到节点的前缀比要插入的长或者和它对不上，然后分三种情况：
+ * 1) 走到了空位置，新节点直接挂上去；
+ * 2) 新前缀是这个节点前缀的开头部分，新节点插到它上面；
+ * 3) 两个前缀在中间某一位分开，在分开的位置加一个没有值的分叉节点
+ */
+ngx_int_t
+ngx_radix128ptree_insert(ngx_radix_ptree_t *tree, u_char *key, u_char *mask,
+    uintptr_t value)
+{
+    uint64_t            k[2], x;
+    ngx_uint_t          plen, len, c;
+    ngx_radix_pnode_t  *node, *parent, *leaf, *glue, **link;
+
+    plen = ngx_radix_pprefix(k, key, mask);
+
+    parent = NULL;
+    link = &tree->root;
+    node = tree->root;
+
+    while (node) {
+        if (node->plen > plen || !ngx_radix_pmatch(k, node)) {
+            break;
+        }
+
+        if (node->plen == plen) {
+            if (node->value != NGX_RADIX_NO_VALUE) {
+                return NGX_BUSY;
+            }
+
+            node->value = value;
+            return NGX_OK;
+        }
+
+        parent = node;
+        link = &node->child[ngx_radix_pbit(k, node->plen)];
+        node = *link;
+    }
+
+    leaf = ngx_radix_palloc(tree);
+    if (leaf == NULL) {
+        return NGX_ERROR;
+    }
+
+    leaf->key[0] = k[0];
+    leaf->key[1] = k[1];
+    leaf->plen = plen;
+    leaf->value = value;
+    leaf->child[0] = NULL;
+    leaf->child[1] = NULL;
+
+    if (node == NULL) {
+        leaf->parent = parent;
+        *link = leaf;
+        return NGX_OK;
+    }
+
+    //两个前缀相同部分的长度
+    len = ngx_min(plen, node->plen);
+
+    if ((x = k[0] ^ node->key[0])) {
+        c = ngx_radix_pclz(x);
+
+    } else {
+        x = k[1] ^ node->key[1];
+        c = x ? 64 + ngx_radix_pclz(x) : 128;
+    }
+
+    c = ngx_min(c, len);
+
+    if (c == plen) {
+        leaf->child[ngx_radix_pbit(node->key, plen)] = node;
+        leaf->parent = parent;
+        node->parent = leaf;
+        *link = leaf;
+        return NGX_OK;
+    }
+
+    glue = ngx_radix_palloc(tree);
+    if (glue == NULL) {
+        leaf->child[0] = tree->free;
+        tree->free = leaf;
+        return NGX_ERROR;
+    }
+
+    if (c < 64) {
+        glue->key[0] = k[0] & ngx_radix_pmask(c);
+        glue->key[1] = 0;
+
+    } else {
+        glue->key[0] = k[0];
+        glue->key[1] = k[1] & ngx_radix_pmask(c - 64);
+    }
+
+    glue->plen = c;
+    glue->value = NGX_RADIX_NO_VALUE;
+    glue->child[ngx_radix_pbit(k, c)] = leaf;
+    glue->child[ngx_radix_pbit(node->key, c)] = node;
+    glue->parent = parent;
+
+    leaf->parent = glue;
+    node->parent = glue;
+    *link = glue;
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_radix128ptree_delete(ngx_radix_ptree_t *tree, u_char *key, u_char *mask)
+{
+    uint64_t            k[2];
+    ngx_uint_t          plen;
+    ngx_radix_pnode_t  *node;
+
+    plen = ngx_radix_pprefix(k, key, mask);
+    node = tree->root;
+
+    while (node && node->plen < plen && ngx_radix_pmatch(k, node)) {
+        node = node->child[ngx_radix_pbit(k, node->plen)];
+    }
+
+    if (node == NULL
+        || node->plen != plen
+        || !ngx_radix_pmatch(k, node)
+        || node->value == NGX_RADIX_NO_VALUE)
+    {
+        return NGX_ERROR;
+    }
+
+    node->value = NGX_RADIX_NO_VALUE;
+
+    ngx_radix_pcompact(tree, node);
+
+    return NGX_OK;
+}
+
+
+/*
+ * 没有值的节点最多只有一个子节点时就不需要了：有一个子节点时让子节点接替它，
+ * 没有子节点时直接删掉，父节点少了一个子节点，可能也不需要了，继续往上检查
+ */
+static void
+ngx_radix_pcompact(ngx_radix_ptree_t *tree, ngx_radix_pnode_t *node)
+{
+    ngx_radix_pnode_t  *parent, *child, **link;
+
+    while (node
+           && node->value == NGX_RADIX_NO_VALUE
+           && (node->child[0] == NULL || node->child[1] == NULL))
+    {
+        child = node->child[0] ? node->child[0] : node->child[1];
+        parent = node->parent;
+
+        if (parent) {
+            link = &parent->child[parent->child[1] == node];
+
+        } else {
+            link = &tree->root;
+        }
+
+        *link = child;
+
+        node->child[0] = tree->free;
+        tree->free = node;
+
+        if (child) {
+            child->parent = parent;
+            break;
+        }
+
+        node = parent;
+    }
+}
+
+
+uintptr_t
+ngx_radix128ptree_find(ngx_radix_ptree_t *tree, u_char *key)
+{
+    uint64_t            k[2];
+    uintptr_t           value;
+    ngx_radix_pnode_t  *node;
+
+    ngx_radix_pkey(k, key);
+
+    value = NGX_RADIX_NO_VALUE;
+    node = tree->root;
+
+    //越往下前缀越长，最后一个有值的就是最长匹配
+    while (node && ngx_radix_pmatch(k, node)) {
+        if (node->value != NGX_RADIX_NO_VALUE) {
+            value = node->value;
+        }
+
+        if (node->plen == 128) {
+            break;
+        }
+
+        node = node->child[ngx_radix_pbit(k, node->plen)];
+    }
+
+    return value;
+}
+
+
+static ngx_radix_pnode_t *
+ngx_radix_palloc(ngx_radix_ptree_t *tree)
+{
+    ngx_radix_pnode_t  *p;
+
+    if (tree->free) {
+        p = tree->free;
+        tree->free = p->child[0];
+        return p;
+    }
+
+    if (tree->size < sizeof(ngx_radix_pnode_t)) {
+        tree->start = ngx_pmemalign(tree->pool, ngx_pagesize, ngx_pagesize);
+        if (tree->start == NULL) {
+            return NULL;
+        }
+
+        tree->size = ngx_pagesize;
+    }
+
+    p = (ngx_radix_pnode_t *) tree->start;
+    tree->start += sizeof(ngx_radix_pnode_t);
+    tree->size -= sizeof(ngx_radix_pnode_t);
+
+    return p;
+}
+
 #endif
 
 static ngx_radix_node_t *
@@ -35,6 +35,7 @@ typedef struct {
     ngx_radix_node_t *free; //回收释放的节点，在添加新节点时，会首先查看free中是否有空闲可用的节点
     char *start; //已分配内存中还未使用内存的首地址
     size_t size; //已分配内存内中还未使用内存的大小
+    ngx_uint_t version; //ngx_radix32tree_insert/delete每次修改树后加1，用来判断编译好的ngx_radix_dir_t是否过期
 } ngx_radix_tree_t;
 
 //创建基数树，preallocate是预分配树的层数
@@ -51,12 +52,110 @@ ngx_int_t ngx_radix32tree_delete(ngx_radix_tree_t *tree,
 //根据key值在基数树中查找返回value数据
 uintptr_t ngx_radix32tree_find(ngx_radix_tree_t *tree, uint32_t key);
 
+/*
+ * 批量查找n个key，values[i]是keys[i]的结果，和逐个调用ngx_radix32tree_find相同
+ * 每NGX_RADIX_BATCH个key一组同时往下走，每层预取下一层的节点，几条路径的cache miss可以重叠
+ */
+#define NGX_RADIX_BATCH  16
+
+void ngx_radix32tree_find_n(ngx_radix_tree_t *tree, uint32_t *keys,
+    uintptr_t *values, ngx_uint_t n);
+
+
+/*
+ * 从IPv4基数树编译出来的DIR-24-8查找表，只读，树修改后要重新编译
+ * tbl24: 按地址的高24位下标，共2^24项，每项是values的下标；
+ *        最高位为1时表示这个/24下面还有更长的前缀，低31位是tbl8里的组号
+ * tbl8:  每组256项，按地址的低8位下标，存的也是values的下标
+ * values: 树里所有的value，values[0]是NGX_RADIX_NO_VALUE
+ * 查找最多读tbl24、tbl8各一次，再读一次values；tbl24固定占64M，
+ * 每个含有长于/24前缀的/24再多占1K，size是总共用的内存，tree_size是原来树节点占的内存
+ */
+#define NGX_RADIX_DIR_GROUP  0x80000000
+
+typedef struct {
+    uint32_t          *tbl24;
+    uint32_t          *tbl8;
+    uintptr_t         *values;
+    ngx_uint_t         ngroups;
+    ngx_uint_t         nvalues;
+    ngx_uint_t         version; //编译时树的version
+    size_t             size;
+    size_t             tree_size;
+} ngx_radix_dir_t;
+
+//编译查找表，内存用ngx_alloc单独分配，不占树的内存池；失败返回NULL
+ngx_radix_dir_t *ngx_radix32dir_create(ngx_radix_tree_t *tree, ngx_log_t *log);
+void ngx_radix32dir_destroy(ngx_radix_dir_t *dir);
+
+//树在编译之后又被修改过
+#define ngx_radix32dir_stale(dir, tree)  ((dir)->version != (tree)->version)
+
+static ngx_inline uintptr_t
+ngx_radix32dir_find(ngx_radix_dir_t *dir, uint32_t key)
+{
+    uint32_t  e;
+
+    e = dir->tbl24[key >> 8];
+
+    if (e & NGX_RADIX_DIR_GROUP) {
+        e = dir->tbl8[((e & ~NGX_RADIX_DIR_GROUP) << 8) + (key & 0xff)];
+    }
+
+    return dir->values[e];
+}
+
+/*
+ * 批量查找，结果和逐个调用ngx_radix32dir_find相同
+ * NGX_RADIX_GATHER为1时，支持AVX2的CPU每8个key用gather一起查；
+ * 在测试的机器上gather比逐个查还慢(见main.c)，所以默认不编译
+ */
+#ifndef NGX_RADIX_GATHER
+#define NGX_RADIX_GATHER  0
+#endif
+
+void ngx_radix32dir_find_n(ngx_radix_dir_t *dir, uint32_t *keys,
+    uintptr_t *values, ngx_uint_t n);
+
 #if (NGX_HAVE_INET6)
 ngx_int_t ngx_radix128tree_insert(ngx_radix_tree_t *tree,
                                   u_char *key, u_char *mask, uintptr_t value);
 ngx_int_t ngx_radix128tree_delete(ngx_radix_tree_t *tree,
                                   u_char *key, u_char *mask);
 uintptr_t ngx_radix128tree_find(ngx_radix_tree_t *tree, u_char *key);
+
+
+/*
+ * 路径压缩的IPv6基数树(Patricia树)
+ * ngx_radix128tree每层只比较1位，/48的前缀要走48层；这里只有分叉的地方和有值的前缀才有节点，
+ * 每个节点记下完整的前缀和长度，一次比较64位，没有分叉的一串位直接跳过，
+ * 深度大约是log2(前缀个数)，和前缀长度无关
+ * insert/delete/find的用法和返回值与ngx_radix128tree_*一样，mask必须是连续的1
+ */
+typedef struct ngx_radix_pnode_s ngx_radix_pnode_t;
+
+struct ngx_radix_pnode_s {
+    uint64_t           key[2];   //前缀，主机字节序，plen之后的位都是0
+    ngx_uint_t         plen;     //前缀长度0~128
+    uintptr_t          value;    //NGX_RADIX_NO_VALUE表示只是用来分叉的节点
+    ngx_radix_pnode_t *child[2]; //第plen位是0/1的子节点，它们的plen都比这个节点大
+    ngx_radix_pnode_t *parent;
+};
+
+typedef struct {
+    ngx_radix_pnode_t *root;     //空树时为NULL
+    ngx_pool_t        *pool;
+    ngx_radix_pnode_t *free;     //删除的节点，用child[0]串起来
+    char              *start;
+    size_t             size;
+} ngx_radix_ptree_t;
+
+ngx_radix_ptree_t *ngx_radix_ptree_create(ngx_pool_t *pool);
+ngx_int_t ngx_radix128ptree_insert(ngx_radix_ptree_t *tree,
+                                   u_char *key, u_char *mask, uintptr_t value);
+ngx_int_t ngx_radix128ptree_delete(ngx_radix_ptree_t *tree,
+                                   u_char *key, u_char *mask);
+uintptr_t ngx_radix128ptree_find(ngx_radix_ptree_t *tree, u_char *key);
 #endif
 
 #endif //NGX_RADIX_TREE_NGX_RADIX_TREE_H
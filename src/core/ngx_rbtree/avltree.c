@@ -288,7 +288,7 @@ Node* delete_node(AVLTree tree,  Node *z)
     }
 
     if (z->key < tree->key) {
-        tree->left = avltree_delete(tree->left, z);
+        tree->left = delete_node(tree->left, z);
         // 删除节点后，若AVL树失去平衡，则进行相应的调节
         if(HEIGHT(tree->right) - HEIGHT(tree->left) == 2) {
             Node *r = tree->right;
@@ -299,7 +299,7 @@ Node* delete_node(AVLTree tree,  Node *z)
             }
         }
     } else if (z->key > tree->key) {// 待删除的节点在"tree的右子树"中
-        tree->right = avltree_delete(tree->right, z);
+        tree->right = delete_node(tree->right, z);
         // 删除节点后，若AVL树失去平衡，则进行相应的调节
         if (HEIGHT(tree->left) - HEIGHT(tree->right) == 2){
             Node *l =  tree->left;
@@ -333,7 +333,7 @@ Node* delete_node(AVLTree tree,  Node *z)
                 //   (03)删除该最小节点。
                 // 这类似于用"tree的右子树中最小节点"做"tree"的替身；
                 // 采用这种方式的好处是：删除"tree的右子树中最小节点"之后，AVL树仍然是平衡的。
-                Node *min = avltree_maximum(tree->right);
+                Node *min = avltree_minimum(tree->right);
                 tree->key = min->key;
                 tree->right = delete_node(tree->right, min);
             }
@@ -344,6 +344,11 @@ Node* delete_node(AVLTree tree,  Node *z)
         }
     }
 
+    //没有旋转时高度也可能变了，要重新计算
+    if (tree != NULL) {
+        tree->height = Max(HEIGHT(tree->left), HEIGHT(tree->right)) + 1;
+    }
+
     return tree;
 }
 
@@ -376,6 +381,8 @@ void destroy_avltree(AVLTree tree)
 }
 
 /*########################test#######################*/
+//main.c里的性能测试会把这个文件一起编译，用-DNGX_TREE_BENCH去掉这里的main
+#ifndef NGX_TREE_BENCH
 static int arr[]= {3,2,1,4,5,6,7,16,15,14,13,12,11,10,8,9};
 #define TBL_SIZE(a) ( (sizeof(a)) / (sizeof(a[0])) )
 
@@ -423,4 +430,5 @@ void main()
     // 销毁二叉树
     destroy_avltree(root);
 }
+#endif
 /*########################test#######################*/
\ No newline at end of file
@@ -291,6 +291,8 @@ void print_bstree(BSTree tree, int key, int direction)
 
 
 /*##########################test###################################*/
+//main.c里的性能测试会把这个文件一起编译，用-DNGX_TREE_BENCH去掉这里的main
+#ifndef NGX_TREE_BENCH
 
 static int arr[]= {1,5,4,3,2,6};
 #define TBL_SIZE(a) ( (sizeof(a)) / (sizeof(a[0])) )
@@ -334,4 +336,6 @@ void main()
     destroy_bstree(root);
 }
 
+#endif
+
 /*################################################################*/
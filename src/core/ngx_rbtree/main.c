@@ -1,5 +1,43 @@
 #include <stdio.h>
+#include <time.h>
+#include <ngx_config.h>
+#include <ngx_core.h>
 #include <ngx_rbtree.h>
+#include "avltree.h"
+
+/*
+ * 性能测试要和avltree.c、bstree.c一起编译，加上-DNGX_TREE_BENCH去掉它们自己的main
+ * avltree.h和bstree.h都定义了Node，不能同时包含，二叉搜索树只声明用到的函数，
+ * 两种节点的第一个成员都是int key
+ */
+struct BSTreeNode *insert_bstree(struct BSTreeNode *tree, int key);
+struct BSTreeNode *delete_bstree(struct BSTreeNode *tree, int key);
+struct BSTreeNode *bstree_minimum(struct BSTreeNode *tree);
+struct BSTreeNode *iterative_bstree_search(struct BSTreeNode *tree, int key);
+void destroy_bstree(struct BSTreeNode *tree);
+
+#define Bench_Ops 1000000
+
+enum { TREE_RB = 0, TREE_B, TREE_AVL, TREE_BST, TREE_MAX };
+static const char *tree_names[TREE_MAX] = { "ngx_rbtree", "ngx_btree", "avltree", "bstree" };
+
+//模拟嵌在连接、事件里的节点，中间隔着其他字段，每个节点都在不同的cache line上
+typedef struct {
+    ngx_rbtree_node_t rb;
+    ngx_btree_node_t bt;
+    u_char pad[192];
+} bench_node_t;
+
+void bench_timer_like(ngx_uint_t n);
+void bench_session_like(ngx_uint_t n);
+void bench_bulk(ngx_uint_t n);
+
+/* for passing compiling */
+volatile ngx_cycle_t  *ngx_cycle;
+ngx_log_t ngx_log;
+void ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err, const char *fmt, ...)
+{
+}
 
 typedef struct rbtree_node {
     ngx_rbtree_node_t node;
@@ -47,5 +85,366 @@ int main() {
     if(lknode != NULL)
         ngx_rbtree_delete(&rbtree, &lknode->node);
 
+    //遍历key在[10, 22]之间的节点，从第一个>=10的节点开始，不用从最小的走起
+    printf("nodes in [10, 22]:");
+    for (tmpnode = ngx_rbtree_lower_bound(&rbtree, 10);
+         tmpnode && tmpnode->key <= 22;
+         tmpnode = ngx_rbtree_next(&rbtree, tmpnode))
+    {
+        printf(" %lu", (unsigned long) tmpnode->key);
+    }
+    printf("\n");
+
+    printf("--------------------------------\n");
+    printf("ordered containers (ns/op):\n");
+    printf("--------------------------------\n");
+
+    for (i = 10000; i <= 1000000; i *= 10) {
+        bench_timer_like(i);
+        bench_session_like(i);
+    }
+
+    for (i = 10000; i <= 1000000; i *= 10) {
+        bench_bulk(i);
+    }
+
     return 0;
-}
\ No newline at end of file
+}
+static ngx_rbtree_t bench_rbtree;
+static ngx_rbtree_node_t bench_sentinel;
+static ngx_btree_t bench_btree;
+static AVLTree bench_avl;
+static struct BSTreeNode *bench_bst;
+
+static void
+bench_init(ngx_uint_t t)
+{
+    switch (t) {
+    case TREE_RB:
+        ngx_rbtree_init(&bench_rbtree, &bench_sentinel, ngx_rbtree_insert_value);
+        break;
+    case TREE_B:
+        ngx_btree_init(&bench_btree, &ngx_log);
+        break;
+    case TREE_AVL:
+        bench_avl = NULL;
+        break;
+    default:
+        bench_bst = NULL;
+    }
+}
+
+static void
+bench_done(ngx_uint_t t)
+{
+    switch (t) {
+    case TREE_B:
+        ngx_btree_destroy(&bench_btree);
+        break;
+    case TREE_AVL:
+        destroy_avltree(bench_avl);
+        break;
+    case TREE_BST:
+        destroy_bstree(bench_bst);
+        break;
+    }
+}
+
+//avltree和bstree自己分配节点，只用key；两个ngx的树用调用方的节点
+static void
+bench_insert(ngx_uint_t t, bench_node_t *node, ngx_uint_t key)
+{
+    switch (t) {
+    case TREE_RB:
+        node->rb.key = key;
+        ngx_rbtree_insert(&bench_rbtree, &node->rb);
+        break;
+    case TREE_B:
+        node->bt.key = key;
+        ngx_btree_insert(&bench_btree, &node->bt);
+        break;
+    case TREE_AVL:
+        bench_avl = avltree_insert(bench_avl, (int) key);
+        break;
+    default:
+        bench_bst = insert_bstree(bench_bst, (int) key);
+    }
+}
+
+static void
+bench_delete(ngx_uint_t t, bench_node_t *node, ngx_uint_t key)
+{
+    switch (t) {
+    case TREE_RB:
+        ngx_rbtree_delete(&bench_rbtree, &node->rb);
+        break;
+    case TREE_B:
+        ngx_btree_delete(&bench_btree, &node->bt);
+        break;
+    case TREE_AVL:
+        bench_avl = avltree_delete(bench_avl, (int) key);
+        break;
+    default:
+        bench_bst = delete_bstree(bench_bst, (int) key);
+    }
+}
+
+//最小的key，ngx的树同时返回节点
+static ngx_uint_t
+bench_min(ngx_uint_t t, bench_node_t **node)
+{
+    ngx_rbtree_node_t *rb;
+    ngx_btree_node_t *bt;
+
+    switch (t) {
+    case TREE_RB:
+        rb = ngx_rbtree_min(bench_rbtree.root, &bench_sentinel);
+        *node = (bench_node_t *) ((u_char *) rb - offsetof(bench_node_t, rb));
+        return rb->key;
+    case TREE_B:
+        bt = ngx_btree_min(&bench_btree);
+        *node = (bench_node_t *) ((u_char *) bt - offsetof(bench_node_t, bt));
+        return bt->key;
+    case TREE_AVL:
+        return avltree_minimum(bench_avl)->key;
+    default:
+        return *(int *) bstree_minimum(bench_bst);
+    }
+}
+
+static ngx_uint_t
+bench_find(ngx_uint_t t, ngx_uint_t key)
+{
+    ngx_rbtree_node_t *node;
+
+    switch (t) {
+    case TREE_RB:
+        node = bench_rbtree.root;
+        while (node != &bench_sentinel) {
+            if (key == node->key) {
+                return 1;
+            }
+            node = (key < node->key) ? node->left : node->right;
+        }
+        return 0;
+    case TREE_B:
+        return ngx_btree_lookup(&bench_btree, key) != NULL;
+    case TREE_AVL:
+        return iterative_avltree_search(bench_avl, (int) key) != NULL;
+    default:
+        return iterative_bstree_search(bench_bst, (int) key) != NULL;
+    }
+}
+
+static ngx_uint_t
+bench_rand(void)
+{
+    return ((ngx_uint_t) rand() << 16) ^ rand();
+}
+
+static double
+bench_elapsed(struct timespec *start, struct timespec *end)
+{
+    return ((end->tv_sec - start->tv_sec) * 1e9
+            + (end->tv_nsec - start->tv_nsec)) / Bench_Ops;
+}
+
+/*
+ * 定时器：n个定时器，每次取出最早的一个(当前时间走到它)，再加一个now + 1 ~ 8n的定时器
+ * avltree不能有重复的key，用位图保证每个key只出现一次，所有的树用同样的key序列
+ */
+static ngx_uint_t
+bench_timer_key(uint8_t *used, ngx_uint_t now, ngx_uint_t n)
+{
+    ngx_uint_t key;
+
+    key = now + 1 + bench_rand() % (8 * n);
+
+    while (used[key >> 3] & (1 << (key & 7))) {
+        key++;
+    }
+
+    used[key >> 3] |= 1 << (key & 7);
+
+    return key;
+}
+
+void bench_timer_like(ngx_uint_t n)
+{
+    ngx_uint_t t, i, now, key, size;
+    uint8_t *used;
+    bench_node_t *nodes, *node;
+    struct timespec start, end;
+
+    nodes = ngx_calloc(n * sizeof(bench_node_t), &ngx_log);
+    size = (8 * (Bench_Ops + 2 * n) + 8 * n) / 8 + 1;
+    used = ngx_alloc(size, &ngx_log);
+
+    printf("timer   n=%-8lu", (unsigned long) n);
+
+    for (t = 0; t < TREE_MAX; t++) {
+        srand(1);
+        ngx_memzero(used, size);
+        bench_init(t);
+
+        for (i = 0; i < n; i++) {
+            bench_insert(t, &nodes[i], bench_timer_key(used, 0, n));
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        for (i = 0; i < Bench_Ops; i++) {
+            now = bench_min(t, &node);
+            bench_delete(t, node, now);
+            key = bench_timer_key(used, now, n);
+            bench_insert(t, node, key);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        printf("  %s %6.1f", tree_names[t], bench_elapsed(&start, &end));
+        bench_done(t);
+    }
+
+    printf("\n");
+
+    ngx_free(used);
+    ngx_free(nodes);
+}
+
+/*
+ * 会话缓存：n个随机key，80%是查找，20%是删除一个再加入一个新的
+ * key是序号乘一个奇数再取低31位，不会重复
+ */
+#define bench_session_key(i)  (((i) * 2654435761u) & 0x7fffffff)
+
+void bench_session_like(ngx_uint_t n)
+{
+    ngx_uint_t t, i, j, next, found, *ids;
+    bench_node_t *nodes;
+    struct timespec start, end;
+
+    nodes = ngx_calloc(n * sizeof(bench_node_t), &ngx_log);
+    ids = ngx_alloc(n * sizeof(ngx_uint_t), &ngx_log);
+
+    printf("session n=%-8lu", (unsigned long) n);
+
+    for (t = 0; t < TREE_MAX; t++) {
+        srand(1);
+        bench_init(t);
+
+        for (i = 0; i < n; i++) {
+            ids[i] = i;
+            bench_insert(t, &nodes[i], bench_session_key(i));
+        }
+
+        next = n;
+        found = 0;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        for (i = 0; i < Bench_Ops; i++) {
+            j = bench_rand() % n;
+
+            if (bench_rand() % 10 < 8) {
+                found += bench_find(t, bench_session_key(ids[j]));
+                continue;
+            }
+
+            bench_delete(t, &nodes[j], bench_session_key(ids[j]));
+            ids[j] = next++;
+            bench_insert(t, &nodes[j], bench_session_key(ids[j]));
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        printf("  %s %6.1f%s", tree_names[t], bench_elapsed(&start, &end),
+               found ? "" : "(?)");
+        bench_done(t);
+    }
+
+    printf("\n");
+
+    ngx_free(ids);
+    ngx_free(nodes);
+}
+
+static double
+bench_ms(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1e3
+           + (end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static void
+bench_free_node(ngx_rbtree_node_t *node, void *data)
+{
+    (*(ngx_uint_t *) data)++;
+}
+
+/*
+ * 重建/清空整棵树：n次ngx_rbtree_insert和ngx_rbtree_build比，
+ * 每次删最小的节点和ngx_rbtree_destroy比，节点已经按key排好序(比如从别的地方导入的会话)
+ * 这里只比树本身的操作，节点用不带pad的ngx_rbtree_node_t，100万个节点约40MB
+ */
+void bench_bulk(ngx_uint_t n)
+{
+    ngx_uint_t i, freed;
+    ngx_rbtree_node_t *nodes;
+    ngx_rbtree_node_t **sorted;
+    struct timespec start, end;
+    double insert, build, del, destroy;
+
+    nodes = ngx_calloc(n * sizeof(ngx_rbtree_node_t), &ngx_log);
+    sorted = ngx_alloc(n * sizeof(ngx_rbtree_node_t *), &ngx_log);
+    if (nodes == NULL || sorted == NULL) {
+        printf("Failed to allocate %lu nodes!\n", (unsigned long) n);
+        return;
+    }
+
+    for (i = 0; i < n; i++) {
+        nodes[i].key = i * 16;
+        sorted[i] = &nodes[i];
+    }
+
+    ngx_rbtree_init(&bench_rbtree, &bench_sentinel, ngx_rbtree_insert_value);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < n; i++) {
+        ngx_rbtree_insert(&bench_rbtree, sorted[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    insert = bench_ms(&start, &end);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (bench_rbtree.root != &bench_sentinel) {
+        ngx_rbtree_delete(&bench_rbtree,
+                          ngx_rbtree_min(bench_rbtree.root, &bench_sentinel));
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    del = bench_ms(&start, &end);
+
+    //ngx_rbtree_delete会把key清零
+    for (i = 0; i < n; i++) {
+        nodes[i].key = i * 16;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ngx_rbtree_build(&bench_rbtree, sorted, n);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    build = bench_ms(&start, &end);
+
+    freed = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ngx_rbtree_destroy(&bench_rbtree, bench_free_node, &freed);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    destroy = bench_ms(&start, &end);
+
+    printf("bulk    n=%-8lu  insert %8.2fms  build %8.2fms"
+           "  delete %8.2fms  destroy %8.2fms%s\n",
+           (unsigned long) n, insert, build, del, destroy,
+           freed == n ? "" : "  (lost nodes!)");
+
+    ngx_free(sorted);
+    ngx_free(nodes);
+}
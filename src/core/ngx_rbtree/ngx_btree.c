@@ -0,0 +1,540 @@
+/*
+* @author:    daemon.xie
+* @license:   Apache Licence
+* @contact:   xieyugui
+* @software:  CLion
+* @file:      ngx_btree.c
+* @date:      2026/10/17 下午3:40
+* @desc:
+*/
+
+//
+// Created by daemon.xie on 2026/10/17.
+//
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+//空闲页最多留这么多，多出来的直接释放
+#define NGX_BTREE_FREE_MAX  64
+
+static ngx_int_t ngx_btree_reserve(ngx_btree_t *tree, ngx_uint_t n);
+static ngx_btree_page_t *ngx_btree_get_page(ngx_btree_t *tree);
+static void ngx_btree_free_page(ngx_btree_t *tree, ngx_btree_page_t *page);
+static void ngx_btree_merge(ngx_btree_t *tree, ngx_btree_page_t *parent,
+    ngx_uint_t j);
+static void ngx_btree_destroy_page(ngx_btree_page_t *page);
+
+
+//页里不大于(key, node)的元素个数，也就是内部页里要走的子页下标
+static ngx_inline ngx_uint_t
+ngx_btree_upper(ngx_btree_page_t *page, ngx_rbtree_key_t key,
+    ngx_btree_node_t *node)
+{
+    ngx_uint_t  i;
+
+    for (i = 0; i < page->n; i++) {
+        if (key < page->key[i]
+            || (key == page->key[i]
+                && (uintptr_t) node < (uintptr_t) page->node[i]))
+        {
+            break;
+        }
+    }
+
+    return i;
+}
+
+
+//在第i个位置放入元素，内部页同时在第i + 1个位置放入右边的子页
+static ngx_inline void
+ngx_btree_insert_at(ngx_btree_page_t *page, ngx_uint_t i,
+    ngx_rbtree_key_t key, ngx_btree_node_t *node, ngx_btree_page_t *child)
+{
+    ngx_uint_t  n;
+
+    n = page->n - i;
+
+    ngx_memmove(&page->key[i + 1], &page->key[i], n * sizeof(ngx_rbtree_key_t));
+    ngx_memmove(&page->node[i + 1], &page->node[i],
+                n * sizeof(ngx_btree_node_t *));
+
+    page->key[i] = key;
+    page->node[i] = node;
+
+    if (!page->leaf) {
+        ngx_memmove(&page->child[i + 2], &page->child[i + 1],
+                    n * sizeof(ngx_btree_page_t *));
+        page->child[i + 1] = child;
+    }
+
+    page->n++;
+}
+
+
+//删除第i个元素，内部页同时删除第i + 1个子页
+static ngx_inline void
+ngx_btree_remove_at(ngx_btree_page_t *page, ngx_uint_t i)
+{
+    ngx_uint_t  n;
+
+    n = page->n - i - 1;
+
+    ngx_memmove(&page->key[i], &page->key[i + 1], n * sizeof(ngx_rbtree_key_t));
+    ngx_memmove(&page->node[i], &page->node[i + 1],
+                n * sizeof(ngx_btree_node_t *));
+
+    if (!page->leaf) {
+        ngx_memmove(&page->child[i + 1], &page->child[i + 2],
+                    n * sizeof(ngx_btree_page_t *));
+    }
+
+    page->n--;
+}
+
+
+ngx_int_t
+ngx_btree_insert(ngx_btree_t *tree, ngx_btree_node_t *node)
+{
+    ngx_int_t          h;
+    ngx_uint_t         i, m, full;
+    ngx_rbtree_key_t   key;
+    ngx_btree_node_t  *sep;
+    ngx_btree_page_t  *p, *q, *root;
+    ngx_btree_page_t  *path[NGX_BTREE_HEIGHT];
+    ngx_uint_t         pos[NGX_BTREE_HEIGHT];
+
+    key = node->key;
+
+    if (tree->root == NULL) {
+        p = ngx_btree_get_page(tree);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        p->leaf = 1;
+        p->n = 0;
+        p->next = NULL;
+        ngx_btree_insert_at(p, 0, key, node, NULL);
+
+        tree->root = p;
+        tree->height = 1;
+        tree->nelts = 1;
+
+        return NGX_OK;
+    }
+
+    //从根往下找到叶子，记下路径，顺便数一下从叶子往上连续有几个满页，就是最多要分裂的页数
+    p = tree->root;
+    full = 0;
+
+    for (h = 0; /* void */; h++) {
+        i = ngx_btree_upper(p, key, node);
+        path[h] = p;
+        pos[h] = i;
+
+        full = (p->n == NGX_BTREE_MAX) ? full + 1 : 0;
+
+        if (p->leaf) {
+            break;
+        }
+
+        p = p->child[i];
+    }
+
+    //先把要用的页准备好，分裂到一半时就不会失败；根也满了还要多一个新根
+    if (ngx_btree_reserve(tree, full + (full == tree->height)) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ngx_btree_insert_at(p, pos[h], key, node, NULL);
+    tree->nelts++;
+
+    while (p->n > NGX_BTREE_MAX) {
+
+        //左边留m个元素，右边的放到新页q里
+        q = ngx_btree_get_page(tree);
+        q->leaf = p->leaf;
+        m = (NGX_BTREE_MAX + 1) / 2;
+
+        if (p->leaf) {
+            //叶子：右边第一个元素复制一份到父页做分隔
+            q->n = p->n - m;
+            ngx_memcpy(q->key, &p->key[m], q->n * sizeof(ngx_rbtree_key_t));
+            ngx_memcpy(q->node, &p->node[m], q->n * sizeof(ngx_btree_node_t *));
+
+            q->next = p->next;
+            p->next = q;
+
+            key = q->key[0];
+            sep = q->node[0];
+
+        } else {
+            //内部页：第m个分隔元素移到父页，左右都不再保留它
+            q->n = p->n - m - 1;
+            ngx_memcpy(q->key, &p->key[m + 1],
+                       q->n * sizeof(ngx_rbtree_key_t));
+            ngx_memcpy(q->node, &p->node[m + 1],
+                       q->n * sizeof(ngx_btree_node_t *));
+            ngx_memcpy(q->child, &p->child[m + 1],
+                       (q->n + 1) * sizeof(ngx_btree_page_t *));
+
+            q->next = NULL;
+
+            key = p->key[m];
+            sep = p->node[m];
+        }
+
+        p->n = m;
+
+        if (--h < 0) {
+            //根分裂了，树长高一层
+            root = ngx_btree_get_page(tree);
+            root->leaf = 0;
+            root->n = 1;
+            root->key[0] = key;
+            root->node[0] = sep;
+            root->child[0] = p;
+            root->child[1] = q;
+            root->next = NULL;
+
+            tree->root = root;
+            tree->height++;
+
+            break;
+        }
+
+        p = path[h];
+        ngx_btree_insert_at(p, pos[h], key, sep, q);
+    }
+
+    return NGX_OK;
+}
+
+
+void
+ngx_btree_delete(ngx_btree_t *tree, ngx_btree_node_t *node)
+{
+    ngx_int_t          h;
+    ngx_uint_t         i;
+    ngx_rbtree_key_t   key;
+    ngx_btree_page_t  *p, *parent, *left, *right;
+    ngx_btree_page_t  *path[NGX_BTREE_HEIGHT];
+    ngx_uint_t         pos[NGX_BTREE_HEIGHT];
+
+    key = node->key;
+    p = tree->root;
+
+    for (h = 0; /* void */; h++) {
+        i = ngx_btree_upper(p, key, node);
+        path[h] = p;
+        pos[h] = i;
+
+        if (p->leaf) {
+            break;
+        }
+
+        p = p->child[i];
+    }
+
+    //叶子里最后一个不大于它的元素就是它自己
+    ngx_btree_remove_at(p, i - 1);
+    tree->nelts--;
+
+    //内部页里可能还留着它做分隔元素，不用改，分隔元素只用来比较，不会访问节点
+
+    for ( ;; ) {
+
+        if (h == 0) {
+            //根可以少于NGX_BTREE_MIN个元素，空了才处理
+            if (p->n == 0) {
+                if (p->leaf) {
+                    tree->root = NULL;
+                    tree->height = 0;
+
+                } else {
+                    tree->root = p->child[0];
+                    tree->height--;
+                }
+
+                ngx_btree_free_page(tree, p);
+            }
+
+            return;
+        }
+
+        if (p->n >= NGX_BTREE_MIN) {
+            return;
+        }
+
+        //元素不够了，先向左右兄弟借一个，都借不到就和兄弟合并，父页少一个元素，再往上检查
+        parent = path[h - 1];
+        i = pos[h - 1];
+
+        left = (i > 0) ? parent->child[i - 1] : NULL;
+        right = (i < parent->n) ? parent->child[i + 1] : NULL;
+
+        if (left && left->n > NGX_BTREE_MIN) {
+
+            if (p->leaf) {
+                ngx_btree_insert_at(p, 0, left->key[left->n - 1],
+                                    left->node[left->n - 1], NULL);
+                parent->key[i - 1] = p->key[0];
+                parent->node[i - 1] = p->node[0];
+
+            } else {
+                //父页的分隔元素下来，左兄弟最后一个元素上去，它的最后一个子页跟过来
+                ngx_memmove(&p->key[1], &p->key[0],
+                            p->n * sizeof(ngx_rbtree_key_t));
+                ngx_memmove(&p->node[1], &p->node[0],
+                            p->n * sizeof(ngx_btree_node_t *));
+                ngx_memmove(&p->child[1], &p->child[0],
+                            (p->n + 1) * sizeof(ngx_btree_page_t *));
+
+                p->key[0] = parent->key[i - 1];
+                p->node[0] = parent->node[i - 1];
+                p->child[0] = left->child[left->n];
+                p->n++;
+
+                parent->key[i - 1] = left->key[left->n - 1];
+                parent->node[i - 1] = left->node[left->n - 1];
+            }
+
+            left->n--;
+
+            return;
+        }
+
+        if (right && right->n > NGX_BTREE_MIN) {
+
+            if (p->leaf) {
+                ngx_btree_insert_at(p, p->n, right->key[0], right->node[0],
+                                    NULL);
+                ngx_btree_remove_at(right, 0);
+                parent->key[i] = right->key[0];
+                parent->node[i] = right->node[0];
+
+            } else {
+                ngx_btree_insert_at(p, p->n, parent->key[i], parent->node[i],
+                                    right->child[0]);
+
+                parent->key[i] = right->key[0];
+                parent->node[i] = right->node[0];
+
+                right->n--;
+
+                ngx_memmove(&right->key[0], &right->key[1],
+                            right->n * sizeof(ngx_rbtree_key_t));
+                ngx_memmove(&right->node[0], &right->node[1],
+                            right->n * sizeof(ngx_btree_node_t *));
+                ngx_memmove(&right->child[0], &right->child[1],
+                            (right->n + 1) * sizeof(ngx_btree_page_t *));
+            }
+
+            return;
+        }
+
+        ngx_btree_merge(tree, parent, left ? i - 1 : i);
+
+        p = parent;
+        h--;
+    }
+}
+
+
+//把child[j + 1]合并到child[j]，两个加起来不会超过NGX_BTREE_MAX
+static void
+ngx_btree_merge(ngx_btree_t *tree, ngx_btree_page_t *parent, ngx_uint_t j)
+{
+    ngx_btree_page_t  *l, *r;
+
+    l = parent->child[j];
+    r = parent->child[j + 1];
+
+    if (l->leaf) {
+        l->next = r->next;
+
+    } else {
+        //内部页合并时父页的分隔元素也要下来
+        l->key[l->n] = parent->key[j];
+        l->node[l->n] = parent->node[j];
+        l->n++;
+
+        ngx_memcpy(&l->child[l->n], r->child,
+                   (r->n + 1) * sizeof(ngx_btree_page_t *));
+    }
+
+    ngx_memcpy(&l->key[l->n], r->key, r->n * sizeof(ngx_rbtree_key_t));
+    ngx_memcpy(&l->node[l->n], r->node, r->n * sizeof(ngx_btree_node_t *));
+    l->n += r->n;
+
+    ngx_btree_remove_at(parent, j);
+    ngx_btree_free_page(tree, r);
+}
+
+
+ngx_btree_node_t *
+ngx_btree_min(ngx_btree_t *tree)
+{
+    ngx_btree_page_t  *p;
+
+    p = tree->root;
+
+    if (p == NULL) {
+        return NULL;
+    }
+
+    while (!p->leaf) {
+        p = p->child[0];
+    }
+
+    return p->node[0];
+}
+
+
+ngx_btree_node_t *
+ngx_btree_lookup(ngx_btree_t *tree, ngx_rbtree_key_t key)
+{
+    ngx_uint_t         i;
+    ngx_btree_page_t  *p;
+
+    p = tree->root;
+
+    if (p == NULL) {
+        return NULL;
+    }
+
+    //key相同的元素可能分在几个页里，往下走时只跳过分隔元素比key小的子页，找到的就是第一个
+    for ( ;; ) {
+        for (i = 0; i < p->n && p->key[i] < key; i++) { /* void */ }
+
+        if (p->leaf) {
+            break;
+        }
+
+        p = p->child[i];
+    }
+
+    if (i == p->n) {
+        //这个叶子里都比key小，第一个不小于key的在右边的叶子开头
+        p = p->next;
+        i = 0;
+
+        if (p == NULL) {
+            return NULL;
+        }
+    }
+
+    return (p->key[i] == key) ? p->node[i] : NULL;
+}
+
+
+ngx_btree_node_t *
+ngx_btree_first(ngx_btree_t *tree, ngx_btree_iter_t *it)
+{
+    ngx_btree_page_t  *p;
+
+    p = tree->root;
+
+    if (p == NULL) {
+        it->page = NULL;
+        return NULL;
+    }
+
+    while (!p->leaf) {
+        p = p->child[0];
+    }
+
+    it->page = p;
+    it->i = 0;
+
+    return p->node[0];
+}
+
+
+void
+ngx_btree_destroy(ngx_btree_t *tree)
+{
+    ngx_btree_page_t  *p;
+
+    if (tree->root) {
+        ngx_btree_destroy_page(tree->root);
+    }
+
+    while (tree->free) {
+        p = tree->free;
+        tree->free = p->next;
+        ngx_free(p);
+    }
+
+    tree->root = NULL;
+    tree->height = 0;
+    tree->nelts = 0;
+    tree->nfree = 0;
+}
+
+
+static void
+ngx_btree_destroy_page(ngx_btree_page_t *page)
+{
+    ngx_uint_t  i;
+
+    if (!page->leaf) {
+        for (i = 0; i <= page->n; i++) {
+            ngx_btree_destroy_page(page->child[i]);
+        }
+    }
+
+    ngx_free(page);
+}
+
+
+static ngx_int_t
+ngx_btree_reserve(ngx_btree_t *tree, ngx_uint_t n)
+{
+    ngx_btree_page_t  *p;
+
+    while (tree->nfree < n) {
+        p = ngx_alloc(sizeof(ngx_btree_page_t), tree->log);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        p->next = tree->free;
+        tree->free = p;
+        tree->nfree++;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_btree_page_t *
+ngx_btree_get_page(ngx_btree_t *tree)
+{
+    ngx_btree_page_t  *p;
+
+    if (ngx_btree_reserve(tree, 1) != NGX_OK) {
+        return NULL;
+    }
+
+    p = tree->free;
+    tree->free = p->next;
+    tree->nfree--;
+
+    return p;
+}
+
+
+static void
+ngx_btree_free_page(ngx_btree_t *tree, ngx_btree_page_t *page)
+{
+    if (tree->nfree >= NGX_BTREE_FREE_MAX) {
+        ngx_free(page);
+        return;
+    }
+
+    page->next = tree->free;
+    tree->free = page;
+    tree->nfree++;
+}
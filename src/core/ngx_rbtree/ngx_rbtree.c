@@ -18,6 +18,9 @@ static ngx_inline void ngx_rbtree_left_rotate(ngx_rbtree_node_t **root,
     ngx_rbtree_node_t *sentinel, ngx_rbtree_node_t *node);
 static ngx_inline void ngx_rbtree_right_rotate(ngx_rbtree_node_t **root,
     ngx_rbtree_node_t *sentinel, ngx_rbtree_node_t *node);
+static ngx_rbtree_node_t *ngx_rbtree_build_node(ngx_rbtree_node_t **nodes,
+    ngx_uint_t n, ngx_uint_t depth, ngx_uint_t red, ngx_rbtree_node_t *parent,
+    ngx_rbtree_node_t *sentinel);
 
 /*
  case 1：红黑树为空，新节点插入作为根结点
@@ -54,6 +57,9 @@ ngx_rbtree_insert(ngx_rbtree_t *tree, ngx_rbtree_node_t *node)
         node->right = sentinel;
         ngx_rbt_black(node);
         *root = node;
+#if (NGX_RBTREE_RANK)
+        node->size = 1;
+#endif
 
         return;
     }
@@ -63,6 +69,16 @@ ngx_rbtree_insert(ngx_rbtree_t *tree, ngx_rbtree_node_t *node)
      */
     tree->insert(*root, node, sentinel);
 
+#if (NGX_RBTREE_RANK)
+    /* 新节点的所有祖先都多了一个子孙，之后的旋转会自己修正 */
+    node->size = 1;
+
+    for (temp = node; temp != *root; /* void */) {
+        temp = temp->parent;
+        temp->size++;
+    }
+#endif
+
     /*插入调整*/
 
     /* 调整红黑树，使其满足性质，
@@ -229,6 +245,19 @@ ngx_rbtree_delete(ngx_rbtree_t *tree, ngx_rbtree_node_t *node)
             temp = subst->right;
         }
     }
+
+#if (NGX_RBTREE_RANK)
+    /*
+     * 真正从原来位置拿走的是subst，它的祖先都少了一个子孙，
+     * subst != node时node也是它的祖先，之后subst接替node的位置和size；
+     * 根的parent不一定是NULL，所以走到根为止
+     */
+    for (w = subst; w != *root; /* void */) {
+        w = w->parent;
+        w->size--;
+    }
+#endif
+
     //subst是转换后只有一个儿子的节点(若node有两个儿子则subst是node右子树上最小的节点，若node至多只有一个儿子
 
     //简单情形1: 待删除的节点为根节点且该根节点至多只有一个儿子，只用用根节点的儿子替代根节点并重绘新根为黑色即可
@@ -281,6 +310,9 @@ ngx_rbtree_delete(ngx_rbtree_t *tree, ngx_rbtree_node_t *node)
         subst->parent = node->parent;
         //将node的颜色赋值给subst
         ngx_rbt_copy_color(subst, node);
+#if (NGX_RBTREE_RANK)
+        subst->size = node->size;
+#endif
 
         //若node为根结点，修改树的根结点指针
         if(node == *root) {
@@ -436,6 +468,11 @@ ngx_rbtree_left_rotate(ngx_rbtree_node_t **root, ngx_rbtree_node_t *sentinel,
 
     temp->left = node;
     node->parent = temp;
+
+#if (NGX_RBTREE_RANK)
+    temp->size = node->size;
+    node->size = node->left->size + node->right->size + 1;
+#endif
 }
 
 //右旋
@@ -466,6 +503,11 @@ ngx_rbtree_right_rotate(ngx_rbtree_node_t **root, ngx_rbtree_node_t *sentinel,
 
     temp->right = node;
     node->parent = temp;
+
+#if (NGX_RBTREE_RANK)
+    temp->size = node->size;
+    node->size = node->left->size + node->right->size + 1;
+#endif
 }
 
 /**
@@ -502,4 +544,244 @@ ngx_rbtree_next(ngx_rbtree_t *tree, ngx_rbtree_node_t *node)
 
         node = parent;
     }
-}
\ No newline at end of file
+}
+
+
+//前驱，和ngx_rbtree_next对称
+ngx_rbtree_node_t *
+ngx_rbtree_prev(ngx_rbtree_t *tree, ngx_rbtree_node_t *node)
+{
+    ngx_rbtree_node_t  *root, *sentinel, *parent;
+
+    sentinel = tree->sentinel;
+
+    if (node->left != sentinel) {
+        node = node->left;
+
+        while (node->right != sentinel) {
+            node = node->right;
+        }
+
+        return node;
+    }
+
+    root = tree->root;
+
+    for ( ;; ) {
+        parent = node->parent;
+
+        if (node == root) {
+            return NULL;
+        }
+
+        if (node == parent->right) {
+            return parent;
+        }
+
+        node = parent;
+    }
+}
+
+
+/*
+ * 从根往下走，遇到满足条件的节点先记下来再往左找更小的，不满足就往右，
+ * 最后记下的就是中序遍历里第一个满足条件的节点
+ */
+ngx_rbtree_node_t *
+ngx_rbtree_lower_bound(ngx_rbtree_t *tree, ngx_rbtree_key_t key)
+{
+    ngx_rbtree_node_t  *node, *sentinel, *found;
+
+    node = tree->root;
+    sentinel = tree->sentinel;
+    found = NULL;
+
+    while (node != sentinel) {
+
+        if (node->key >= key) {
+            found = node;
+            node = node->left;
+
+        } else {
+            node = node->right;
+        }
+    }
+
+    return found;
+}
+
+
+ngx_rbtree_node_t *
+ngx_rbtree_upper_bound(ngx_rbtree_t *tree, ngx_rbtree_key_t key)
+{
+    ngx_rbtree_node_t  *node, *sentinel, *found;
+
+    node = tree->root;
+    sentinel = tree->sentinel;
+    found = NULL;
+
+    while (node != sentinel) {
+
+        if (node->key > key) {
+            found = node;
+            node = node->left;
+
+        } else {
+            node = node->right;
+        }
+    }
+
+    return found;
+}
+
+
+void
+ngx_rbtree_build(ngx_rbtree_t *tree, ngx_rbtree_node_t **nodes, ngx_uint_t n)
+{
+    ngx_uint_t  red;
+
+    //深度0 ~ red-1的层是满的，第red层(如果有)是不满的最后一层
+    for (red = 0; ((ngx_uint_t) 2 << red) - 1 <= n; red++) { /* void */ }
+
+    tree->root = ngx_rbtree_build_node(nodes, n, 0, red, NULL, tree->sentinel);
+}
+
+
+static ngx_rbtree_node_t *
+ngx_rbtree_build_node(ngx_rbtree_node_t **nodes, ngx_uint_t n,
+    ngx_uint_t depth, ngx_uint_t red, ngx_rbtree_node_t *parent,
+    ngx_rbtree_node_t *sentinel)
+{
+    ngx_uint_t          m;
+    ngx_rbtree_node_t  *node;
+
+    if (n == 0) {
+        return sentinel;
+    }
+
+    m = n / 2;
+    node = nodes[m];
+
+    node->parent = parent;
+    node->left = ngx_rbtree_build_node(nodes, m, depth + 1, red, node,
+                                       sentinel);
+    node->right = ngx_rbtree_build_node(nodes + m + 1, n - m - 1, depth + 1,
+                                        red, node, sentinel);
+
+    /* 到每个叶子都经过red个黑节点，红节点在最后一层，孩子都是哨兵 */
+    if (depth == red) {
+        ngx_rbt_red(node);
+
+    } else {
+        ngx_rbt_black(node);
+    }
+
+#if (NGX_RBTREE_RANK)
+    node->size = n;
+#endif
+
+    return node;
+}
+
+
+/*
+ * 每次往下走到一个没有孩子的节点，把它从父节点上摘掉再交给handler，然后回到父节点，
+ * 每个节点最多经过三次，不需要递归和额外的栈
+ */
+void
+ngx_rbtree_destroy(ngx_rbtree_t *tree, ngx_rbtree_free_pt handler, void *data)
+{
+    ngx_rbtree_node_t  *node, *parent, *sentinel;
+
+    sentinel = tree->sentinel;
+    node = tree->root;
+
+    while (node != sentinel) {
+
+        if (node->left != sentinel) {
+            node = node->left;
+            continue;
+        }
+
+        if (node->right != sentinel) {
+            node = node->right;
+            continue;
+        }
+
+        //根的parent不一定是NULL，要单独判断
+        if (node == tree->root) {
+            parent = sentinel;
+            tree->root = sentinel;
+
+        } else {
+            parent = node->parent;
+
+            if (node == parent->left) {
+                parent->left = sentinel;
+
+            } else {
+                parent->right = sentinel;
+            }
+        }
+
+        handler(node, data);
+
+        node = parent;
+    }
+}
+
+
+#if (NGX_RBTREE_RANK)
+
+//往右走时，左子树和当前节点都比key小
+ngx_uint_t
+ngx_rbtree_rank(ngx_rbtree_t *tree, ngx_rbtree_key_t key)
+{
+    ngx_uint_t          rank;
+    ngx_rbtree_node_t  *node, *sentinel;
+
+    node = tree->root;
+    sentinel = tree->sentinel;
+    rank = 0;
+
+    while (node != sentinel) {
+
+        if (node->key < key) {
+            rank += node->left->size + 1;
+            node = node->right;
+
+        } else {
+            node = node->left;
+        }
+    }
+
+    return rank;
+}
+
+
+ngx_rbtree_node_t *
+ngx_rbtree_select(ngx_rbtree_t *tree, ngx_uint_t k)
+{
+    ngx_rbtree_node_t  *node, *sentinel;
+
+    node = tree->root;
+    sentinel = tree->sentinel;
+
+    while (node != sentinel) {
+
+        if (k < node->left->size) {
+            node = node->left;
+
+        } else if (k == node->left->size) {
+            return node;
+
+        } else {
+            k -= node->left->size + 1;
+            node = node->right;
+        }
+    }
+
+    return NULL;
+}
+
+#endif
@@ -34,6 +34,15 @@
 (5) 从一个节点到该节点的子孙节点的所有路径上包含相同数目的黑节点。
  */
 
+/*
+ * 为1时每个节点多一个size字段，记录以它为根的子树的节点个数，插入、删除和旋转时顺便维护，
+ * 可以用ngx_rbtree_rank/ngx_rbtree_select在O(log n)里统计某个key之前有多少节点、取第k个节点
+ * 默认不开，节点大小和原来一样
+ */
+#ifndef NGX_RBTREE_RANK
+#define NGX_RBTREE_RANK  0
+#endif
+
 typedef ngx_uint_t ngx_rbtree_key_t;
 typedef ngx_int_t ngx_rbtree_key_int_t;
 
@@ -46,6 +55,9 @@ struct ngx_rbtree_node_s {
     ngx_rbtree_node_t *parent;
     u_char color; //节点颜色，0表示黑色，1表示红色
     u_char data; //数据
+#if (NGX_RBTREE_RANK)
+    ngx_uint_t size; //子树的节点个数，哨兵是0
+#endif
 };
 
 typedef struct ngx_rbtree_s ngx_rbtree_t;
@@ -108,6 +120,51 @@ void ngx_rbtree_insert_timer_value(ngx_rbtree_node_t *root, ngx_rbtree_node_t *n
 
 //后继
 ngx_rbtree_node_t *ngx_rbtree_next(ngx_rbtree_t *tree, ngx_rbtree_node_t *node);
+//前驱
+ngx_rbtree_node_t *ngx_rbtree_prev(ngx_rbtree_t *tree, ngx_rbtree_node_t *node);
+
+/*
+ * 第一个key >= key的节点和第一个key > key的节点，没有返回NULL
+ * key按无符号数比较，定时器那种会回绕的key不能用
+ * 有重复的key时返回中序遍历里最靠前的一个，从它开始用ngx_rbtree_next遍历一个范围：
+ *     for (node = ngx_rbtree_lower_bound(tree, lo);
+ *          node && node->key <= hi;
+ *          node = ngx_rbtree_next(tree, node))
+ *     {
+ *         ...
+ *     }
+ * 遍历时要删除当前节点的话，先取出下一个节点再删除
+ */
+ngx_rbtree_node_t *ngx_rbtree_lower_bound(ngx_rbtree_t *tree,
+    ngx_rbtree_key_t key);
+ngx_rbtree_node_t *ngx_rbtree_upper_bound(ngx_rbtree_t *tree,
+    ngx_rbtree_key_t key);
+
+/*
+ * 用已经排好序的n个节点一次建好树，O(n)，不做插入时的旋转和变色，树必须是空的
+ * nodes[i]按树的比较方式从小到大排列(key和tree->insert的顺序一致)，节点的key要先设置好
+ * 每次取中间的节点做根，左右子树节点数最多差1，最下面不满的一层涂红，其余涂黑
+ */
+void ngx_rbtree_build(ngx_rbtree_t *tree, ngx_rbtree_node_t **nodes,
+    ngx_uint_t n);
+
+/*
+ * 拆掉整棵树，O(n)，不做删除时的调整；每个节点从树上摘下来后调用一次handler，
+ * handler里可以直接释放节点，不能再访问树；结束后树是空的
+ */
+typedef void (*ngx_rbtree_free_pt) (ngx_rbtree_node_t *node, void *data);
+
+void ngx_rbtree_destroy(ngx_rbtree_t *tree, ngx_rbtree_free_pt handler,
+    void *data);
+
+#if (NGX_RBTREE_RANK)
+//key小于key的节点个数，[lo, hi]里的节点个数是rank(hi + 1) - rank(lo)
+ngx_uint_t ngx_rbtree_rank(ngx_rbtree_t *tree, ngx_rbtree_key_t key);
+//中序遍历的第k个节点(从0开始)，k >= 节点总数时返回NULL
+ngx_rbtree_node_t *ngx_rbtree_select(ngx_rbtree_t *tree, ngx_uint_t k);
+//节点总数
+#define ngx_rbtree_size(tree)           ((tree)->root->size)
+#endif
 
 #define ngx_rbt_red(node)               ((node)->color = 1)
 #define ngx_rbt_black(node)             ((node)->color = 0)
@@ -119,7 +176,11 @@ ngx_rbtree_node_t *ngx_rbtree_next(ngx_rbtree_t *tree, ngx_rbtree_node_t *node);
 #define ngx_rbt_copy_color(n1, n2)      (n1->color = n2->color)
 
 /* a sentinel must be black */
+#if (NGX_RBTREE_RANK)
+#define ngx_rbtree_sentinel_init(node) ngx_rbt_black(node); (node)->size = 0;
+#else
 #define ngx_rbtree_sentinel_init(node) ngx_rbt_black(node);
+#endif
 
 //找到最左值，一直遍历到哨兵节点
 static ngx_inline ngx_rbtree_node_t *
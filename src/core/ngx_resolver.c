@@ -111,6 +111,7 @@ static ngx_int_t ngx_tcp_connect(ngx_resolver_connection_t *rec);
 
 static void ngx_resolver_cleanup(void *data);
 static void ngx_resolver_cleanup_tree(ngx_resolver_t *r, ngx_rbtree_t *tree);
+static void ngx_resolver_cleanup_node(ngx_rbtree_node_t *node, void *data);
 static ngx_int_t ngx_resolve_name_locked(ngx_resolver_t *r,
                                          ngx_resolver_ctx_t *ctx, ngx_str_t *name);
 static void ngx_resolver_expire(ngx_resolver_t *r, ngx_rbtree_t *tree,
@@ -396,34 +397,39 @@ ngx_resolver_cleanup(void *data)
 static void
 ngx_resolver_cleanup_tree(ngx_resolver_t *r, ngx_rbtree_t *tree)
 {
-    ngx_resolver_ctx_t   *ctx, *next;
-    ngx_resolver_node_t  *rn;
+    //整棵树都要释放，直接拆掉，不用一个个删除再调整
+    ngx_rbtree_destroy(tree, ngx_resolver_cleanup_node, r);
+}
 
-    while (tree->root != tree->sentinel) {
 
-        rn = ngx_resolver_node(ngx_rbtree_min(tree->root, tree->sentinel));
+static void
+ngx_resolver_cleanup_node(ngx_rbtree_node_t *node, void *data)
+{
+    ngx_resolver_t       *r = data;
 
-        ngx_queue_remove(&rn->queue);
+    ngx_resolver_ctx_t   *ctx, *next;
+    ngx_resolver_node_t  *rn;
 
-        for (ctx = rn->waiting; ctx; ctx = next) {
-            next = ctx->next;
+    rn = ngx_resolver_node(node);
 
-            //删除定时器
-            if (ctx->event) {
-                if (ctx->event->timer_set) {
-                    ngx_del_timer(ctx->event);
-                }
+    ngx_queue_remove(&rn->queue);
+
+    for (ctx = rn->waiting; ctx; ctx = next) {
+        next = ctx->next;
 
-                ngx_resolver_free(r, ctx->event);
+        //删除定时器
+        if (ctx->event) {
+            if (ctx->event->timer_set) {
+                ngx_del_timer(ctx->event);
             }
 
-            ngx_resolver_free(r, ctx);
+            ngx_resolver_free(r, ctx->event);
         }
 
-        ngx_rbtree_delete(tree, &rn->node);
-
-        ngx_resolver_free_node(r, rn);
+        ngx_resolver_free(r, ctx);
     }
+
+    ngx_resolver_free_node(r, rn);
 }
 
 // 初始化域名解析上下文ngx_resolver_ctx_t
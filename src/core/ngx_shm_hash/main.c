@@ -0,0 +1,210 @@
+//
+// Created by daemon.xie on 2026/10/17.
+//
+// ngx_shm_hash和共享内存里常用的ngx_str_rbtree_lookup方式对比
+// 两边的节点都从同样大小的slab pool里分配，key是"key-%08x"，hash用ngx_murmur_hash2
+//
+
+#include <stdio.h>
+#include <time.h>
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+#define NGX_BENCH_POOL_SIZE  (512 * 1024 * 1024)
+
+typedef struct {
+    ngx_shm_hash_node_t sn;
+    u_char data[16];
+} ngx_bench_hash_node_t;
+
+typedef struct {
+    ngx_str_node_t sn;
+    u_char data[16];
+} ngx_bench_tree_node_t;
+
+ngx_log_t ngx_log;
+
+ngx_slab_pool_t *bench_pool(u_char *mem);
+double bench_now(void);
+void bench_tree(ngx_uint_t n, uint32_t *keys);
+void bench_hash(ngx_uint_t n, uint32_t *keys);
+
+void ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err, const char *fmt, ...)
+{
+}
+
+int main(/* int argc, char **argv */)
+{
+    ngx_uint_t i, n;
+    uint32_t *keys;
+
+    //这几个变量平时由ngx_os_init设置
+    ngx_pagesize = getpagesize();
+    for (n = ngx_pagesize, ngx_pagesize_shift = 0; n >>= 1; ngx_pagesize_shift++) { /* void */ }
+    ngx_ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    ngx_cacheline_size = 64;
+
+    for (n = 10000; n <= 1000000; n *= 10) {
+        keys = malloc(n * sizeof(uint32_t));
+
+        //乱序的key，查找顺序和插入顺序不同
+        for (i = 0; i < n; i++) {
+            keys[i] = (uint32_t) i * 2654435761u;
+        }
+
+        printf("--------------------------------\n");
+        printf("%lu keys:\n", (unsigned long) n);
+        printf("--------------------------------\n");
+
+        bench_tree(n, keys);
+        bench_hash(n, keys);
+
+        free(keys);
+    }
+
+    return 0;
+}
+
+ngx_slab_pool_t *bench_pool(u_char *mem)
+{
+    ngx_slab_pool_t *sp;
+
+    sp = (ngx_slab_pool_t *) mem;
+    sp->end = mem + NGX_BENCH_POOL_SIZE;
+    sp->min_shift = 3;
+    sp->addr = mem;
+
+    if (ngx_shmtx_create(&sp->mutex, &sp->lock, NULL) != NGX_OK) {
+        return NULL;
+    }
+
+    ngx_slab_init(sp);
+
+    return sp;
+}
+
+double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+//shm中的rbtree用法: 整个zone一把锁，ngx_str_rbtree_lookup查找
+void bench_tree(ngx_uint_t n, uint32_t *keys)
+{
+    u_char *mem;
+    uint32_t hash;
+    ngx_str_t name;
+    ngx_uint_t i, found;
+    double start, t, worst, insert;
+    ngx_rbtree_t tree;
+    ngx_rbtree_node_t sentinel;
+    ngx_slab_pool_t *sp;
+    ngx_bench_tree_node_t *node;
+    u_char buf[16];
+
+    mem = ngx_memalign(ngx_pagesize, NGX_BENCH_POOL_SIZE, &ngx_log);
+    sp = bench_pool(mem);
+
+    ngx_rbtree_init(&tree, &sentinel, ngx_str_rbtree_insert_value);
+
+    worst = 0;
+    start = bench_now();
+
+    for (i = 0; i < n; i++) {
+        t = bench_now();
+
+        ngx_shmtx_lock(&sp->mutex);
+
+        node = ngx_slab_alloc_locked(sp, sizeof(ngx_bench_tree_node_t));
+        node->sn.str.data = node->data;
+        node->sn.str.len = ngx_sprintf(node->data, "key-%08xD", keys[i]) - node->data;
+        node->sn.node.key = ngx_murmur_hash2(node->data, node->sn.str.len);
+        ngx_rbtree_insert(&tree, &node->sn.node);
+
+        ngx_shmtx_unlock(&sp->mutex);
+
+        worst = ngx_max(worst, bench_now() - t);
+    }
+
+    insert = (bench_now() - start) / n;
+
+    found = 0;
+    start = bench_now();
+
+    for (i = n; i--; ) {
+        name.data = buf;
+        name.len = ngx_sprintf(buf, "key-%08xD", keys[i]) - buf;
+        hash = ngx_murmur_hash2(buf, name.len);
+
+        ngx_shmtx_lock(&sp->mutex);
+        found += ngx_str_rbtree_lookup(&tree, &name, hash) != NULL;
+        ngx_shmtx_unlock(&sp->mutex);
+    }
+
+    printf("rbtree    insert = %6.1f ns (worst %8.0f ns) lookup = %6.1f ns found = %lu\n",
+           insert, worst, (bench_now() - start) / n, (unsigned long) found);
+
+    ngx_free(mem);
+}
+
+//ngx_shm_hash: 按桶加锁，扩容在写操作之后分摊完成
+void bench_hash(ngx_uint_t n, uint32_t *keys)
+{
+    u_char *mem;
+    uint32_t hash;
+    ngx_str_t name;
+    ngx_uint_t i, found;
+    double start, t, worst, insert;
+    ngx_shm_hash_t *h;
+    ngx_slab_pool_t *sp;
+    ngx_bench_hash_node_t *node;
+    u_char buf[16];
+
+    mem = ngx_memalign(ngx_pagesize, NGX_BENCH_POOL_SIZE, &ngx_log);
+    sp = bench_pool(mem);
+
+    h = ngx_shm_hash_create(sp, 64);
+
+    worst = 0;
+    start = bench_now();
+
+    for (i = 0; i < n; i++) {
+        t = bench_now();
+
+        node = ngx_slab_alloc(sp, sizeof(ngx_bench_hash_node_t));
+        node->sn.str.data = node->data;
+        node->sn.str.len = ngx_sprintf(node->data, "key-%08xD", keys[i]) - node->data;
+        node->sn.hash = ngx_murmur_hash2(node->data, node->sn.str.len);
+
+        ngx_shm_hash_wlock(h, node->sn.hash);
+        ngx_shm_hash_insert(h, &node->sn);
+        ngx_shm_hash_unlock(h, node->sn.hash);
+
+        worst = ngx_max(worst, bench_now() - t);
+    }
+
+    insert = (bench_now() - start) / n;
+
+    found = 0;
+    start = bench_now();
+
+    for (i = n; i--; ) {
+        name.data = buf;
+        name.len = ngx_sprintf(buf, "key-%08xD", keys[i]) - buf;
+        hash = ngx_murmur_hash2(buf, name.len);
+
+        ngx_shm_hash_rlock(h, hash);
+        found += ngx_shm_hash_lookup(h, &name, hash) != NULL;
+        ngx_shm_hash_unlock(h, hash);
+    }
+
+    printf("shm_hash  insert = %6.1f ns (worst %8.0f ns) lookup = %6.1f ns found = %lu buckets = %lu\n",
+           insert, worst, (bench_now() - start) / n, (unsigned long) found,
+           (unsigned long) (h->mask + 1));
+
+    ngx_free(mem);
+}
@@ -0,0 +1,231 @@
+/*
+* @author:    daemon.xie
+* @license:   Apache Licence
+* @contact:   xieyugui
+* @software:  CLion
+* @file:      ngx_shm_hash.c
+* @date:      2026/10/17 上午10:12
+* @desc:
+*/
+
+//
+// Created by daemon.xie on 2026/10/17.
+//
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+static void ngx_shm_hash_lock_all(ngx_shm_hash_t *h);
+static void ngx_shm_hash_unlock_all(ngx_shm_hash_t *h);
+static void ngx_shm_hash_grow(ngx_shm_hash_t *h);
+static void ngx_shm_hash_move(ngx_shm_hash_t *h, ngx_uint_t n);
+
+
+ngx_shm_hash_t *
+ngx_shm_hash_create(ngx_slab_pool_t *shpool, ngx_uint_t size)
+{
+    ngx_uint_t n;
+    ngx_shm_hash_t *h;
+
+    for (n = NGX_SHM_HASH_STRIPES; n < size; n <<= 1) { /* void */ }
+
+    h = ngx_slab_calloc(shpool, sizeof(ngx_shm_hash_t));
+    if (h == NULL) {
+        return NULL;
+    }
+
+    h->buckets = ngx_slab_calloc(shpool, n * sizeof(ngx_shm_hash_node_t *));
+    if (h->buckets == NULL) {
+        ngx_slab_free(shpool, h);
+        return NULL;
+    }
+
+    h->mask = n - 1;
+    h->shpool = shpool;
+
+    return h;
+}
+
+
+//持有hash对应的锁时调用，旧桶还没搬走就在旧表里找
+static ngx_inline ngx_shm_hash_node_t **
+ngx_shm_hash_bucket(ngx_shm_hash_t *h, uint32_t hash)
+{
+    if (h->old && (hash & h->old_mask) >= h->rehash) {
+        return &h->old[hash & h->old_mask];
+    }
+
+    return &h->buckets[hash & h->mask];
+}
+
+
+ngx_shm_hash_node_t *
+ngx_shm_hash_lookup(ngx_shm_hash_t *h, ngx_str_t *name, uint32_t hash)
+{
+    ngx_shm_hash_node_t *node;
+
+    for (node = *ngx_shm_hash_bucket(h, hash); node; node = node->next) {
+
+        if (node->hash == hash
+            && node->str.len == name->len
+            && ngx_memcmp(node->str.data, name->data, name->len) == 0)
+        {
+            return node;
+        }
+    }
+
+    return NULL;
+}
+
+
+void
+ngx_shm_hash_insert(ngx_shm_hash_t *h, ngx_shm_hash_node_t *node)
+{
+    ngx_shm_hash_node_t **bucket;
+
+    bucket = ngx_shm_hash_bucket(h, node->hash);
+
+    node->next = *bucket;
+    *bucket = node;
+
+    (void) ngx_atomic_fetch_add(&h->nelts, 1);
+}
+
+
+void
+ngx_shm_hash_delete(ngx_shm_hash_t *h, ngx_shm_hash_node_t *node)
+{
+    ngx_shm_hash_node_t **p;
+
+    for (p = ngx_shm_hash_bucket(h, node->hash); *p; p = &(*p)->next) {
+
+        if (*p == node) {
+            *p = node->next;
+            (void) ngx_atomic_fetch_add(&h->nelts, -1);
+            return;
+        }
+    }
+}
+
+
+/*
+ * 先释放桶的锁再做扩容相关的事，这样扩容时拿别的锁不会和调用方持有的锁形成死锁。
+ * nelts和old在这里不加锁读，只是判断要不要去抢resize，读到旧值最多是晚一次开始
+ */
+void
+ngx_shm_hash_unlock(ngx_shm_hash_t *h, uint32_t hash)
+{
+    ngx_rwlock_unlock(&h->stripes[hash & (NGX_SHM_HASH_STRIPES - 1)].lock);
+
+    if (h->old == NULL && h->nelts <= (h->mask + 1) * NGX_SHM_HASH_LOAD) {
+        return;
+    }
+
+    if (!ngx_trylock(&h->resize)) {
+        return;
+    }
+
+    if (h->old) {
+        ngx_shm_hash_move(h, NGX_SHM_HASH_REHASH_STEP);
+
+    } else if (h->nelts > (h->mask + 1) * NGX_SHM_HASH_LOAD) {
+        ngx_shm_hash_grow(h);
+    }
+
+    ngx_unlock(&h->resize);
+}
+
+
+//按下标顺序加锁，只有持有resize的进程会这样做，不会和单个桶的锁交叉
+static void
+ngx_shm_hash_lock_all(ngx_shm_hash_t *h)
+{
+    ngx_uint_t i;
+
+    for (i = 0; i < NGX_SHM_HASH_STRIPES; i++) {
+        ngx_rwlock_wlock(&h->stripes[i].lock);
+    }
+}
+
+
+static void
+ngx_shm_hash_unlock_all(ngx_shm_hash_t *h)
+{
+    ngx_uint_t i;
+
+    for (i = 0; i < NGX_SHM_HASH_STRIPES; i++) {
+        ngx_rwlock_unlock(&h->stripes[i].lock);
+    }
+}
+
+
+/*
+ * 只分配新表并切换指针，不搬任何元素，所以持有全部锁的时间和元素个数无关。
+ * 分配失败就继续用旧表，链表会变长但不影响正确性
+ */
+static void
+ngx_shm_hash_grow(ngx_shm_hash_t *h)
+{
+    ngx_uint_t size;
+    ngx_shm_hash_node_t **buckets;
+
+    size = (h->mask + 1) * 2;
+
+    buckets = ngx_slab_calloc(h->shpool, size * sizeof(ngx_shm_hash_node_t *));
+    if (buckets == NULL) {
+        return;
+    }
+
+    ngx_shm_hash_lock_all(h);
+
+    h->old = h->buckets;
+    h->old_mask = h->mask;
+    h->rehash = 0;
+
+    h->buckets = buckets;
+    h->mask = size - 1;
+
+    ngx_shm_hash_unlock_all(h);
+}
+
+
+//从旧表中搬n个桶到新表，旧表搬完后释放
+static void
+ngx_shm_hash_move(ngx_shm_hash_t *h, ngx_uint_t n)
+{
+    ngx_uint_t b;
+    ngx_atomic_t *lock;
+    ngx_shm_hash_node_t *node, *next, **old;
+
+    while (n-- && h->rehash <= h->old_mask) {
+        b = h->rehash;
+        lock = &h->stripes[b & (NGX_SHM_HASH_STRIPES - 1)].lock;
+
+        ngx_rwlock_wlock(lock);
+
+        for (node = h->old[b]; node; node = next) {
+            next = node->next;
+            node->next = h->buckets[node->hash & h->mask];
+            h->buckets[node->hash & h->mask] = node;
+        }
+
+        h->old[b] = NULL;
+        h->rehash = b + 1;
+
+        ngx_rwlock_unlock(lock);
+    }
+
+    if (h->rehash <= h->old_mask) {
+        return;
+    }
+
+    ngx_shm_hash_lock_all(h);
+
+    old = h->old;
+    h->old = NULL;
+
+    ngx_shm_hash_unlock_all(h);
+
+    ngx_slab_free(h->shpool, old);
+}
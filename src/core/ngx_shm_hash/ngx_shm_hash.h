@@ -0,0 +1,85 @@
+/*
+* @author:    daemon.xie
+* @license:   Apache Licence
+* @contact:   xieyugui
+* @software:  CLion
+* @file:      ngx_shm_hash.h
+* @date:      2026/10/17 上午10:12
+* @desc:
+ * 共享内存中可以在运行时增删的hash表，桶数组和节点都从ngx_slab_pool_t中分配
+ * 用法和ngx_str_rbtree_lookup差不多，节点结构体以ngx_shm_hash_node_t开头，由调用方分配和释放
+*/
+
+//
+// Created by daemon.xie on 2026/10/17.
+//
+
+#ifndef NGX_SHM_HASH_NGX_SHM_HASH_H
+#define NGX_SHM_HASH_NGX_SHM_HASH_H
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+//锁的个数，桶i由stripes[i & (NGX_SHM_HASH_STRIPES - 1)]保护，桶数总是它的整数倍
+#define NGX_SHM_HASH_STRIPES      64
+//平均每个桶的元素个数超过这个值就开始扩容
+#define NGX_SHM_HASH_LOAD         2
+//每次ngx_shm_hash_unlock最多搬多少个旧桶
+#define NGX_SHM_HASH_REHASH_STEP  16
+
+typedef struct ngx_shm_hash_node_s ngx_shm_hash_node_t;
+
+struct ngx_shm_hash_node_s {
+    ngx_shm_hash_node_t *next;
+    uint32_t hash; //调用方算好的hash，扩容搬桶时也用它
+    ngx_str_t str;
+};
+
+//每把锁占一个cache line，避免不同的锁互相干扰
+typedef struct {
+    ngx_atomic_t lock;
+    u_char pad[64 - sizeof(ngx_atomic_t)];
+} ngx_shm_hash_stripe_t;
+
+/*
+ * 扩容是渐进的: 新表是旧表的两倍，旧表中[0, rehash)的桶已经搬到新表，
+ * 旧桶b只会拆到新桶b和b + 旧表大小，三个桶落在同一把锁上，所以搬一个桶只需要持有一把锁。
+ * buckets/old/mask只在持有全部锁时修改，持有任意一把锁时读到的都是一致的
+ */
+typedef struct {
+    ngx_shm_hash_node_t **buckets;
+    ngx_shm_hash_node_t **old; //正在扩容时的旧表，否则为NULL
+    ngx_uint_t mask;           //buckets个数 - 1
+    ngx_uint_t old_mask;
+    ngx_uint_t rehash;         //旧表中下一个要搬的桶
+
+    ngx_atomic_t nelts;
+    ngx_atomic_t resize;       //同一时刻只有一个进程扩容或搬桶，用trylock，拿不到就不做
+
+    ngx_slab_pool_t *shpool;
+
+    ngx_shm_hash_stripe_t stripes[NGX_SHM_HASH_STRIPES];
+} ngx_shm_hash_t;
+
+//在shpool中创建hash表，size是初始桶数，会向上取成2的幂并且不小于NGX_SHM_HASH_STRIPES
+ngx_shm_hash_t *ngx_shm_hash_create(ngx_slab_pool_t *shpool, ngx_uint_t size);
+
+/*
+ * 查找、插入、删除之前要先用ngx_shm_hash_rlock/wlock锁住hash对应的桶，之后ngx_shm_hash_unlock；
+ * 同一时刻只能持有一个桶的锁。unlock之后顺便推进扩容，所以扩容的代价分摊到每次写操作上
+ */
+#define ngx_shm_hash_rlock(h, hash)                                           \
+    ngx_rwlock_rlock(&(h)->stripes[(hash) & (NGX_SHM_HASH_STRIPES - 1)].lock)
+#define ngx_shm_hash_wlock(h, hash)                                           \
+    ngx_rwlock_wlock(&(h)->stripes[(hash) & (NGX_SHM_HASH_STRIPES - 1)].lock)
+
+void ngx_shm_hash_unlock(ngx_shm_hash_t *h, uint32_t hash);
+
+ngx_shm_hash_node_t *ngx_shm_hash_lookup(ngx_shm_hash_t *h, ngx_str_t *name,
+    uint32_t hash);
+//node->hash和node->str由调用方设置好，不检查重复
+void ngx_shm_hash_insert(ngx_shm_hash_t *h, ngx_shm_hash_node_t *node);
+//只把node从表中摘下来，node本身由调用方释放
+void ngx_shm_hash_delete(ngx_shm_hash_t *h, ngx_shm_hash_node_t *node);
+
+#endif //NGX_SHM_HASH_NGX_SHM_HASH_H
@@ -57,6 +57,13 @@
 
 #endif
 
+//fine时NGX_SLAB_BIG页的slab低位存的是slot下标而不是shift
+#define NGX_SLAB_SLOT_MASK   0xff
+//NGX_SLAB_BIG页的slab高位中能用作bitmap的位数，决定了一页最多能切多少个chunk
+#define NGX_SLAB_MAP_BITS    (8 * sizeof(uintptr_t) - NGX_SLAB_MAP_SHIFT)
+//fine时最多的分级数
+#define NGX_SLAB_FINE_MAX    64
+
 #define ngx_slab_slots(pool)                                                  \
     (ngx_slab_page_t *) ((u_char *) (pool) + sizeof(ngx_slab_pool_t)) //可用内存开始
 
@@ -94,6 +101,63 @@ static void ngx_slab_free_pages(ngx_slab_pool_t *pool, ngx_slab_page_t *page,
                                 ngx_uint_t pages);
 static void ngx_slab_error(ngx_slab_pool_t *pool, ngx_uint_t level,
                            char *text);
+static ngx_uint_t ngx_slab_fine_classes(size_t *sizes);
+static uintptr_t ngx_slab_alloc_fine(ngx_slab_pool_t *pool, ngx_uint_t slot);
+static void ngx_slab_free_insert(ngx_slab_pool_t *pool, ngx_slab_page_t *page);
+static void ngx_slab_free_remove(ngx_slab_pool_t *pool, ngx_slab_page_t *page);
+static void *ngx_slab_alloc_reclaim(ngx_slab_pool_t *pool, size_t size);
+static ngx_inline ngx_uint_t ngx_slab_reclaim_find(ngx_slab_pool_t *pool);
+static size_t ngx_slab_reclaim_call(ngx_slab_pool_t *pool, size_t size);
+static void ngx_slab_reclaim_delete(ngx_slab_pool_t *pool);
+static void ngx_slab_trace_alloc(ngx_slab_pool_t *pool, size_t size,
+    uintptr_t p);
+static void ngx_slab_trace_lat(ngx_slab_trace_lat_t *lat, uint64_t ns);
+
+/*
+ * worker进程私有的一个slot的chunk缓存，chunks当作栈使用，
+ * 后放进去的先取出来，刚释放的chunk还在cpu cache里
+ */
+typedef struct {
+    ngx_uint_t            n; //当前缓存的chunk个数
+    void                **chunks;
+} ngx_slab_magazine_t;
+
+//一块共享内存在本进程中的chunk缓存
+typedef struct {
+    ngx_slab_pool_t      *pool;
+    ngx_uint_t            size; //每个slot最多缓存的chunk个数
+    ngx_uint_t            batch; //每次加锁补充或归还的chunk个数
+    ngx_uint_t            nslots;
+    ngx_slab_magazine_t  *slots;
+    ngx_uint_t            locks; //加锁次数，调试日志用
+    ngx_uint_t            ops; //经过缓存的分配和释放次数
+} ngx_slab_magazine_zone_t;
+
+static void ngx_slab_magazine_refill(ngx_slab_pool_t *pool,
+    ngx_slab_magazine_zone_t *mz, ngx_slab_magazine_t *mag, ngx_uint_t slot);
+static void ngx_slab_magazine_drain(ngx_slab_pool_t *pool,
+    ngx_slab_magazine_zone_t *mz, ngx_slab_magazine_t *mag, ngx_uint_t n);
+
+/*
+ * 共享内存一般只有几块，线性查找就够了；
+ * 这是进程内的静态变量，每个worker各有一份，不需要加锁
+ */
+static ngx_slab_magazine_zone_t  ngx_slab_magazines[NGX_SLAB_MAGAZINE_ZONES];
+static ngx_uint_t                ngx_slab_nmagazines;
+
+/*
+ * 本进程登记的回收回调，和chunk缓存一样是进程内的静态变量；
+ * 不能放进共享内存：reload后旧worker会拿到新周期设置的data，那块内存它没有映射，
+ * 动态模块重新加载到别的地址时函数指针也会失效
+ */
+typedef struct {
+    ngx_slab_pool_t      *pool;
+    ngx_slab_reclaim_pt   handler;
+    void                 *data;
+} ngx_slab_reclaimer_t;
+
+static ngx_slab_reclaimer_t  ngx_slab_reclaimers[NGX_SLAB_RECLAIM_HANDLERS];
+static ngx_uint_t            ngx_slab_nreclaimers;
 
 //slab页面的大小,32位Linux中为4k,
 //设置ngx_slab_max_size = 2048B。如果一个页要存放多个obj，则obj size要小于这个数值
@@ -109,13 +173,96 @@ static ngx_uint_t  ngx_slab_exact_size;
 //每个slot块大小的位移是ngx_slab_exact_shift
 static ngx_uint_t  ngx_slab_exact_shift;//ngx_slab_exact_shift = 7，即128的位表示 2的7次方
 
+
+//查找pool在本进程中的chunk缓存，没有开启时返回NULL
+static ngx_inline ngx_slab_magazine_zone_t *
+ngx_slab_magazine_find(ngx_slab_pool_t *pool)
+{
+    ngx_uint_t  i;
+
+    for (i = 0; i < ngx_slab_nmagazines; i++) {
+        if (ngx_slab_magazines[i].pool == pool) {
+            return &ngx_slab_magazines[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+//pool在本进程中有没有登记回收回调
+static ngx_inline ngx_uint_t
+ngx_slab_reclaim_find(ngx_slab_pool_t *pool)
+{
+    ngx_uint_t  i;
+
+    for (i = 0; i < ngx_slab_nreclaimers; i++) {
+        if (ngx_slab_reclaimers[i].pool == pool) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+//单调时间，纳秒，只用来算锁的等待和持有时间
+static ngx_inline uint64_t
+ngx_slab_trace_now(void)
+{
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/*
+ * 加锁，开启了跟踪时记录等待时间，返回拿到锁的时间，传给ngx_slab_unlock算持有时间
+ * 等待时间是拿到锁之后才记的，所以也是在锁里更新
+ */
+static ngx_inline uint64_t
+ngx_slab_lock(ngx_slab_pool_t *pool)
+{
+    uint64_t  start, now;
+
+    if (pool->trace_info == NULL) {
+        ngx_shmtx_lock(&pool->mutex);
+        return 0;
+    }
+
+    start = ngx_slab_trace_now();
+
+    ngx_shmtx_lock(&pool->mutex);
+
+    now = ngx_slab_trace_now();
+
+    ngx_slab_trace_lat(&pool->trace_info->wait, now - start);
+
+    return now;
+}
+
+
+static ngx_inline void
+ngx_slab_unlock(ngx_slab_pool_t *pool, uint64_t locked)
+{
+    if (pool->trace_info) {
+        ngx_slab_trace_lat(&pool->trace_info->hold,
+                           ngx_slab_trace_now() - locked);
+    }
+
+    ngx_shmtx_unlock(&pool->mutex);
+}
+
+
 void
 ngx_slab_init(ngx_slab_pool_t *pool)
 {
     u_char *p;
-    size_t size;
+    size_t size, sizes[NGX_SLAB_FINE_MAX];
     ngx_int_t m;
-    ngx_uint_t i, n, pages;
+    ngx_uint_t i, j, k = 0, n, pages;
     ngx_slab_page_t *slots, *page;
     /*
     假设每个page是4KB
@@ -153,6 +300,17 @@ ngx_slab_init(ngx_slab_pool_t *pool)
     /*从最小块大小到页大小之间的分级数*/
     n = ngx_pagesize_shift - pool->min_shift; //12-3=9
 
+    /*
+     * fine时不大于ngx_slab_exact_size的slot不变，之后换成ngx_slab_fine_classes算出的分级，
+     * 所以slot下标 shift - min_shift 对小块内存仍然成立
+     */
+    if (pool->fine) {
+        k = ngx_slab_fine_classes(sizes);
+        n = ngx_slab_exact_shift - pool->min_shift + 1 + k;
+    }
+
+    pool->nslots = n;
+
     /*
     这些slab page是给大小为8，16，32，64，128，256，512，1024，2048byte的内存块 这些slab page的位置是在pool->pages的前面初始化
     共享内存的其实地址开始处数据:ngx_slab_pool_t + 9 * sizeof(ngx_slab_page_t)(slots_m[]) + pages * sizeof(ngx_slab_page_t)(pages_m[]) +pages*ngx_pagesize(这是实际的数据部分，
@@ -172,13 +330,73 @@ ngx_slab_init(ngx_slab_pool_t *pool)
     pool->stats = (ngx_slab_stat_t *) p;
     ngx_memzero(pool->stats, n * sizeof(ngx_slab_stat_t));
 
+    for (i = 0; i < n; i++) {
+        pool->stats[i].size = (size_t) 1 << (i + pool->min_shift);
+    }
+
     //将p移动n*sizeof(ngx_slab_stat_t)个字节,指向m_page数组
     p += n * sizeof(ngx_slab_stat_t);
 
     size -= n * (sizeof(ngx_slab_page_t) + sizeof(ngx_slab_stat_t));
 
+    pool->lookup = NULL;
+
+    if (pool->fine) {
+        i = ngx_slab_exact_shift - pool->min_shift + 1;
+
+        for (j = 0; j < k; j++) {
+            pool->stats[i + j].size = sizes[j];
+        }
+
+        /*
+         * 查找表，下标 (size - 1) >> min_shift，值为能容纳该下标所有请求的最小分级，
+         * 只有大于ngx_slab_exact_size的部分会用到
+         */
+        pool->lookup = p;
+        m = ngx_slab_max_size >> pool->min_shift;
+
+        for (j = 0, i = ngx_slab_exact_shift - pool->min_shift + 1;
+             j < (ngx_uint_t) m;
+             j++)
+        {
+            while (i < n - 1
+                   && pool->stats[i].size < ((size_t) (j + 1) << pool->min_shift))
+            {
+                i++;
+            }
+
+            p[j] = (u_char) i;
+        }
+
+        p = ngx_align_ptr(p + m, sizeof(uintptr_t));
+        size = pool->end - p;
+    }
+
+    pool->trace_info = NULL;
+    pool->occupancy = NULL;
+
+    if (pool->trace) {
+        //跟踪信息和请求大小直方图紧跟在stats(lookup)后面
+        pool->trace_info = (ngx_slab_trace_t *) p;
+        ngx_memzero(pool->trace_info, sizeof(ngx_slab_trace_t));
+
+        p += sizeof(ngx_slab_trace_t);
+
+        pool->trace_info->magic = NGX_SLAB_TRACE_MAGIC;
+        pool->trace_info->version = NGX_SLAB_TRACE_VERSION;
+        pool->trace_info->max_size = ngx_slab_max_size;
+        pool->trace_info->sizes_off = p - (u_char *) pool->addr;
+
+        ngx_memzero(p, (ngx_slab_max_size + 1) * sizeof(ngx_uint_t));
+        p += (ngx_slab_max_size + 1) * sizeof(ngx_uint_t);
+
+        size = pool->end - p;
+    }
+
     //计算一共能够保存多个页，加上ngx_slab_page_t，是因为每一页都会有一个ngx_slab_page_t来表示相关信息
-    pages = (ngx_uint_t) (size / (ngx_pagesize + sizeof(ngx_slab_page_t)));
+    //开启跟踪时每页还有一个uint16_t的occupancy
+    pages = (ngx_uint_t) (size / (ngx_pagesize + sizeof(ngx_slab_page_t)
+                                  + (pool->trace ? sizeof(uint16_t) : 0)));
 
     //指向m_page数组
     pool->pages = (ngx_slab_page_t *) p;
@@ -188,19 +406,30 @@ ngx_slab_init(ngx_slab_pool_t *pool)
     page = pool->pages;
 
     /* only "next" is used in list head */
-    //初始化free，free.next是下次分配页时候的入口
-    pool->free.slab = 0;
-    pool->free.next = page;
-    pool->free.prev = 0;
+    //初始化free，所有链表都为空
+    for (i = 0; i < NGX_SLAB_FREE_LISTS; i++) {
+        pool->free[i].slab = 0;
+        pool->free[i].next = &pool->free[i];
+        pool->free[i].prev = 0;
+    }
 
-    //更新第一个slab page的状态，这儿slab成员记录了整个缓存区的页数目
-    page->slab = pages; //第一个pages->slab指定了共享内存中除去头部外剩余页的个数
-    page->next = &pool->free;
-    page->prev = (uintptr_t) &pool->free;
+    pool->free_map = 0;
+    pool->nruns = 0;
+
+    p += pages * sizeof(ngx_slab_page_t);
+
+    //occupancy放在m_page数组后面
+    if (pool->trace) {
+        pool->occupancy = (uint16_t *) p;
+        ngx_memzero(p, pages * sizeof(uint16_t));
+
+        pool->trace_info->pages_off = p - (u_char *) pool->addr;
+
+        p += pages * sizeof(uint16_t);
+    }
 
     //因为对齐的原因,使得m_page数组和数据区域之间可能有些内存无法使用    ++++按照ngx_pagesize 页大小对齐
-    pool->start = ngx_align_ptr(p + pages * sizeof(ngx_slab_page_t),
-                                ngx_pagesize);
+    pool->start = ngx_align_ptr(p, ngx_pagesize);
 
 
     //由于内存对齐操作(pool->start处内存对齐),可能导致pages减少,
@@ -208,13 +437,28 @@ ngx_slab_init(ngx_slab_pool_t *pool)
     m = pages - (pool->end - pool->start) / ngx_pagesize;
     if (m > 0) {
         pages -= m;
-        page->slab = pages;
     }
 
+    //更新第一个slab page的状态，这儿slab成员记录了整个缓存区的页数目
+    page->slab = pages; //第一个pages->slab指定了共享内存中除去头部外剩余页的个数
+    ngx_slab_free_insert(pool, page);
+
     //跳过pages * sizeof(ngx_slab_page_t)，也就是指向实际的数据页pages*ngx_pagesize
     pool->last = pool->pages + pages; //指向最后一块内存首地址
     pool->pfree = pages; //空闲页数
 
+    if (pool->trace) {
+        pool->trace_info->npages = pages;
+        pool->trace_info->pfree_min = pages;
+    }
+
+    //新初始化的共享内存可能映射在已经释放的旧共享内存的地址上，旧的回调不能再用
+    ngx_slab_reclaim_delete(pool);
+
+    pool->reclaim_low = 0;
+    pool->reclaim_high = 0;
+    pool->reclaiming = 0;
+
     pool->log_nomem = 1;
     pool->log_ctx = &pool->zero;
     pool->zero = '\0';
@@ -224,13 +468,51 @@ ngx_slab_init(ngx_slab_pool_t *pool)
 void *
 ngx_slab_alloc(ngx_slab_pool_t *pool, size_t size)
 {
-    void  *p;
+    void                      *p;
+    size_t                     s;
+    uint64_t                   locked;
+    ngx_uint_t                 shift, slot;
+    ngx_slab_magazine_t       *mag;
+    ngx_slab_magazine_zone_t  *mz;
 
-    ngx_shmtx_lock(&pool->mutex);
+    mz = ngx_slab_magazine_find(pool);
+
+    //开启了chunk缓存，并且不是按页分配的，先从本进程的缓存里取
+    if (mz && size <= ngx_slab_max_size) {
+
+        //和ngx_slab_alloc_locked中一样计算所在的slot
+        if (pool->fine && size > ngx_slab_exact_size) {
+            slot = pool->lookup[(size - 1) >> pool->min_shift];
+
+        } else if (size > pool->min_size) {
+            shift = 1;
+            for (s = size - 1; s >>= 1; shift++) { /* void */ }
+            slot = shift - pool->min_shift;
+
+        } else {
+            slot = 0;
+        }
+
+        mag = &mz->slots[slot];
+
+        if (mag->n == 0) {
+            ngx_slab_magazine_refill(pool, mz, mag, slot);
+
+            if (mag->n == 0) {
+                return NULL;
+            }
+        }
+
+        mz->ops++;
+
+        return mag->chunks[--mag->n];
+    }
+
+    locked = ngx_slab_lock(pool);
 
     p = ngx_slab_alloc_locked(pool, size);
 
-    ngx_shmtx_unlock(&pool->mutex);
+    ngx_slab_unlock(pool, locked);
 
     return p;
 }
@@ -303,6 +585,11 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
     ngx_uint_t i, slot, shift, map;
     ngx_slab_page_t *page, *prev, *slots;
 
+    //本进程注册了回收回调，失败时先回收再重试
+    if (!pool->reclaiming && ngx_slab_reclaim_find(pool)) {
+        return ngx_slab_alloc_reclaim(pool, size);
+    }
+
     if (size > ngx_slab_max_size) {//如果是large obj, size >= 2048B
 
         ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
@@ -324,6 +611,21 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
         goto done;
     }
 
+    //更细的分级，按查找表找到slot，只会用到NGX_SLAB_BIG类型的页
+    if (pool->fine && size > ngx_slab_exact_size) {
+        slot = pool->lookup[(size - 1) >> pool->min_shift];
+
+        pool->stats[slot].reqs++;
+        pool->stats[slot].waste += pool->stats[slot].size - size;
+
+        ngx_log_debug2(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
+                       "slab alloc: %uz slot: %ui", size, slot);
+
+        p = ngx_slab_alloc_fine(pool, slot);
+
+        goto done;
+    }
+
     //申请内存小于一页
     //计算使用哪个slots[]，也就是需要分配的空间是多少  例如size=9,则会使用slot[1]，也就是16字节
     if (size > pool->min_size) {
@@ -340,6 +642,7 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
 
     //状态统计
     pool->stats[slot].reqs++;
+    pool->stats[slot].waste += ((size_t) 1 << shift) - size;
 
     ngx_log_debug2(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
                    "slab alloc: %uz slot: %ui", size, slot);
@@ -590,6 +893,10 @@ ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
 
 done:
 
+    if (pool->trace_info) {
+        ngx_slab_trace_alloc(pool, size, p);
+    }
+
     ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
                    "slab alloc: %p", (void *) p);
 
@@ -597,6 +904,205 @@ done:
 }
 
 
+/*
+ * 在锁里分配，失败时调用回收回调再重试，最多NGX_SLAB_RECLAIM_TRIES次
+ * 回收目标从size按页对齐开始，每次翻倍：释放的chunk不一定正好能凑出一个空闲页
+ * 中间失败的尝试不打印"no memory"，stats里的fails会记上
+ */
+static void *
+ngx_slab_alloc_reclaim(ngx_slab_pool_t *pool, size_t size)
+{
+    void        *p;
+    size_t       target;
+    ngx_uint_t   n, log_nomem;
+
+    pool->reclaiming = 1;
+
+    log_nomem = pool->log_nomem;
+    pool->log_nomem = 0;
+
+    target = ngx_align(size, ngx_pagesize);
+
+    for (n = 0; /* void */ ; n++) {
+
+        p = ngx_slab_alloc_locked(pool, size);
+
+        if (p || n == NGX_SLAB_RECLAIM_TRIES) {
+            break;
+        }
+
+        ngx_log_debug2(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
+                       "slab reclaim: %uz for %uz", target, size);
+
+        if (ngx_slab_reclaim_call(pool, target) == 0) {
+            break;
+        }
+
+        target <<= 1;
+    }
+
+    pool->log_nomem = log_nomem;
+    pool->reclaiming = 0;
+
+    if (p == NULL && log_nomem) {
+        ngx_slab_error(pool, NGX_LOG_CRIT,
+                       "ngx_slab_alloc() failed: no memory");
+    }
+
+    return p;
+}
+
+
+ngx_int_t
+ngx_slab_set_reclaim(ngx_slab_pool_t *pool, ngx_slab_reclaim_pt handler,
+    void *data, size_t low, size_t high)
+{
+    ngx_uint_t             i;
+    ngx_slab_reclaimer_t  *r;
+
+    if (handler == NULL) {
+        ngx_slab_reclaim_delete(pool);
+        return NGX_OK;
+    }
+
+    for (i = 0; i < ngx_slab_nreclaimers; i++) {
+        r = &ngx_slab_reclaimers[i];
+
+        if (r->pool == pool && r->handler == handler) {
+            r->data = data;
+            goto watermark;
+        }
+    }
+
+    if (ngx_slab_nreclaimers == NGX_SLAB_RECLAIM_HANDLERS) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                      "too many slab reclaim handlers");
+        return NGX_ERROR;
+    }
+
+    r = &ngx_slab_reclaimers[ngx_slab_nreclaimers++];
+
+    r->pool = pool;
+    r->handler = handler;
+    r->data = data;
+
+watermark:
+
+    if (low) {
+        ngx_shmtx_lock(&pool->mutex);
+
+        pool->reclaim_low = low >> ngx_pagesize_shift;
+        pool->reclaim_high = ngx_max(high, low) >> ngx_pagesize_shift;
+
+        ngx_shmtx_unlock(&pool->mutex);
+    }
+
+    return NGX_OK;
+}
+
+
+//按登记顺序调用pool的回收回调，释放够size或者都调用过一遍为止，已经持有pool->mutex
+static size_t
+ngx_slab_reclaim_call(ngx_slab_pool_t *pool, size_t size)
+{
+    size_t                 freed;
+    ngx_uint_t             i;
+    ngx_slab_reclaimer_t  *r;
+
+    freed = 0;
+
+    for (i = 0; i < ngx_slab_nreclaimers && freed < size; i++) {
+        r = &ngx_slab_reclaimers[i];
+
+        if (r->pool == pool) {
+            freed += r->handler(pool, size - freed, r->data);
+        }
+    }
+
+    return freed;
+}
+
+
+//删除本进程中pool上登记的所有回收回调，保持其余回调的登记顺序
+static void
+ngx_slab_reclaim_delete(ngx_slab_pool_t *pool)
+{
+    ngx_uint_t  i, n;
+
+    for (i = 0, n = 0; i < ngx_slab_nreclaimers; i++) {
+        if (ngx_slab_reclaimers[i].pool != pool) {
+            ngx_slab_reclaimers[n++] = ngx_slab_reclaimers[i];
+        }
+    }
+
+    ngx_slab_nreclaimers = n;
+}
+
+
+/*
+ * 后台回收，所有worker都会定时调用
+ * 先不加锁看一眼空闲页数，大部分时候不需要回收，不会争锁；
+ * 加锁后再检查一次，别的worker可能刚回收过
+ */
+size_t
+ngx_slab_reclaim(ngx_slab_pool_t *pool)
+{
+    size_t      size, freed;
+    uint64_t    locked;
+    ngx_uint_t  n;
+
+    if (pool->pfree >= pool->reclaim_low || !ngx_slab_reclaim_find(pool)) {
+        return 0;
+    }
+
+    freed = 0;
+
+    locked = ngx_slab_lock(pool);
+
+    pool->reclaiming = 1;
+
+    for (n = 0; n < NGX_SLAB_RECLAIM_TRIES; n++) {
+
+        if (pool->pfree >= pool->reclaim_high) {
+            break;
+        }
+
+        size = (pool->reclaim_high - pool->pfree) << ngx_pagesize_shift;
+
+        size = ngx_slab_reclaim_call(pool, size);
+        if (size == 0) {
+            break;
+        }
+
+        freed += size;
+    }
+
+    pool->reclaiming = 0;
+
+    ngx_slab_unlock(pool, locked);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
+                   "slab background reclaim: %uz, free pages: %ui",
+                   freed, pool->pfree);
+
+    return freed;
+}
+
+
+void *
+ngx_slab_calloc(ngx_slab_pool_t *pool, size_t size)
+{
+    void  *p;
+
+    p = ngx_slab_alloc(pool, size);
+    if (p) {
+        ngx_memzero(p, size);
+    }
+
+    return p;
+}
+
+
 void *
 ngx_slab_calloc_locked(ngx_slab_pool_t *pool, size_t size)
 {
@@ -614,11 +1120,66 @@ ngx_slab_calloc_locked(ngx_slab_pool_t *pool, size_t size)
 void
 ngx_slab_free(ngx_slab_pool_t *pool, void *p)
 {
-    ngx_shmtx_lock(&pool->mutex);
+    uint64_t                   locked;
+    ngx_uint_t                 slot;
+    ngx_slab_page_t           *page;
+    ngx_slab_magazine_t       *mag;
+    ngx_slab_magazine_zone_t  *mz;
+
+    mz = ngx_slab_magazine_find(pool);
+
+    if (mz && (u_char *) p >= pool->start && (u_char *) p < pool->end) {
+
+        /*
+         * chunk还在使用中，所在页的类型和slab中的shift(slot)都不会变，不加锁读也是安全的；
+         * 按页分配的内存不缓存
+         */
+        page = &pool->pages[((u_char *) p - pool->start) >> ngx_pagesize_shift];
+
+        switch (ngx_slab_page_type(page)) {
+
+        case NGX_SLAB_SMALL:
+            slot = (page->slab & NGX_SLAB_SHIFT_MASK) - pool->min_shift;
+            break;
+
+        case NGX_SLAB_BIG:
+            if (pool->fine) {
+                slot = page->slab & NGX_SLAB_SLOT_MASK;
+
+            } else {
+                slot = (page->slab & NGX_SLAB_SHIFT_MASK) - pool->min_shift;
+            }
+
+            break;
+
+        case NGX_SLAB_EXACT:
+            slot = ngx_slab_exact_shift - pool->min_shift;
+            break;
+
+        default:
+            slot = NGX_SLAB_SLOT_MASK + 1;
+        }
+
+        if (slot < mz->nslots) {
+            mag = &mz->slots[slot];
+
+            if (mag->n == mz->size) {
+                ngx_slab_magazine_drain(pool, mz, mag, mz->batch);
+            }
+
+            mz->ops++;
+
+            mag->chunks[mag->n++] = p;
+
+            return;
+        }
+    }
+
+    locked = ngx_slab_lock(pool);
 
     ngx_slab_free_locked(pool, p);
 
-    ngx_shmtx_unlock(&pool->mutex);
+    ngx_slab_unlock(pool, locked);
 }
 
 /**
@@ -803,22 +1364,38 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
 
         case NGX_SLAB_BIG:
 
-            //slab的高16位是slot块的位图,低16位用于存储slot块大小的偏移
-            shift = slab & NGX_SLAB_SHIFT_MASK;
-            size = (size_t) 1 << shift;
+            if (pool->fine) {
+                //fine时低位存的是slot，chunk大小不是2的幂次方，只能用除法算chunk的位置
+                slot = slab & NGX_SLAB_SLOT_MASK;
+                size = pool->stats[slot].size;
 
-            if ((uintptr_t) p & (size - 1)) {
-                goto wrong_chunk;
+                n = (uintptr_t) p & (ngx_pagesize - 1);
+
+                if (n % size) {
+                    goto wrong_chunk;
+                }
+
+                n /= size;
+
+            } else {
+                //slab的高16位是slot块的位图,低16位用于存储slot块大小的偏移
+                shift = slab & NGX_SLAB_SHIFT_MASK;
+                size = (size_t) 1 << shift;
+
+                if ((uintptr_t) p & (size - 1)) {
+                    goto wrong_chunk;
+                }
+
+                n = ((uintptr_t) p & (ngx_pagesize - 1)) >> shift;
+                slot = shift - pool->min_shift;
             }
 
             //找到该slot块在位图中的位置.这里要注意一下,
             //位图存储在slab的高16位,所以要+16(即+ NGX_SLAB_MAP_SHIFT)
-            m = (uintptr_t) 1 << ((((uintptr_t) p & (ngx_pagesize - 1)) >> shift)
-                                  + NGX_SLAB_MAP_SHIFT);
+            m = (uintptr_t) 1 << (n + NGX_SLAB_MAP_SHIFT);
 
             //该slot块确实正在被使用
             if (slab & m) {
-                slot = shift - pool->min_shift;
 
                 //如果整个页面中的所有obj块都被使用,则该页page[]和slot[]没有对应关系,因此需要把页page[]和slot[]对应关系加上
                 if (page->next == NULL) {
@@ -842,7 +1419,7 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
 
                 ngx_slab_free_pages(pool, page, 1);
 
-                pool->stats[slot].total -= ngx_pagesize >> shift;
+                pool->stats[slot].total -= ngx_pagesize / size;
 
                 goto done;
             }
@@ -872,6 +1449,11 @@ ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
             n = ((u_char *) p - pool->start) >> ngx_pagesize_shift;
             //计算归还page的个数
             size = slab & ~NGX_SLAB_PAGE_START;
+            if (pool->trace_info) {
+                pool->trace_info->frees++;
+                ngx_memzero(&pool->occupancy[n], size * sizeof(uint16_t));
+            }
+
             //归还页面
             ngx_slab_free_pages(pool, &pool->pages[n], size);
 
@@ -888,6 +1470,11 @@ done:
 
     pool->stats[slot].used--;
 
+    if (pool->trace_info) {
+        pool->trace_info->frees++;
+        pool->occupancy[((u_char *) p - pool->start) >> ngx_pagesize_shift]--;
+    }
+
     ngx_slab_junk(p, size);
 
     return;
@@ -916,6 +1503,12 @@ fail:
 然后page[3]的next和prev指向free,free的next和prev也指向page[3]，也就是下次只能从page[3]开始获取页
 */ //分配一个页面,并将页面从free中摘除.
 
+/*
+ * 上面是原来只有一个free链表时的情况，现在pool->free按连续页数分成NGX_SLAB_FREE_LISTS个链表，
+ * 切分和合并的方式不变，只是每段按合并后的页数挂到对应的链表上；
+ * 分配时借助free_map直接找到第一个够用的非空链表，不再从头遍历所有空闲段
+ */
+
 /*
 -------------------------------------------------------------------
 | page1  | page2 | page3 | page4| page5) | page6 | page7 | page8 |
@@ -948,70 +1541,42 @@ fail:
 static ngx_slab_page_t *
 ngx_slab_alloc_pages(ngx_slab_pool_t *pool, ngx_uint_t pages)
 {
+    uintptr_t         map;
+    ngx_uint_t        lo, hi;
     ngx_slab_page_t  *page, *p;
 
-    //初始化的时候pool->free.next默认指向第一个pool->pages
-    //从pool->free.next开始，每次取(slab page) page = page->next
-    for (page = pool->free.next; page != &pool->free; page = page->next) {//如果一个可用page页都没有，就不会进入循环体
+    //lo是pages所在的链表，hi是第一个所有段都不少于pages页的链表
+    for (lo = 0, map = pages; map >>= 1; lo++) { /* void */ }
 
-        /*
-        本个slab page剩下的缓存页数目>=需要分配的缓存页数目pages则可以分配，否则继续遍历free,直到下一个首page及其后连续page数和大于等于需要分配的pages数，才可以分配
-        slab是首次分配page开始的slab个页的时候指定的，在释放的时候slab还是首次分配时候的slab，不会变，也就是说释放page后不会把相邻的两个page页的slab数合并，
-        例如首次开辟page1开始的3个page页空间，page1->slab=3,紧接着开辟page2开始的2个page页空间，page2->slab=2,当连续释放page1和page2对应的空间后，他们还是
-        两个独立的page[]空间，slab分别是2和3,而不会把这两块连续空间进行合并为1个(也就是新的page3,page3首地址等于page2，并且page3->slab=3+2=5)
-        */
-        //找到了合适的slab
-        if (page->slab >= pages) {
-
-            //对于大于请求page数的情况，会将前pages个切分出去,page[pages]刚好为将
-            //pages个切分出去后，逗留下的第一个，正好作为构建新结点的第一个。下面
-            //其实是一个双向链表插入及删除节点时的操作
-            if (page->slab > pages) {
-                page[page->slab - 1].prev = (uintptr_t) &page[pages];
-
-                //更新从本个slab page开始往下第pages个slab page的缓存页数目为本个slab page数目减去pages
-                //让下次可以从page[pages]开始分配的页的next和prev指向pool->free,只要页的next和prev指向了free，则表示可以从该页开始分配页page
-                page[pages].slab = page->slab - pages;
-                page[pages].next = page->next;//该可用页的next指向pool->free.next
-                page[pages].prev = page->prev;//该可用页的prev指向pool->free.next
-                // ++ pages 和free 相互指向
-                p = (ngx_slab_page_t *) page->prev;
-                //更新pool->free.next = &page[pages]，下次从第pages个slab page开始进行上面的for()循环遍历
-                p->next = &page[pages];
-                //指向下次可以分配页的页地址
-                page->next->prev = (uintptr_t) &page[pages];
+    hi = (pages & (pages - 1)) ? lo + 1 : lo;
 
-            } else {
-                //恰好等于时，不用进行切分直接删除节点  然free自己指向自己
-                p = (ngx_slab_page_t *) page->prev;
-                p->next = page->next;
-                page->next->prev = page->prev;
-            }
+    /*
+     * 先从不小于hi的非空链表中取第一段，不需要遍历链表；
+     * 取能满足的最短那一级，把长的段留给大的请求
+     */
+    if (hi < NGX_SLAB_FREE_LISTS) {
+        map = pool->free_map & ~(((uintptr_t) 1 << hi) - 1);
 
-            //NGX_SLAB_PAGE_START标记page是分配的pages个页的第一个页，并在第一个页page中记录出其后连续的pages个页是一起分配的
-            //修改page对应的状态 //更新被分配的page slab中的第一个的slab成员，即页的个数和占用情况
-            page->slab = pages | NGX_SLAB_PAGE_START;
-            page->next = NULL;
-            //page页面不划分slot时候,即将整个页面分配给用户,pre的后两位为NGX_SLAB_PAGE
-            page->prev = NGX_SLAB_PAGE;
+        if (map) {
+            for ( /* void */ ; !(map & ((uintptr_t) 1 << hi)); hi++) {
+                /* void */
+            }
 
-            pool->pfree -= pages;
+            page = pool->free[hi].next;
 
-            if (--pages == 0) { //pages为1。则直接返回该page
-                return page;
-            }
+            goto found;
+        }
+    }
 
-            //对于pages大于1的情况，还处理非第一个page的状态，修改为BUSY
-            for (p = page + 1; pages; pages--) {
-                p->slab = NGX_SLAB_PAGE_BUSY;
-                //标记这是连续分配多个page，并且我不是首page，例如一次分配3个page,分配的page为[1-3]，则page[1].slab=3
-                // page[2].slab=page[3].slab=NGX_SLAB_PAGE_BUSY记录
-                p->next = NULL;
-                p->prev = NGX_SLAB_PAGE;
-                p++;
+    /* pages不是2的幂次方时，lo链表中也可能有足够长的段，只有这种情况需要遍历一个链表 */
+    if (lo < NGX_SLAB_FREE_LISTS && lo != hi) {
+        for (page = pool->free[lo].next;
+             page != &pool->free[lo];
+             page = page->next)
+        {
+            if (page->slab >= pages) {
+                goto found;
             }
-
-            return page;
         }
     }
 
@@ -1022,6 +1587,44 @@ ngx_slab_alloc_pages(ngx_slab_pool_t *pool, ngx_uint_t pages)
 
     //没有找到空余的页
     return NULL;
+
+found:
+
+    ngx_slab_free_remove(pool, page);
+
+    //对于大于请求page数的情况，会将前pages个切分出去,剩下的page[pages]开始的一段重新挂到对应的链表上
+    if (page->slab > pages) {
+        //剩下那段的最后一页的prev指向它的首页，释放时向前合并要用到
+        page[page->slab - 1].prev = (uintptr_t) &page[pages];
+
+        page[pages].slab = page->slab - pages;
+        ngx_slab_free_insert(pool, &page[pages]);
+    }
+
+    //NGX_SLAB_PAGE_START标记page是分配的pages个页的第一个页，并在第一个页page中记录出其后连续的pages个页是一起分配的
+    //修改page对应的状态 //更新被分配的page slab中的第一个的slab成员，即页的个数和占用情况
+    page->slab = pages | NGX_SLAB_PAGE_START;
+    page->next = NULL;
+    //page页面不划分slot时候,即将整个页面分配给用户,pre的后两位为NGX_SLAB_PAGE
+    page->prev = NGX_SLAB_PAGE;
+
+    pool->pfree -= pages;
+
+    if (--pages == 0) { //pages为1。则直接返回该page
+        return page;
+    }
+
+    //对于pages大于1的情况，还处理非第一个page的状态，修改为BUSY
+    for (p = page + 1; pages; pages--) {
+        p->slab = NGX_SLAB_PAGE_BUSY;
+        //标记这是连续分配多个page，并且我不是首page，例如一次分配3个page,分配的page为[1-3]，则page[1].slab=3
+        // page[2].slab=page[3].slab=NGX_SLAB_PAGE_BUSY记录
+        p->next = NULL;
+        p->prev = NGX_SLAB_PAGE;
+        p++;
+    }
+
+    return page;
 }
 
 //释放page页开始的pages个页面
@@ -1065,15 +1668,13 @@ ngx_slab_free_pages(ngx_slab_pool_t *pool, ngx_slab_page_t *page,
         if (ngx_slab_page_type(join) == NGX_SLAB_PAGE) {
             /* 如果连续页连着的也是空白页首页，也在free链表中，那么就可以合并起来  */
             if (join->next != NULL) {
+                //join脱离链表，按join->slab找到所在的链表，所以要在修改slab之前
+                ngx_slab_free_remove(pool, join);
+
                 pages += join->slab;
                 //把join的页数合并入page，连在一起
                 page->slab += join->slab;
 
-                //join脱离链表
-                prev = ngx_slab_page_prev(join);
-                prev->next = join->next;
-                join->next->prev = join->prev;
-
                 join->slab = NGX_SLAB_PAGE_FREE;
                 join->next = NULL;
                 join->prev = NGX_SLAB_PAGE;
@@ -1096,13 +1697,12 @@ ngx_slab_free_pages(ngx_slab_pool_t *pool, ngx_slab_page_t *page,
 
             /* 同理，将自己合并到前一个空白页的后面 */
             if (join->next != NULL) {
+                //join从链表中分享出来
+                ngx_slab_free_remove(pool, join);
+
                 pages += join->slab;
                 //把page以后续的页合并入join
                 join->slab += page->slab;
-                //join从链表中分享出来
-                prev = ngx_slab_page_prev(join);
-                prev->next = join->next;
-                join->next->prev = join->prev;
                 //page原来指向的页变成中间页，所以对应的next和prev都清除
                 page->slab = NGX_SLAB_PAGE_FREE;
                 page->next = NULL;
@@ -1118,16 +1718,417 @@ ngx_slab_free_pages(ngx_slab_pool_t *pool, ngx_slab_page_t *page,
         page[pages].prev = (uintptr_t) page;
     }
 
-    //将page重新归于，slab_page的管理结构之下。放于管理结构的头部
-    //这里释放后就会把之前free指向的可用page页与释放的page页以及pool->free形成一个环形链表
-    //page变成空闲页，需要重新接入free指向的空闲节点，并且放在free指向的头部
-    /* 将空白页插到free 链表最前头 */
-    page->prev = (uintptr_t) &pool->free;
-    page->next = pool->free.next;
+    //page变成空闲页，按合并后的页数插到对应free链表的头部
+    ngx_slab_free_insert(pool, page);
+}
+
+
+//page->slab是这段连续空闲页的页数，返回它所在的free链表
+static ngx_inline ngx_uint_t
+ngx_slab_free_list(ngx_uint_t pages)
+{
+    ngx_uint_t  i;
+
+    for (i = 0; pages >>= 1; i++) { /* void */ }
+
+    return (i < NGX_SLAB_FREE_LISTS) ? i : NGX_SLAB_FREE_LISTS - 1;
+}
+
+
+//把一段连续空闲页插到对应free链表的头部
+static void
+ngx_slab_free_insert(ngx_slab_pool_t *pool, ngx_slab_page_t *page)
+{
+    ngx_uint_t        i;
+    ngx_slab_page_t  *head;
+
+    i = ngx_slab_free_list(page->slab);
+    head = &pool->free[i];
+
+    page->prev = (uintptr_t) head;
+    page->next = head->next;
 
     page->next->prev = (uintptr_t) page;
 
-    pool->free.next = page;
+    head->next = page;
+
+    pool->free_map |= (uintptr_t) 1 << i;
+    pool->nruns++;
+}
+
+
+//把一段连续空闲页从free链表中摘除，page->slab必须还是这段的页数
+static void
+ngx_slab_free_remove(ngx_slab_pool_t *pool, ngx_slab_page_t *page)
+{
+    ngx_uint_t        i;
+    ngx_slab_page_t  *prev;
+
+    prev = ngx_slab_page_prev(page);
+    prev->next = page->next;
+    page->next->prev = page->prev;
+
+    i = ngx_slab_free_list(page->slab);
+
+    if (pool->free[i].next == &pool->free[i]) {
+        pool->free_map &= ~((uintptr_t) 1 << i);
+    }
+
+    pool->nruns--;
+}
+
+
+/*
+ * 记录一次ngx_slab_alloc_locked，在锁里调用
+ * 开启了chunk缓存时，缓存命中的分配不经过这里，直方图里只有补充缓存时按slot大小的请求
+ */
+static void
+ngx_slab_trace_alloc(ngx_slab_pool_t *pool, size_t size, uintptr_t p)
+{
+    ngx_uint_t         i, n, pages;
+    ngx_uint_t        *sizes;
+    ngx_slab_trace_t  *tr;
+
+    tr = pool->trace_info;
+
+    tr->allocs++;
+
+    if (size <= ngx_slab_max_size) {
+        sizes = (ngx_uint_t *) ((u_char *) pool->addr + tr->sizes_off);
+        sizes[size]++;
+
+    } else {
+        pages = (size >> ngx_pagesize_shift) + ((size % ngx_pagesize) ? 1 : 0);
+
+        for (i = 0; (pages >>= 1) && i < NGX_SLAB_TRACE_PAGES - 1; i++) {
+            /* void */
+        }
+
+        tr->big[i]++;
+    }
+
+    if (pool->pfree < tr->pfree_min) {
+        tr->pfree_min = pool->pfree;
+    }
+
+    if (p == 0) {
+        tr->fails++;
+        tr->fail_size = size;
+        return;
+    }
+
+    n = ((u_char *) p - pool->start) >> ngx_pagesize_shift;
+
+    if (size <= ngx_slab_max_size) {
+        pool->occupancy[n]++;
+        return;
+    }
+
+    pages = (size >> ngx_pagesize_shift) + ((size % ngx_pagesize) ? 1 : 0);
+
+    for (i = 0; i < pages; i++) {
+        pool->occupancy[n + i] = NGX_SLAB_TRACE_BUSY;
+    }
+}
+
+
+static void
+ngx_slab_trace_lat(ngx_slab_trace_lat_t *lat, uint64_t ns)
+{
+    ngx_uint_t  i;
+
+    lat->count++;
+    lat->total += ns;
+
+    if (ns > lat->max) {
+        lat->max = ns;
+    }
+
+    for (i = 0; (ns >>= 1) && i < NGX_SLAB_TRACE_LAT - 1; i++) {
+        /* void */
+    }
+
+    lat->hist[i]++;
+}
+
+
+/**
+ * 统计空闲页的碎片情况
+ * 最长的一段一定在最高的非空链表上，只需要遍历这一个链表
+ */
+void
+ngx_slab_frag_stat(ngx_slab_pool_t *pool, ngx_slab_frag_t *fs)
+{
+    uint64_t          locked;
+    ngx_uint_t        i;
+    ngx_slab_page_t  *page;
+
+    locked = ngx_slab_lock(pool);
+
+    fs->pages = pool->pfree;
+    fs->runs = pool->nruns;
+    fs->largest = 0;
+
+    for (i = NGX_SLAB_FREE_LISTS; i--; /* void */ ) {
+        if (!(pool->free_map & ((uintptr_t) 1 << i))) {
+            continue;
+        }
+
+        for (page = pool->free[i].next;
+             page != &pool->free[i];
+             page = page->next)
+        {
+            if (page->slab > fs->largest) {
+                fs->largest = page->slab;
+            }
+        }
+
+        break;
+    }
+
+    ngx_slab_unlock(pool, locked);
+}
+
+
+/*
+ * 计算fine时大于ngx_slab_exact_size的分级，返回分级个数，sizes不为NULL时填入每级的chunk大小
+ * 每翻一倍分成 5/4, 6/4, 7/4, 8/4 四级，一页切出的chunk数超过NGX_SLAB_MAP_BITS的那几级放不下bitmap，跳过；
+ * 2的幂次方那一级总是保留，和原来的NGX_SLAB_BIG一样
+ */
+static ngx_uint_t
+ngx_slab_fine_classes(size_t *sizes)
+{
+    size_t      d, c;
+    ngx_uint_t  q, k;
+
+    k = 0;
+
+    for (d = ngx_slab_exact_size; d < ngx_slab_max_size; d <<= 1) {
+        for (q = 5; q <= 8; q++) {
+            c = d * q / 4;
+
+            if (q != 8 && ngx_pagesize / c > NGX_SLAB_MAP_BITS) {
+                continue;
+            }
+
+            if (sizes) {
+                sizes[k] = c;
+            }
+
+            k++;
+        }
+    }
+
+    return k;
+}
+
+
+/*
+ * fine时大于ngx_slab_exact_size的分配，和ngx_slab_alloc_locked中shift > ngx_slab_exact_shift的情况一样，
+ * bitmap放在page->slab的高位，只是chunk的位置用乘法算
+ */
+static uintptr_t
+ngx_slab_alloc_fine(ngx_slab_pool_t *pool, ngx_uint_t slot)
+{
+    size_t            size;
+    uintptr_t         m, mask;
+    ngx_uint_t        i, n;
+    ngx_slab_page_t  *page, *prev, *slots;
+
+    size = pool->stats[slot].size;
+    //一页能切出的chunk数
+    n = ngx_pagesize / size;
+
+    mask = ((uintptr_t) 1 << n) - 1;
+    mask <<= NGX_SLAB_MAP_SHIFT;
+
+    slots = ngx_slab_slots(pool);
+    page = slots[slot].next;
+
+    if (page->next != page) {
+
+        for (m = (uintptr_t) 1 << NGX_SLAB_MAP_SHIFT, i = 0;
+             m & mask;
+             m <<= 1, i++)
+        {
+            if (page->slab & m) {
+                continue;
+            }
+
+            page->slab |= m;
+
+            if ((page->slab & NGX_SLAB_MAP_MASK) == mask) {
+                prev = ngx_slab_page_prev(page);
+                prev->next = page->next;
+                page->next->prev = page->prev;
+
+                page->next = NULL;
+                page->prev = NGX_SLAB_BIG;
+            }
+
+            pool->stats[slot].used++;
+
+            return ngx_slab_page_addr(pool, page) + i * size;
+        }
+
+        ngx_slab_error(pool, NGX_LOG_ALERT, "ngx_slab_alloc(): page is busy");
+        ngx_debug_point();
+    }
+
+    page = ngx_slab_alloc_pages(pool, 1);
+
+    if (page) {
+        page->slab = ((uintptr_t) 1 << NGX_SLAB_MAP_SHIFT) | slot;
+        page->next = &slots[slot];
+        page->prev = (uintptr_t) &slots[slot] | NGX_SLAB_BIG;
+
+        slots[slot].next = page;
+
+        pool->stats[slot].total += n;
+        pool->stats[slot].used++;
+
+        return ngx_slab_page_addr(pool, page);
+    }
+
+    pool->stats[slot].fails++;
+
+    return 0;
+}
+
+
+/**
+ * 为pool开启本进程的chunk缓存，每个slot最多缓存size个chunk
+ * 在worker进程初始化时调用，缓存的内存从本进程的堆上分配
+ */
+ngx_int_t
+ngx_slab_magazine_init(ngx_slab_pool_t *pool, ngx_uint_t size, ngx_log_t *log)
+{
+    u_char                    *p;
+    ngx_uint_t                 i, n;
+    ngx_slab_magazine_zone_t  *mz;
+
+    if (size == 0 || ngx_slab_magazine_find(pool)) {
+        return NGX_OK;
+    }
+
+    if (ngx_slab_nmagazines == NGX_SLAB_MAGAZINE_ZONES) {
+        ngx_log_error(NGX_LOG_WARN, log, 0,
+                      "too many slab magazines, ignored");
+        return NGX_DECLINED;
+    }
+
+    n = pool->nslots;
+
+    p = ngx_alloc(n * (sizeof(ngx_slab_magazine_t) + size * sizeof(void *)),
+                  log);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    mz = &ngx_slab_magazines[ngx_slab_nmagazines++];
+
+    mz->pool = pool;
+    mz->size = size;
+    mz->batch = size - size / 2;
+    mz->nslots = n;
+    mz->slots = (ngx_slab_magazine_t *) p;
+    mz->locks = 0;
+    mz->ops = 0;
+
+    p += n * sizeof(ngx_slab_magazine_t);
+
+    for (i = 0; i < n; i++) {
+        mz->slots[i].n = 0;
+        mz->slots[i].chunks = (void **) p;
+        p += size * sizeof(void *);
+    }
+
+    return NGX_OK;
+}
+
+
+void
+ngx_slab_magazine_flush(ngx_slab_pool_t *pool)
+{
+    ngx_uint_t                 i, n;
+    ngx_slab_magazine_zone_t  *mz;
+
+    for (i = 0; i < ngx_slab_nmagazines; i++) {
+        mz = &ngx_slab_magazines[i];
+
+        if (pool && mz->pool != pool) {
+            continue;
+        }
+
+        for (n = 0; n < mz->nslots; n++) {
+            if (mz->slots[n].n) {
+                ngx_slab_magazine_drain(mz->pool, mz, &mz->slots[n],
+                                        mz->slots[n].n);
+            }
+        }
+
+        ngx_log_debug3(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
+                       "slab magazine %p flushed, ops:%ui locks:%ui",
+                       mz->pool, mz->ops, mz->locks);
+    }
+}
+
+
+/*
+ * 缓存空了，加一次锁取batch个chunk，取到几个算几个，第一次失败就停
+ * 只有第一个是调用方真正要的，可以触发回收回调；后面预取的chunk置上reclaiming，
+ * 不为了填缓存去释放别人的数据，失败时也不打印"no memory"
+ */
+static void
+ngx_slab_magazine_refill(ngx_slab_pool_t *pool, ngx_slab_magazine_zone_t *mz,
+    ngx_slab_magazine_t *mag, ngx_uint_t slot)
+{
+    void        *p;
+    uint64_t     locked;
+    ngx_uint_t   n, log_nomem, reclaiming;
+
+    locked = ngx_slab_lock(pool);
+
+    mz->locks++;
+
+    log_nomem = pool->log_nomem;
+    reclaiming = pool->reclaiming;
+
+    for (n = mz->batch; n; n--) {
+        p = ngx_slab_alloc_locked(pool, pool->stats[slot].size);
+        if (p == NULL) {
+            break;
+        }
+
+        mag->chunks[mag->n++] = p;
+
+        pool->log_nomem = 0;
+        pool->reclaiming = 1;
+    }
+
+    pool->log_nomem = log_nomem;
+    pool->reclaiming = reclaiming;
+
+    ngx_slab_unlock(pool, locked);
+}
+
+
+//缓存满了，加一次锁把最近放进去的n个chunk还给共享内存
+static void
+ngx_slab_magazine_drain(ngx_slab_pool_t *pool, ngx_slab_magazine_zone_t *mz,
+    ngx_slab_magazine_t *mag, ngx_uint_t n)
+{
+    uint64_t  locked;
+
+    locked = ngx_slab_lock(pool);
+
+    mz->locks++;
+
+    while (n-- && mag->n) {
+        ngx_slab_free_locked(pool, mag->chunks[--mag->n]);
+    }
+
+    ngx_slab_unlock(pool, locked);
 }
 
 
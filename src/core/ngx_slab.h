@@ -69,10 +69,92 @@ typedef struct {
     ngx_uint_t used;
     ngx_uint_t reqs; // 请求到的次数，分配到的次数
     ngx_uint_t fails; // 分配失败次数
+    size_t size; // 该slot的chunk大小
+    size_t waste; // 累计的内部碎片，每次请求 chunk大小 - 请求大小，waste/reqs 即平均每次浪费的字节数
 } ngx_slab_stat_t;
 
-/*整个内存区的管理结构*/
+/*
+ * 空闲页按连续页数分成NGX_SLAB_FREE_LISTS个链表，第i个链表上每段连续空闲页的页数在[2^i, 2^(i+1))之间，
+ * 最后一个链表放所有更大的
+ */
+#define NGX_SLAB_FREE_LISTS 32
+
+//空闲页的碎片情况，见ngx_slab_frag_stat
+typedef struct {
+    ngx_uint_t pages; // 空闲页数
+    ngx_uint_t runs; // 连续空闲页的段数，越多说明碎片越多
+    ngx_uint_t largest; // 最长一段连续空闲页的页数，决定了一次最多能分配多大的内存
+} ngx_slab_frag_t;
+
+/*
+ * 跟踪信息，pool->trace为1时由ngx_slab_init放在共享内存里slot/stats之后，
+ * 所有计数都在持有pool->mutex时更新，外部工具(通过/proc/<pid>/mem或gdb)可以不加锁直接读，
+ * 读到的是某一时刻附近的值，单个计数不会错乱
+ *
+ * 共享内存中的布局：
+ *   ngx_slab_trace_t
+ *   ngx_uint_t sizes[max_size + 1]  请求大小的精确直方图，sizes[n]为请求n字节的次数
+ *   ngx_slab_page_t pages[npages]   (pool->pages)
+ *   uint16_t occupancy[npages]      每页的占用情况
+ * sizes和occupancy相对pool->addr的偏移记在sizes_off和pages_off里，工具不需要解析指针
+ */
+#define NGX_SLAB_TRACE_MAGIC     0x74726163 // "trac"
+#define NGX_SLAB_TRACE_VERSION   1
+
+// 锁等待/持有时间的直方图，第i个桶为[2^i, 2^(i+1))纳秒
+#define NGX_SLAB_TRACE_LAT       32
+// 大于max_size按页分配的请求，第i个桶为页数在[2^i, 2^(i+1))之间的请求
+#define NGX_SLAB_TRACE_PAGES     32
+
+// occupancy的取值：0为空闲页，NGX_SLAB_TRACE_BUSY为按页分配出去的页，其他为页里已分配的chunk数
+#define NGX_SLAB_TRACE_BUSY      0xffff
+
+typedef struct {
+    ngx_uint_t count; // 次数
+    uint64_t total; // 总耗时，纳秒
+    uint64_t max; // 最长的一次，纳秒
+    ngx_uint_t hist[NGX_SLAB_TRACE_LAT];
+} ngx_slab_trace_lat_t;
+
 typedef struct {
+    uint32_t magic; // NGX_SLAB_TRACE_MAGIC，工具用来确认找对了位置
+    uint32_t version;
+
+    ngx_uint_t max_size; // sizes直方图覆盖1..max_size字节
+    ngx_uint_t npages; // occupancy的个数
+    size_t sizes_off;
+    size_t pages_off;
+
+    ngx_uint_t allocs; // ngx_slab_alloc_locked的调用次数
+    ngx_uint_t frees; // ngx_slab_free_locked成功释放的次数
+    ngx_uint_t fails; // 分配失败的次数
+    size_t fail_size; // 最近一次分配失败的请求大小
+    ngx_uint_t pfree_min; // 空闲页数的最低值，接近0说明共享内存快用完了
+
+    ngx_uint_t big[NGX_SLAB_TRACE_PAGES];
+
+    ngx_slab_trace_lat_t wait; // 等待pool->mutex的时间
+    ngx_slab_trace_lat_t hold; // 持有pool->mutex的时间
+} ngx_slab_trace_t;
+
+typedef struct ngx_slab_pool_s ngx_slab_pool_t;
+
+/*
+ * 回收回调，由使用共享内存的模块注册，通常是按LRU淘汰最旧的节点
+ * 调用时已经持有pool->mutex，只能用ngx_slab_free_locked释放，
+ * size是希望释放的字节数，返回实际释放的字节数，返回0表示没有可淘汰的了
+ */
+typedef size_t (*ngx_slab_reclaim_pt)(ngx_slab_pool_t *pool, size_t size,
+    void *data);
+
+//分配失败后最多回收几次，每次的目标翻倍
+#define NGX_SLAB_RECLAIM_TRIES  4
+
+//每个进程最多登记的回收回调个数，所有共享内存加起来
+#define NGX_SLAB_RECLAIM_HANDLERS  32
+
+/*整个内存区的管理结构*/
+struct ngx_slab_pool_s {
     ngx_shmtx_sh_t lock; //mutex的锁
 
     size_t min_size; //最小分配空间，默认为8字节 /* 最小 chunk 字节数 */
@@ -81,11 +163,16 @@ typedef struct {
 
     ngx_slab_page_t *pages;  /* 页数组 */  /* slab 的管理结构体数组首地址 */
     ngx_slab_page_t  *last; // 指向最后一块内存内存首地址
-    ngx_slab_page_t   free; // 空闲页链表 /* 空闲的 slab 管理结构体链表 */
+    ngx_slab_page_t   free[NGX_SLAB_FREE_LISTS]; // 按连续页数分级的空闲页链表 /* 空闲的 slab 管理结构体链表 */
+    uintptr_t         free_map; // 第i位为1表示free[i]非空
+    ngx_uint_t        nruns; // 所有free链表上的段数
 
     ngx_slab_stat_t  *stats;
     ngx_uint_t        pfree; // 空闲页的数量
 
+    ngx_uint_t        nslots; // slot的个数，stats也是这么多个
+    u_char           *lookup; // fine时大于ngx_slab_exact_size的请求按 (size - 1) >> min_shift 查到slot
+
     u_char           *start; //page数组的开始地址
     u_char           *end; //page数组的最后字节
 
@@ -95,10 +182,31 @@ typedef struct {
     u_char            zero;
 
     unsigned          log_nomem:1;
+    /*
+     * 在ngx_slab_init之前设置，大于ngx_slab_exact_size的chunk不再只有2的幂次方，
+     * 每翻一倍分成4级(约1.25倍间隔)，例如130字节的对象只占160字节而不是256字节
+     */
+    unsigned          fine:1;
+    /*
+     * 在ngx_slab_init之前设置，开启跟踪信息，见ngx_slab_trace_t
+     * 只统计通过ngx_slab_alloc/ngx_slab_free等加的锁，调用方自己锁pool->mutex再调*_locked的不算锁时间
+     */
+    unsigned          trace:1;
+
+    ngx_slab_trace_t *trace_info; // 没有开启时为NULL
+    uint16_t         *occupancy; // 每页的占用情况
+
+    /*
+     * 见ngx_slab_set_reclaim，回调本身登记在每个进程自己的表里，这里只放所有进程共用的水位，
+     * reclaiming只在持有mutex时置上
+     */
+    ngx_uint_t           reclaim_low; // 空闲页少于这个数时后台开始回收，0为不在后台回收
+    ngx_uint_t           reclaim_high; // 后台回收到空闲页达到这个数为止
+    unsigned             reclaiming:1; // 正在回收，回调里再分配时不会再次回收
 
     void             *data; // 具体使用场景业务的结构体
     void             *addr; // 共享内存起始地址，也就是本结构体起始地址
-} ngx_slab_pool_t;
+};
 
 // 初始化slab池
 void ngx_slab_init(ngx_slab_pool_t *pool);
@@ -116,4 +224,34 @@ void *ngx_slab_calloc_locked(ngx_slab_pool_t *pool, size_t size);
 void ngx_slab_free(ngx_slab_pool_t *pool, void *p);
 void ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p);
 
+/*
+ * 每个worker进程私有的chunk缓存(magazine)，挂在ngx_slab_alloc/ngx_slab_free前面
+ * 每个slot缓存最多size个chunk，空了或者满了才加一次锁，批量补充或归还size/2个，
+ * 加锁次数大约降为原来的 2/size
+ * 只能在worker进程中开启，master进程中缓存的chunk会被fork到每个worker里重复使用
+ */
+#define NGX_SLAB_MAGAZINE_ZONES 16
+
+ngx_int_t ngx_slab_magazine_init(ngx_slab_pool_t *pool, ngx_uint_t size,
+    ngx_log_t *log);
+// 统计空闲页的碎片情况，会加锁
+void ngx_slab_frag_stat(ngx_slab_pool_t *pool, ngx_slab_frag_t *fs);
+
+/*
+ * 注册回收回调，ngx_slab_alloc_locked失败时先调用回调淘汰一部分再重试，
+ * 调用方不需要自己写"淘汰再分配"的逻辑；
+ * 回调和data登记在本进程的表里，不放进共享内存：函数指针和data只在设置它的进程里有效，
+ * 一般在zone的init回调里设置(master进程，fork时worker复制一份)，reload后旧worker还用自己那份；
+ * 同一个pool可以登记多个不同的handler，按登记顺序调用到释放够为止，同一个handler再次设置时替换data，
+ * handler为NULL时删除pool上所有的回调；
+ * low和high是字节数，low不为0时ngx_slab_reclaim会在空闲内存少于low时回收到high，low为0时不改动原来的水位
+ */
+ngx_int_t ngx_slab_set_reclaim(ngx_slab_pool_t *pool,
+    ngx_slab_reclaim_pt handler, void *data, size_t low, size_t high);
+// 后台回收，worker定时调用，空闲页不少于低水位时直接返回，会加锁，返回释放的字节数
+size_t ngx_slab_reclaim(ngx_slab_pool_t *pool);
+
+// 把缓存的chunk全部还给共享内存，pool为NULL时处理所有开启了缓存的共享内存
+void ngx_slab_magazine_flush(ngx_slab_pool_t *pool);
+
 #endif //NGINX_LEARNING_NGX_SLAB_H
@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <time.h>
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+
+#define Max_Timeout 60000  //定时器超时时间范围1~60秒，和常见的读写超时差不多
+
+void bench_timer(ngx_uint_t n, ngx_uint_t wheel);
+void bench_timer_refresh(ngx_uint_t n, ngx_uint_t wheel, ngx_uint_t defer);
+
+/* for passing compiling */
+volatile ngx_cycle_t  *ngx_cycle;
+volatile ngx_msec_t  ngx_current_msec;
+ngx_log_t ngx_log;
+void ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err, const char *fmt, ...)
+{
+}
+
+static ngx_uint_t fired;
+
+static void
+ngx_timer_test_handler(ngx_event_t *ev)
+{
+    fired++;
+}
+
+static double
+elapsed(struct timespec *start, struct timespec *end, ngx_uint_t n)
+{
+    return ((end->tv_sec - start->tv_sec) * 1e9
+            + (end->tv_nsec - start->tv_nsec)) / n;
+}
+
+int main(/* int argc, char **argv */)
+{
+    ngx_uint_t n;
+
+    printf("--------------------------------\n");
+    printf("timer rbtree vs timer wheel (ns/op):\n");
+    printf("--------------------------------\n");
+
+    for (n = 10000; n <= 1000000; n *= 10) {
+        bench_timer(n, 0);
+        bench_timer(n, 1);
+    }
+
+    printf("--------------------------------\n");
+    printf("keepalive refresh, timer_defer off/on (ns/op):\n");
+    printf("--------------------------------\n");
+
+    for (n = 10000; n <= 1000000; n *= 10) {
+        bench_timer_refresh(n, 0, 0);
+        bench_timer_refresh(n, 0, 1);
+        bench_timer_refresh(n, 1, 0);
+        bench_timer_refresh(n, 1, 1);
+    }
+
+    return 0;
+}
+
+/*
+ * add: n个定时器依次加入
+ * re-arm: 每个定时器换一个超时时间重新加入(先删再加，和读写事件刷新超时一样)
+ * del: 全部删除
+ * expire: 重新加入后每次走1毫秒，直到全部超时，按触发的定时器个数平均
+ */
+void bench_timer(ngx_uint_t n, ngx_uint_t wheel)
+{
+    ngx_uint_t i, *timeouts;
+    ngx_event_t *evs;
+    struct timespec start, end;
+    double add, rearm, del, expire;
+
+    evs = ngx_calloc(n * sizeof(ngx_event_t), &ngx_log);
+    timeouts = ngx_alloc(2 * n * sizeof(ngx_uint_t), &ngx_log);
+    if (evs == NULL || timeouts == NULL) {
+        printf("Failed to allocate %lu events!\n", (unsigned long) n);
+        return;
+    }
+
+    srand(1);
+    for (i = 0; i < 2 * n; i++) {
+        timeouts[i] = 1 + (((ngx_uint_t) rand() << 16) ^ rand()) % Max_Timeout;
+    }
+
+    for (i = 0; i < n; i++) {
+        evs[i].handler = ngx_timer_test_handler;
+        evs[i].log = &ngx_log;
+    }
+
+    ngx_current_msec = 1000;
+    ngx_event_timer_wheel = wheel;
+    ngx_event_timer_init(&ngx_log);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < n; i++) {
+        ngx_add_timer(&evs[i], timeouts[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    add = elapsed(&start, &end, n);
+
+    //ngx_add_timer里相差不到NGX_TIMER_LAZY_DELAY的不会重新加入，这里的超时时间基本都会真正移动
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < n; i++) {
+        ngx_add_timer(&evs[i], timeouts[n + i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    rearm = elapsed(&start, &end, n);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < n; i++) {
+        ngx_del_timer(&evs[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    del = elapsed(&start, &end, n);
+
+    for (i = 0; i < n; i++) {
+        ngx_add_timer(&evs[i], timeouts[i]);
+    }
+
+    fired = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (ngx_event_find_timer() != NGX_TIMER_INFINITE) {
+        ngx_current_msec++;
+        ngx_event_expire_timers();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    expire = elapsed(&start, &end, n);
+
+    printf("%-6s n=%-8lu add %6.1f  re-arm %6.1f  del %6.1f  expire %6.1f%s\n",
+           wheel ? "wheel" : "rbtree", (unsigned long) n,
+           add, rearm, del, expire, fired == n ? "" : "  (lost timers!)");
+
+    ngx_free(timeouts);
+    ngx_free(evs);
+}
+
+/*
+ * 模拟keepalive连接：每个连接的超时都是Max_Timeout，每过1秒所有连接都有一次读写，
+ * 超时往后推1秒，一直都不会真正超时；
+ * timer_defer关闭时每次都删除再加入，打开时只在旧的超时到期时重新加入一次
+ */
+void bench_timer_refresh(ngx_uint_t n, ngx_uint_t wheel, ngx_uint_t defer)
+{
+    ngx_uint_t i, round, rounds;
+    ngx_event_t *evs;
+    struct timespec start, end;
+
+    evs = ngx_calloc(n * sizeof(ngx_event_t), &ngx_log);
+    if (evs == NULL) {
+        printf("Failed to allocate %lu events!\n", (unsigned long) n);
+        return;
+    }
+
+    for (i = 0; i < n; i++) {
+        evs[i].handler = ngx_timer_test_handler;
+        evs[i].log = &ngx_log;
+    }
+
+    ngx_current_msec = 1000;
+    ngx_event_timer_wheel = wheel;
+    ngx_event_timer_defer = defer;
+    ngx_event_timer_init(&ngx_log);
+
+    for (i = 0; i < n; i++) {
+        ngx_add_timer(&evs[i], Max_Timeout);
+    }
+
+    rounds = 2 * Max_Timeout / 1000;
+    fired = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (round = 0; round < rounds; round++) {
+        ngx_current_msec += 1000;
+        ngx_event_expire_timers();
+
+        for (i = 0; i < n; i++) {
+            ngx_add_timer(&evs[i], Max_Timeout);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    printf("%-6s defer=%lu n=%-8lu refresh %6.1f%s\n",
+           wheel ? "wheel" : "rbtree", (unsigned long) defer,
+           (unsigned long) n, elapsed(&start, &end, n * rounds),
+           fired == 0 ? "" : "  (unexpected timeouts!)");
+
+    for (i = 0; i < n; i++) {
+        ngx_del_timer(&evs[i]);
+    }
+
+    ngx_event_timer_defer = 0;
+    ngx_free(evs);
+}
@@ -45,6 +45,8 @@ static ngx_int_t ngx_event_module_init(ngx_cycle_t *cycle);
  设置接受连接的回调函数为ngx_event_accept，可以接受连接
  */
 static ngx_int_t ngx_event_process_init(ngx_cycle_t *cycle);
+// worker进程退出时调用，把缓存在本进程的共享内存chunk还回去
+static void ngx_event_process_exit(ngx_cycle_t *cycle);
 
 // 解析events配置块
 // 设置事件模块的ctx_index
@@ -59,6 +61,8 @@ static char *ngx_event_connections(ngx_conf_t *cf, ngx_command_t *cmd,
 static char *ngx_event_use(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static char *ngx_event_debug_connection(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_event_slab_magazine(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 
 // 创建event_core模块的配置结构体，成员初始化为unset
 static void *ngx_event_core_create_conf(ngx_cycle_t *cycle);
@@ -66,6 +70,12 @@ static void *ngx_event_core_create_conf(ngx_cycle_t *cycle);
 // 所有模块配置解析完毕后，对配置进行初始化
 static char *ngx_event_core_init_conf(ngx_cycle_t *cycle, void *conf);
 
+// 定时释放内存池块回收缓存中的空闲块
+static void ngx_pool_cache_trim_handler(ngx_event_t *ev);
+
+// 定时对注册了回收回调的共享内存做后台回收
+static void ngx_slab_reclaim_handler(ngx_event_t *ev);
+
 // nginx更新缓存时间的精度，如果设置了会定时发送sigalarm信号更新时间
 // ngx_timer_resolution = ccf->timer_resolution;默认值是0
 static ngx_uint_t     ngx_timer_resolution;
@@ -76,6 +86,14 @@ sig_atomic_t          ngx_event_timer_alarm;
 //编译进Nginx的所有事件模块的总个数
 static ngx_uint_t     ngx_event_max_module;
 
+// 内存池块回收缓存的清理定时器，data指向一个假连接，给调试日志里的ngx_event_ident用
+static ngx_event_t       ngx_pool_cache_trim_event;
+static ngx_connection_t  ngx_pool_cache_trim_conn;
+
+// 共享内存后台回收的定时器
+static ngx_event_t       ngx_slab_reclaim_event;
+static ngx_connection_t  ngx_slab_reclaim_conn;
+
 // 事件模型的基本标志位
 // 在ngx_epoll_init里设置为et模式，边缘触发
 // NGX_USE_CLEAR_EVENT|NGX_USE_GREEDY_EVENT|NGX_USE_EPOLL_EVENT
@@ -229,6 +247,59 @@ static ngx_command_t  ngx_event_core_commands[] = {
       ngx_conf_set_msec_slot,
       0,
       offsetof(ngx_event_conf_t, accept_mutex_delay),
+      NULL },
+
+        // 每个worker缓存的已销毁内存池块个数，默认0不缓存
+        // 连接和请求的内存池频繁创建销毁，缓存后可以不用每次都走malloc/free
+    { ngx_string("pool_cache"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      0,
+      offsetof(ngx_event_conf_t, pool_cache),
+      NULL },
+
+        // 定时释放缓存中空闲内存池块的间隔，默认10秒
+    { ngx_string("pool_cache_trim"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      0,
+      offsetof(ngx_event_conf_t, pool_cache_trim),
+      NULL },
+
+        // 为指定的共享内存开启worker私有的chunk缓存，参数是共享内存名字和每个slot缓存的个数
+        // 减少ngx_slab_alloc/ngx_slab_free对共享内存锁的争用
+    { ngx_string("slab_magazine"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE2,
+      ngx_event_slab_magazine,
+      0,
+      0,
+      NULL },
+
+        // 检查共享内存空闲页是否低于回收低水位的间隔，默认1秒，0为不在后台回收
+        // 只对调用了ngx_slab_set_reclaim设置低水位的共享内存起作用
+    { ngx_string("slab_reclaim_interval"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      0,
+      offsetof(ngx_event_conf_t, slab_reclaim_interval),
+      NULL },
+
+        // 定时器用分层时间轮代替红黑树，加入和删除都是O(1)，默认off
+        // 定时器很多(大量keepalive连接)时减少ngx_add_timer/ngx_del_timer的开销
+    { ngx_string("timer_wheel"),
+      NGX_EVENT_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      0,
+      offsetof(ngx_event_conf_t, timer_wheel),
+      NULL },
+
+        // 超时时间往后推时不删除再加入定时器，只记下新的时间，到期时再检查，默认off
+        // keepalive连接每次读写都会刷新超时，这样定时器的操作只和真正到期的次数有关
+    { ngx_string("timer_defer"),
+      NGX_EVENT_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      0,
+      offsetof(ngx_event_conf_t, timer_defer),
       NULL },
 
         // 是否要针对某些连接打印调试日志
@@ -274,7 +345,7 @@ ngx_module_t  ngx_event_core_module = {
     ngx_event_process_init,                /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
-    NULL,                                  /* exit process */
+    ngx_event_process_exit,                /* exit process */
     NULL,                                  /* exit master */
     NGX_MODULE_V1_PADDING
 };
@@ -793,13 +864,16 @@ ngx_timer_signal_handler(int signo)
 static ngx_int_t
 ngx_event_process_init(ngx_cycle_t *cycle)
 {
-    ngx_uint_t           m, i;
-    ngx_event_t         *rev, *wev;
-    ngx_listening_t     *ls;
-    ngx_connection_t    *c, *next, *old;
-    ngx_core_conf_t     *ccf;
-    ngx_event_conf_t    *ecf;
-    ngx_event_module_t  *module;
+    ngx_uint_t                  m, i, n;
+    ngx_event_t                *rev, *wev;
+    ngx_listening_t            *ls;
+    ngx_connection_t           *c, *next, *old;
+    ngx_core_conf_t            *ccf;
+    ngx_event_conf_t           *ecf;
+    ngx_event_module_t         *module;
+    ngx_event_slab_magazine_t  *sm;
+    ngx_shm_zone_t             *shm_zone;
+    ngx_list_part_t            *part;
 
     // core模块的配置结构体
     ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
@@ -835,10 +909,84 @@ ngx_event_process_init(ngx_cycle_t *cycle)
     ngx_queue_init(&ngx_posted_events);
 
     // 初始化定时器红黑树
+    ngx_event_timer_wheel = ecf->timer_wheel;
+    ngx_event_timer_defer = ecf->timer_defer;
+
     if (ngx_event_timer_init(cycle->log) == NGX_ERROR) {
         return NGX_ERROR;
     }
 
+    // 开启本worker的内存池块回收缓存，并启动定时清理
+    if (ecf->pool_cache) {
+        ngx_pool_cache_init(ecf->pool_cache);
+
+        if (ecf->pool_cache_trim) {
+            ngx_pool_cache_trim_event.handler = ngx_pool_cache_trim_handler;
+            ngx_pool_cache_trim_event.data = &ngx_pool_cache_trim_conn;
+            ngx_pool_cache_trim_event.log = cycle->log;
+            // 不阻止worker优雅退出
+            ngx_pool_cache_trim_event.cancelable = 1;
+
+            ngx_add_timer(&ngx_pool_cache_trim_event, ecf->pool_cache_trim);
+        }
+    }
+
+    // 为配置了slab_magazine的共享内存开启本worker的chunk缓存
+    if (ecf->slab_magazines.nelts) {
+        sm = ecf->slab_magazines.elts;
+
+        for (n = 0; n < ecf->slab_magazines.nelts; n++) {
+
+            part = &cycle->shared_memory.part;
+            shm_zone = part->elts;
+
+            for (i = 0; /* void */ ; i++) {
+
+                if (i >= part->nelts) {
+                    if (part->next == NULL) {
+                        shm_zone = NULL;
+                        break;
+                    }
+                    part = part->next;
+                    shm_zone = part->elts;
+                    i = 0;
+                }
+
+                if (shm_zone[i].shm.name.len == sm[n].name.len
+                    && ngx_strncmp(shm_zone[i].shm.name.data, sm[n].name.data,
+                                   sm[n].name.len)
+                       == 0)
+                {
+                    break;
+                }
+            }
+
+            if (shm_zone == NULL) {
+                ngx_log_error(NGX_LOG_WARN, cycle->log, 0,
+                              "slab_magazine: unknown zone \"%V\"",
+                              &sm[n].name);
+                continue;
+            }
+
+            if (ngx_slab_magazine_init((ngx_slab_pool_t *) shm_zone[i].shm.addr,
+                                       sm[n].size, cycle->log)
+                == NGX_ERROR)
+            {
+                return NGX_ERROR;
+            }
+        }
+    }
+
+    // 有共享内存时启动后台回收，每个worker都检查，空闲页足够时不会加锁
+    if (ecf->slab_reclaim_interval && cycle->shared_memory.part.nelts) {
+        ngx_slab_reclaim_event.handler = ngx_slab_reclaim_handler;
+        ngx_slab_reclaim_event.data = &ngx_slab_reclaim_conn;
+        ngx_slab_reclaim_event.log = cycle->log;
+        ngx_slab_reclaim_event.cancelable = 1;
+
+        ngx_add_timer(&ngx_slab_reclaim_event, ecf->slab_reclaim_interval);
+    }
+
     // 遍历事件模块，但只执行实际使用的事件模块对应初始化函数
     for (m = 0; cycle->modules[m]; m++) {
         if (cycle->modules[m]->type != NGX_EVENT_MODULE) {
@@ -1498,6 +1646,92 @@ ngx_event_debug_connection(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     return NGX_CONF_OK;
 }
 
+// 解析slab_magazine指令，共享内存要等到worker初始化时才按名字查找
+static char *
+ngx_event_slab_magazine(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_event_conf_t  *ecf = conf;
+
+    ngx_int_t                   n;
+    ngx_str_t                  *value;
+    ngx_event_slab_magazine_t  *sm;
+
+    value = cf->args->elts;
+
+    n = ngx_atoi(value[2].data, value[2].len);
+    if (n == NGX_ERROR || n == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid magazine size \"%V\"", &value[2]);
+        return NGX_CONF_ERROR;
+    }
+
+    sm = ngx_array_push(&ecf->slab_magazines);
+    if (sm == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    sm->name = value[1];
+    sm->size = n;
+
+    return NGX_CONF_OK;
+}
+
+
+static void
+ngx_event_process_exit(ngx_cycle_t *cycle)
+{
+    ngx_slab_magazine_flush(NULL);
+}
+
+
+// 释放回收缓存中整个周期都没有用到的内存池块，然后重新加入定时器
+static void
+ngx_pool_cache_trim_handler(ngx_event_t *ev)
+{
+    ngx_event_conf_t  *ecf;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_EVENT, ev->log, 0, "pool cache trim");
+
+    ngx_pool_cache_trim(0);
+
+    ecf = ngx_event_get_conf(ngx_cycle->conf_ctx, ngx_event_core_module);
+
+    ngx_add_timer(ev, ecf->pool_cache_trim);
+}
+
+// 遍历所有共享内存做后台回收，然后重新加入定时器
+static void
+ngx_slab_reclaim_handler(ngx_event_t *ev)
+{
+    ngx_uint_t         i;
+    ngx_shm_zone_t    *shm_zone;
+    ngx_list_part_t   *part;
+    ngx_event_conf_t  *ecf;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_EVENT, ev->log, 0, "slab reclaim");
+
+    part = (ngx_list_part_t *) &ngx_cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        (void) ngx_slab_reclaim((ngx_slab_pool_t *) shm_zone[i].shm.addr);
+    }
+
+    ecf = ngx_event_get_conf(ngx_cycle->conf_ctx, ngx_event_core_module);
+
+    ngx_add_timer(ev, ecf->slab_reclaim_interval);
+}
+
 // 创建event_core模块的配置结构体，成员初始化为unset
 static void *
 ngx_event_core_create_conf(ngx_cycle_t *cycle)
@@ -1515,6 +1749,18 @@ ngx_event_core_create_conf(ngx_cycle_t *cycle)
     ecf->accept_mutex = NGX_CONF_UNSET;
     ecf->accept_mutex_delay = NGX_CONF_UNSET_MSEC;
     ecf->name = (void *) NGX_CONF_UNSET;
+    ecf->pool_cache = NGX_CONF_UNSET_UINT;
+    ecf->pool_cache_trim = NGX_CONF_UNSET_MSEC;
+    ecf->slab_reclaim_interval = NGX_CONF_UNSET_MSEC;
+    ecf->timer_wheel = NGX_CONF_UNSET;
+    ecf->timer_defer = NGX_CONF_UNSET;
+
+    if (ngx_array_init(&ecf->slab_magazines, cycle->pool, 1,
+                       sizeof(ngx_event_slab_magazine_t))
+        != NGX_OK)
+    {
+        return NULL;
+    }
 
 #if (NGX_DEBUG)
 
@@ -1633,6 +1879,22 @@ ngx_event_core_init_conf(ngx_cycle_t *cycle, void *conf)
     ngx_conf_init_value(ecf->accept_mutex, 0);
     // 默认负载均衡锁的等待时间是500毫秒
     ngx_conf_init_msec_value(ecf->accept_mutex_delay, 500);
+    // 默认不缓存内存池块
+    ngx_conf_init_uint_value(ecf->pool_cache, 0);
+    ngx_conf_init_msec_value(ecf->pool_cache_trim, 10000);
+    ngx_conf_init_msec_value(ecf->slab_reclaim_interval, 1000);
+    // 默认还是用红黑树
+    ngx_conf_init_value(ecf->timer_wheel, 0);
+    ngx_conf_init_value(ecf->timer_defer, 0);
+
+#if (NGX_DEBUG)
+
+    //每个新连接都要查一次，整理成可以二分查找的形式
+    if (ngx_cidr_compile(&ecf->debug_connection) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+#endif
 
     return NGX_CONF_OK;
 }
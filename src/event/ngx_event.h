@@ -141,6 +141,8 @@ struct ngx_event_s {
 
     //定时器节点，用于定时器红黑树中
     ngx_rbtree_node_t   timer;
+    //真正的超时时间，timer_defer打开时往后推的超时只改它，timer.key不动，到期时再按它重新加入
+    ngx_msec_t          timer_deadline;
 
     /*
     post事件将会构成一个队列再统一处理，这个队列以next和prev作为链表指针，以此构成一个简易的双向链表，其中next指向后一个事件的地址，
@@ -482,6 +484,12 @@ extern ngx_os_io_t  ngx_io;
 #define NGX_EVENT_MODULE      0x544E5645  /* "EVNT" */
 #define NGX_EVENT_CONF        0x02000000
 
+/* slab_magazine指令的一项：共享内存的名字和每个slot缓存的chunk个数 */
+typedef struct {
+    ngx_str_t     name;
+    ngx_uint_t    size;
+} ngx_event_slab_magazine_t;
+
 /* 存储ngx_event_core_module事件模块配置项参数的结构体 ngx_event_conf_t */
 typedef struct {
     /* 连接池中最大连接数 */
@@ -500,6 +508,20 @@ typedef struct {
     /* 被使用事件模块的名称 */
     u_char       *name;
 
+    /* 每个worker缓存已销毁内存池块的个数上限(每个尺寸分级)，0表示不缓存 */
+    ngx_uint_t    pool_cache;
+    /* 定时释放缓存中长期空闲的内存池块的间隔 */
+    ngx_msec_t    pool_cache_trim;
+
+    /* 需要开启worker私有chunk缓存的共享内存，元素是ngx_event_slab_magazine_t */
+    ngx_array_t   slab_magazines;
+    /* 共享内存后台回收的检查间隔，0表示关闭 */
+    ngx_msec_t    slab_reclaim_interval;
+    /* 标志位，为1表示定时器用分层时间轮而不是红黑树 */
+    ngx_flag_t    timer_wheel;
+    /* 标志位，为1表示往后推迟的定时器先不移动，到期时再重新加入 */
+    ngx_flag_t    timer_defer;
+
 #if (NGX_DEBUG)
     /* 用于保存与输出调试级别日志连接对应客户端的地址信息 */
     ngx_array_t   debug_connection;
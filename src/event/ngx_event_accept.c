@@ -784,56 +784,51 @@ ngx_accept_log_error(ngx_log_t *log, u_char *buf, size_t len)
 static void
 ngx_debug_accepted_connection(ngx_event_conf_t *ecf, ngx_connection_t *c)
 {
-    struct sockaddr_in   *sin;
-    ngx_cidr_t           *cidr;
-    ngx_uint_t            i;
 #if (NGX_HAVE_INET6)
+    ngx_cidr_t           *cidr;
+    ngx_uint_t            i, n;
     struct sockaddr_in6  *sin6;
-    ngx_uint_t            n;
-#endif
 
-    cidr = ecf->debug_connection.elts;
-    for (i = 0; i < ecf->debug_connection.nelts; i++) {
-        if (cidr[i].family != (ngx_uint_t) c->sockaddr->sa_family) {
-            goto next;
-        }
+    /*
+     * ngx_cidr_match把IPv4映射的IPv6地址(::ffff:a.b.c.d)当成IPv4和IPv4的条目比较，
+     * debug_connection一直是按family比较的，这种连接只和IPv6的条目比较；
+     * 只有双栈监听才会有这种地址，逐个比较即可，AF_UNSPEC的头部family对不上会被跳过
+     */
+    if (c->sockaddr->sa_family == AF_INET6) {
+        sin6 = (struct sockaddr_in6 *) c->sockaddr;
 
-        switch (cidr[i].family) {
+        if (IN6_IS_ADDR_V4MAPPED(&sin6->sin6_addr)) {
+            cidr = ecf->debug_connection.elts;
 
-#if (NGX_HAVE_INET6)
-        case AF_INET6:
-            sin6 = (struct sockaddr_in6 *) c->sockaddr;
-            for (n = 0; n < 16; n++) {
-                if ((sin6->sin6_addr.s6_addr[n]
-                    & cidr[i].u.in6.mask.s6_addr[n])
-                    != cidr[i].u.in6.addr.s6_addr[n])
-                {
-                    goto next;
+            for (i = 0; i < ecf->debug_connection.nelts; i++) {
+                if (cidr[i].family != AF_INET6) {
+                    continue;
                 }
-            }
-            break;
-#endif
 
-#if (NGX_HAVE_UNIX_DOMAIN)
-        case AF_UNIX:
-            break;
-#endif
+                for (n = 0; n < 16; n++) {
+                    if ((sin6->sin6_addr.s6_addr[n]
+                        & cidr[i].u.in6.mask.s6_addr[n])
+                        != cidr[i].u.in6.addr.s6_addr[n])
+                    {
+                        break;
+                    }
+                }
 
-        default: /* AF_INET */
-            sin = (struct sockaddr_in *) c->sockaddr;
-            if ((sin->sin_addr.s_addr & cidr[i].u.in.mask)
-                != cidr[i].u.in.addr)
-            {
-                goto next;
+                if (n == 16) {
+                    c->log->log_level = NGX_LOG_DEBUG_CONNECTION
+                                        |NGX_LOG_DEBUG_ALL;
+                    return;
+                }
             }
-            break;
+
+            return;
         }
+    }
+#endif
 
+    //debug_connection在ngx_event_core_init_conf里已经用ngx_cidr_compile整理过
+    if (ngx_cidr_match(c->sockaddr, &ecf->debug_connection) == NGX_OK) {
         c->log->log_level = NGX_LOG_DEBUG_CONNECTION|NGX_LOG_DEBUG_ALL;
-        break;
-
-    next:
-        continue;
     }
 }
 
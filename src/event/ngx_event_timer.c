@@ -14,6 +14,42 @@ ngx_rbtree_t              ngx_event_timer_rbtree;
 // 定时器红黑树的哨兵节点
 static ngx_rbtree_node_t  ngx_event_timer_sentinel;
 
+
+/*
+ * 分层时间轮，精度1毫秒
+ * 第0层256个槽，每槽1毫秒，放256毫秒内到期的定时器，槽号是key & 255
+ * 第1~4层各64个槽，第n层每槽2^(8+6(n-1))毫秒，放2^(8+6n)毫秒内到期的，最大约49.7天，更远的先放在第4层
+ * 每走完第0层一圈(now是256的倍数)，把第1层当前槽里的定时器重新加入，它们会落到第0层或留在第1层，
+ * 第1层也走完一圈时再处理第2层，依次类推(和linux内核以前的timer wheel一样)
+ * 每个槽是以slots[i]为头的双向循环链表，bitmap记录哪些槽非空，用来跳过空槽和计算最近的超时时间
+ */
+#define NGX_TIMER_WHEEL_LEVELS  5
+#define NGX_TIMER_WHEEL_SIZE0   256
+#define NGX_TIMER_WHEEL_SIZE    64
+#define NGX_TIMER_WHEEL_SLOTS   (NGX_TIMER_WHEEL_SIZE0                         \
+                                 + (NGX_TIMER_WHEEL_LEVELS - 1)               \
+                                   * NGX_TIMER_WHEEL_SIZE)
+
+// 第n(>=1)层槽号的起始位置和每槽的位数
+#define ngx_timer_wheel_base(n)   (NGX_TIMER_WHEEL_SIZE0 + ((n) - 1) * NGX_TIMER_WHEEL_SIZE)
+#define ngx_timer_wheel_shift(n)  (8 + 6 * ((n) - 1))
+
+typedef struct {
+    ngx_msec_t         now;    //比它小的毫秒都已经处理过，它自己的槽在下次expire时还会再看一次
+    ngx_uint_t         count;
+    uint64_t           bitmap[NGX_TIMER_WHEEL_SLOTS / 64];
+    ngx_rbtree_node_t  slots[NGX_TIMER_WHEEL_SLOTS];
+} ngx_event_timer_wheel_t;
+
+ngx_uint_t                      ngx_event_timer_wheel;
+ngx_uint_t                      ngx_event_timer_defer;
+static ngx_event_timer_wheel_t  ngx_timer_wheel;
+
+
+static ngx_msec_t ngx_event_timer_wheel_find(void);
+static void ngx_event_timer_wheel_expire(void);
+static void ngx_event_timer_wheel_cascade(ngx_uint_t slot);
+
 /*
  * the event timer rbtree may contain the duplicate keys, however,
  * it should not be a problem, because we use the rbtree to find
@@ -23,12 +59,345 @@ static ngx_rbtree_node_t  ngx_event_timer_sentinel;
 ngx_int_t
 ngx_event_timer_init(ngx_log_t *log)
 {
+    ngx_uint_t  i;
+
     ngx_rbtree_init(&ngx_event_timer_rbtree, &ngx_event_timer_sentinel,
                     ngx_rbtree_insert_timer_value);
 
+    if (ngx_event_timer_wheel) {
+        ngx_memzero(ngx_timer_wheel.bitmap, sizeof(ngx_timer_wheel.bitmap));
+
+        for (i = 0; i < NGX_TIMER_WHEEL_SLOTS; i++) {
+            ngx_timer_wheel.slots[i].left = &ngx_timer_wheel.slots[i];
+            ngx_timer_wheel.slots[i].right = &ngx_timer_wheel.slots[i];
+        }
+
+        ngx_timer_wheel.now = ngx_current_msec;
+        ngx_timer_wheel.count = 0;
+
+        ngx_log_error(NGX_LOG_INFO, log, 0, "using timer wheel");
+    }
+
     return NGX_OK;
 }
 
+
+// word中第一个为1的位
+static ngx_inline ngx_uint_t
+ngx_event_timer_ffs(uint64_t word)
+{
+#if (__GNUC__)
+    return __builtin_ctzll(word);
+#else
+    ngx_uint_t  n;
+
+    for (n = 0; !(word & 1); n++) {
+        word >>= 1;
+    }
+
+    return n;
+#endif
+}
+
+
+// key应该放在哪个槽里，不晚于now的放在第0层的当前槽，下一次ngx_event_expire_timers就会处理
+static ngx_inline ngx_uint_t
+ngx_event_timer_wheel_slot(ngx_msec_t key)
+{
+    ngx_uint_t      n;
+    ngx_msec_int_t  diff;
+
+    diff = (ngx_msec_int_t) (key - ngx_timer_wheel.now);
+
+    if (diff < NGX_TIMER_WHEEL_SIZE0) {
+        return (diff < 0 ? ngx_timer_wheel.now : key)
+               & (NGX_TIMER_WHEEL_SIZE0 - 1);
+    }
+
+    for (n = 1; n < NGX_TIMER_WHEEL_LEVELS - 1; n++) {
+        if ((ngx_msec_t) diff < (ngx_msec_t) 1 << ngx_timer_wheel_shift(n + 1)) {
+            break;
+        }
+    }
+
+    //64位的ngx_msec_t超过第4层范围的，按范围内最远的位置放，重新加入时再算
+    if ((uint64_t) diff >> 32) {
+        key = ngx_timer_wheel.now + 0xffffffff;
+    }
+
+    return ngx_timer_wheel_base(n)
+           + ((key >> ngx_timer_wheel_shift(n)) & (NGX_TIMER_WHEEL_SIZE - 1));
+}
+
+
+// 加到槽的末尾，相同key先加入的先超时，和红黑树中一样
+static ngx_inline void
+ngx_event_timer_wheel_link(ngx_rbtree_node_t *node)
+{
+    ngx_uint_t          s;
+    ngx_rbtree_node_t  *head;
+
+    s = ngx_event_timer_wheel_slot(node->key);
+    head = &ngx_timer_wheel.slots[s];
+
+    node->parent = head;
+    node->right = head;
+    node->left = head->left;
+    head->left->right = node;
+    head->left = node;
+
+    ngx_timer_wheel.bitmap[s >> 6] |= (uint64_t) 1 << (s & 63);
+}
+
+
+void
+ngx_event_timer_wheel_add(ngx_rbtree_node_t *node)
+{
+    ngx_event_timer_wheel_link(node);
+    ngx_timer_wheel.count++;
+}
+
+
+void
+ngx_event_timer_wheel_del(ngx_rbtree_node_t *node)
+{
+    ngx_uint_t          s;
+    ngx_rbtree_node_t  *head;
+
+    node->left->right = node->right;
+    node->right->left = node->left;
+
+    head = node->parent;
+
+    if (head->right == head) {
+        s = head - ngx_timer_wheel.slots;
+        ngx_timer_wheel.bitmap[s >> 6] &= ~((uint64_t) 1 << (s & 63));
+    }
+
+    ngx_timer_wheel.count--;
+}
+
+
+// 把一个槽里的定时器全部取出来重新加入
+static void
+ngx_event_timer_wheel_cascade(ngx_uint_t slot)
+{
+    ngx_rbtree_node_t  *head, *node, *next;
+
+    head = &ngx_timer_wheel.slots[slot];
+
+    if (head->right == head) {
+        return;
+    }
+
+    node = head->right;
+    head->left->right = NULL;
+
+    head->left = head;
+    head->right = head;
+    ngx_timer_wheel.bitmap[slot >> 6] &= ~((uint64_t) 1 << (slot & 63));
+
+    for ( /* void */ ; node; node = next) {
+        next = node->right;
+        ngx_event_timer_wheel_link(node);
+    }
+}
+
+
+/*
+ * 返回值不会晚于最早的定时器：第0层里的定时器key是准确的；
+ * 只在更高层有定时器时返回下一次把它们往下移的时间，到时候epoll提前醒一次，移完再算
+ */
+static ngx_msec_t
+ngx_event_timer_wheel_find(void)
+{
+    uint64_t        word;
+    ngx_uint_t      n, i, idx, pos, shift;
+    ngx_msec_t      tick, best;
+    ngx_msec_int_t  timer;
+
+    if (ngx_timer_wheel.count == 0) {
+        return NGX_TIMER_INFINITE;
+    }
+
+    best = NGX_TIMER_INFINITE;
+    idx = ngx_timer_wheel.now & (NGX_TIMER_WHEEL_SIZE0 - 1);
+
+    //第0层先找当前这一圈里idx之后的，再找下一圈的
+    for (i = idx >> 6; i < NGX_TIMER_WHEEL_SIZE0 / 64; i++) {
+        word = ngx_timer_wheel.bitmap[i];
+
+        if (i == idx >> 6) {
+            word &= ~(uint64_t) 0 << (idx & 63);
+        }
+
+        if (word) {
+            best = (ngx_timer_wheel.now & ~(ngx_msec_t) (NGX_TIMER_WHEEL_SIZE0 - 1))
+                   + i * 64 + ngx_event_timer_ffs(word);
+            goto found;
+        }
+    }
+
+    for (i = 0; i <= idx >> 6; i++) {
+        word = ngx_timer_wheel.bitmap[i];
+
+        if (word) {
+            best = (ngx_timer_wheel.now | (NGX_TIMER_WHEEL_SIZE0 - 1)) + 1
+                   + i * 64 + ngx_event_timer_ffs(word);
+            break;
+        }
+    }
+
+    for (n = 1; n < NGX_TIMER_WHEEL_LEVELS; n++) {
+        word = ngx_timer_wheel.bitmap[ngx_timer_wheel_base(n) >> 6];
+
+        if (word == 0) {
+            continue;
+        }
+
+        //从当前槽的下一个开始转一圈，第一个非空槽在pos之后d个，它在第d个边界时被移下来
+        shift = ngx_timer_wheel_shift(n);
+        pos = ((ngx_timer_wheel.now >> shift) + 1) & 63;
+        word = (word >> pos) | (pos ? word << (64 - pos) : 0);
+
+        tick = ((ngx_timer_wheel.now >> shift) + 1 + ngx_event_timer_ffs(word))
+               << shift;
+
+        if (best == NGX_TIMER_INFINITE
+            || (ngx_msec_int_t) (tick - best) < 0)
+        {
+            best = tick;
+        }
+    }
+
+found:
+
+    timer = (ngx_msec_int_t) (best - ngx_current_msec);
+
+    return (ngx_msec_t) (timer > 0 ? timer : 0);
+}
+
+
+/*
+ * now一直走到ngx_current_msec，经过256的倍数时先把高层的定时器移下来，
+ * 第0层的空槽通过bitmap直接跳过。
+ * 处理完后now停在ngx_current_msec而不是它的下一毫秒，这样之后加入的key == ngx_current_msec的定时器
+ * 下次调用就会超时，和红黑树一样；这时now所在的槽会再处理一次，如果正好是256的倍数，
+ * 高层的当前槽也会再移一次。
+ * 再移一次不一定是空操作(比如超出最高层一圈范围、取模后落在最高层当前下标上的定时器)，但仍然是对的：
+ * cascade只是按它们的key和当前的now重新调用ngx_event_timer_wheel_link，
+ * 还没到期的会回到高层对应的槽，256毫秒内到期的落到第0层，
+ * 不会提前超时也不会丢，多出来的只是把这个槽再遍历一遍
+ */
+static void
+ngx_event_timer_wheel_expire(void)
+{
+    uint64_t            word;
+    ngx_uint_t          n, idx, s, i;
+    ngx_msec_t          tick;
+    ngx_event_t        *ev;
+    ngx_rbtree_node_t  *head, *node;
+
+    for ( ;; ) {
+
+        if (ngx_timer_wheel.count == 0) {
+            ngx_timer_wheel.now = ngx_current_msec;
+            return;
+        }
+
+        if ((ngx_msec_int_t) (ngx_current_msec - ngx_timer_wheel.now) < 0) {
+            return;
+        }
+
+        idx = ngx_timer_wheel.now & (NGX_TIMER_WHEEL_SIZE0 - 1);
+
+        if (idx == 0) {
+            for (n = 1; n < NGX_TIMER_WHEEL_LEVELS; n++) {
+                i = (ngx_timer_wheel.now >> ngx_timer_wheel_shift(n))
+                    & (NGX_TIMER_WHEEL_SIZE - 1);
+
+                ngx_event_timer_wheel_cascade(ngx_timer_wheel_base(n) + i);
+
+                if (i) {
+                    break;
+                }
+            }
+        }
+
+        //这一圈中idx之后第一个非空的槽
+        s = NGX_TIMER_WHEEL_SIZE0;
+
+        for (i = idx >> 6; i < NGX_TIMER_WHEEL_SIZE0 / 64; i++) {
+            word = ngx_timer_wheel.bitmap[i];
+
+            if (i == idx >> 6) {
+                word &= ~(uint64_t) 0 << (idx & 63);
+            }
+
+            if (word) {
+                s = i * 64 + ngx_event_timer_ffs(word);
+                break;
+            }
+        }
+
+        if (s == NGX_TIMER_WHEEL_SIZE0) {
+            //这一圈后面都是空的，直接到下一圈的开始，但不能超过当前时间，
+            //否则之后加入的定时器会按将来的now放，晚于应有的时间
+            tick = (ngx_timer_wheel.now | (NGX_TIMER_WHEEL_SIZE0 - 1)) + 1;
+
+            if ((ngx_msec_int_t) (tick - ngx_current_msec) > 0) {
+                ngx_timer_wheel.now = ngx_current_msec;
+                return;
+            }
+
+            ngx_timer_wheel.now = tick;
+            continue;
+        }
+
+        tick = (ngx_timer_wheel.now & ~(ngx_msec_t) (NGX_TIMER_WHEEL_SIZE0 - 1))
+               + s;
+
+        if ((ngx_msec_int_t) (tick - ngx_current_msec) > 0) {
+            ngx_timer_wheel.now = ngx_current_msec;
+            return;
+        }
+
+        //handler里新加的key <= tick的定时器也会加到这个槽，在这个循环里一起处理
+        ngx_timer_wheel.now = tick;
+        head = &ngx_timer_wheel.slots[s];
+
+        while (head->right != head) {
+            node = head->right;
+
+            ngx_event_timer_wheel_del(node);
+
+            ev = (ngx_event_t *) ((char *) node - offsetof(ngx_event_t, timer));
+
+            if ((ngx_msec_int_t) (ev->timer_deadline - ngx_current_msec) > 0) {
+                //推迟过的定时器，按真正的超时时间放到后面的槽里
+                node->key = ev->timer_deadline;
+                ngx_event_timer_wheel_add(node);
+                continue;
+            }
+
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                           "event timer del: %d: %M",
+                           ngx_event_ident(ev->data), ev->timer.key);
+
+            ev->timer_set = 0;
+            ev->timedout = 1;
+
+            ev->handler(ev);
+        }
+
+        if (tick == ngx_current_msec) {
+            return;
+        }
+
+        ngx_timer_wheel.now = tick + 1;
+    }
+}
+
 // 在红黑树里查找最小值，即最左边的节点，得到超时的时间差值
 // 如果时间已经超过了，那么时间差值就是0
 // 意味着在红黑树里已经有事件超时了，必须立即处理
@@ -42,6 +411,10 @@ ngx_event_find_timer(void)
     ngx_msec_int_t      timer;
     ngx_rbtree_node_t  *node, *root, *sentinel;
 
+    if (ngx_event_timer_wheel) {
+        return ngx_event_timer_wheel_find();
+    }
+
     // 红黑树是空的，没有任何定时事件
     if (ngx_event_timer_rbtree.root == &ngx_event_timer_sentinel) {
         return NGX_TIMER_INFINITE;
@@ -69,6 +442,11 @@ ngx_event_expire_timers(void)
     ngx_event_t        *ev;
     ngx_rbtree_node_t  *node, *root, *sentinel;
 
+    if (ngx_event_timer_wheel) {
+        ngx_event_timer_wheel_expire();
+        return;
+    }
+
     // 红黑树的哨兵
     sentinel = ngx_event_timer_rbtree.sentinel;
 
@@ -95,13 +473,24 @@ ngx_event_expire_timers(void)
         /* 获取超时的具体事件 */
         ev = (ngx_event_t *) ((char *) node - offsetof(ngx_event_t, timer));
 
+        /* 将已超时事件对象从现有定时器红黑树中移除 */
+        ngx_rbtree_delete(&ngx_event_timer_rbtree, &ev->timer);
+
+        /* timer_defer推迟过的定时器还没真正超时，按新的时间重新加入 */
+        if ((ngx_msec_int_t) (ev->timer_deadline - ngx_current_msec) > 0) {
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                           "event timer readd: %d: %M",
+                           ngx_event_ident(ev->data), ev->timer_deadline);
+
+            ev->timer.key = ev->timer_deadline;
+            ngx_rbtree_insert(&ngx_event_timer_rbtree, &ev->timer);
+            continue;
+        }
+
         ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
                        "event timer del: %d: %M",
                        ngx_event_ident(ev->data), ev->timer.key);
 
-        /* 将已超时事件对象从现有定时器红黑树中移除 */
-        ngx_rbtree_delete(&ngx_event_timer_rbtree, &ev->timer);
-
 #if (NGX_DEBUG)
         ev->timer.left = NULL;
         ev->timer.right = NULL;
@@ -123,9 +512,27 @@ ngx_event_expire_timers(void)
 ngx_int_t
 ngx_event_no_timers_left(void)
 {
+    ngx_uint_t          i;
     ngx_event_t        *ev;
     ngx_rbtree_node_t  *node, *root, *sentinel;
 
+    if (ngx_event_timer_wheel) {
+        for (i = 0; i < NGX_TIMER_WHEEL_SLOTS; i++) {
+            for (node = ngx_timer_wheel.slots[i].right;
+                 node != &ngx_timer_wheel.slots[i];
+                 node = node->right)
+            {
+                ev = (ngx_event_t *) ((char *) node - offsetof(ngx_event_t, timer));
+
+                if (!ev->cancelable) {
+                    return NGX_AGAIN;
+                }
+            }
+        }
+
+        return NGX_OK;
+    }
+
     sentinel = ngx_event_timer_rbtree.sentinel;
     root = ngx_event_timer_rbtree.root;
 
@@ -36,6 +36,16 @@ ngx_int_t ngx_event_no_timers_left(void);
 // 定时器红黑树，键值是超时时间（毫秒时间戳）
 extern ngx_rbtree_t  ngx_event_timer_rbtree;
 
+// 为1时用分层时间轮代替红黑树，由events块的timer_wheel指令设置，必须在ngx_event_timer_init之前
+extern ngx_uint_t    ngx_event_timer_wheel;
+
+// 时间轮的加入和删除，都是O(1)；节点还是ev->timer，key是超时时间，left/right/parent用作链表
+void ngx_event_timer_wheel_add(ngx_rbtree_node_t *node);
+void ngx_event_timer_wheel_del(ngx_rbtree_node_t *node);
+
+// 为1时超时往后推只更新ev->timer_deadline，由events块的timer_defer指令设置
+extern ngx_uint_t    ngx_event_timer_defer;
+
 /**
 定时事件的超时检测
 当需要对某个事件进行超时检测时，只需要将该事件添加到定时器红黑树中即可，由函数 ngx_event_add_timer，
@@ -50,7 +60,12 @@ ngx_event_del_timer(ngx_event_t *ev)
                     ngx_event_ident(ev->data), ev->timer.key);
 
     /* 从红黑树中移除指定事件的节点对象 */
-    ngx_rbtree_delete(&ngx_event_timer_rbtree, &ev->timer);
+    if (ngx_event_timer_wheel) {
+        ngx_event_timer_wheel_del(&ev->timer);
+
+    } else {
+        ngx_rbtree_delete(&ngx_event_timer_rbtree, &ev->timer);
+    }
 
 #if (NGX_DEBUG)
     ev->timer.left = NULL;
@@ -84,13 +99,28 @@ ngx_event_add_timer(ngx_event_t *ev, ngx_msec_t timer)
          */
 
         // 计算一下旧超时时间与新超时时间的差值
-        diff = (ngx_msec_int_t) (key - ev->timer.key);
+        diff = (ngx_msec_int_t) (key - ev->timer_deadline);
 
         // 减少对红黑树的操作，加快速度提高性能
         if (ngx_abs(diff) < NGX_TIMER_LAZY_DELAY) {
             ngx_log_debug3(NGX_LOG_DEBUG_EVENT, ev->log, 0,
                            "event timer: %d, old: %M, new: %M",
+                            ngx_event_ident(ev->data), ev->timer_deadline, key);
+            return;
+        }
+
+        /*
+         * 往后推的超时先不动节点，到期时ngx_event_expire_timers发现
+         * timer_deadline还没到，再按它重新加入；提前的超时还是要马上移动
+         */
+        if (ngx_event_timer_defer
+            && (ngx_msec_int_t) (key - ev->timer.key) >= 0)
+        {
+            ngx_log_debug3(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                           "event timer defer: %d, old: %M, new: %M",
                             ngx_event_ident(ev->data), ev->timer.key, key);
+
+            ev->timer_deadline = key;
             return;
         }
 
@@ -100,13 +130,19 @@ ngx_event_add_timer(ngx_event_t *ev, ngx_msec_t timer)
 
     // 设置事件的key
     ev->timer.key = key;
+    ev->timer_deadline = key;
 
     ngx_log_debug3(NGX_LOG_DEBUG_EVENT, ev->log, 0,
                    "event timer add: %d: %M:%M",
                     ngx_event_ident(ev->data), timer, ev->timer.key);
 
     // 加入红黑树
-    ngx_rbtree_insert(&ngx_event_timer_rbtree, &ev->timer);
+    if (ngx_event_timer_wheel) {
+        ngx_event_timer_wheel_add(&ev->timer);
+
+    } else {
+        ngx_rbtree_insert(&ngx_event_timer_rbtree, &ev->timer);
+    }
     // 设置事件的定时器标志
     ev->timer_set = 1;
 }